@@ -0,0 +1,276 @@
+/*
+ * Blocking time profiler.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The profiler accounts the wall clock time spent in the system calls
+ * that may block, keyed by the command name of the thread, the syscall,
+ * and the user space stack the syscall has been invoked from, when stack
+ * tracing is enabled.  On exit, the profile is written in the folded
+ * stack format, one line per key with the time in microseconds, ready
+ * to be rendered as an off-CPU flame graph.
+ */
+
+#include "defs.h"
+#include "sen.h"
+
+bool blocking_profile;
+
+static FILE *blocking_profile_fp;
+
+struct blocking_key {
+	char comm[PROC_COMM_LEN];
+	const char *sys_name;
+	size_t stack_id;
+};
+
+struct blocking_stats {
+	struct blocking_key key;
+	bool used;
+	uint64_t count;
+	struct timespec total;
+};
+
+/* Open addressing hash table of blocking_stats.  */
+static struct blocking_stats *stats;
+static size_t stats_size;
+static size_t stats_count;
+
+static bool
+is_blocking_syscall(const struct tcb *tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	/* Reads and writes of pipes, sockets, and terminals.  */
+	case SEN_read:
+	case SEN_readv:
+	case SEN_pread:
+	case SEN_preadv:
+	case SEN_preadv2:
+	case SEN_write:
+	case SEN_writev:
+	case SEN_pwrite:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_splice:
+	case SEN_tee:
+	case SEN_vmsplice:
+	case SEN_sendfile:
+	case SEN_sendfile64:
+	case SEN_copy_file_range:
+	/* Sockets.  */
+	case SEN_accept:
+	case SEN_accept4:
+	case SEN_connect:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+	case SEN_recvmmsg:
+	case SEN_recvmmsg_time32:
+	case SEN_recvmmsg_time64:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+	case SEN_sendmmsg:
+	/* Multiplexing.  */
+	case SEN_select:
+	case SEN_oldselect:
+	case SEN_pselect6_time32:
+	case SEN_pselect6_time64:
+	case SEN_poll_time32:
+	case SEN_poll_time64:
+	case SEN_ppoll_time32:
+	case SEN_ppoll_time64:
+	case SEN_epoll_wait:
+	case SEN_epoll_pwait:
+	case SEN_epoll_pwait2:
+	case SEN_io_getevents_time32:
+	case SEN_io_getevents_time64:
+	case SEN_io_pgetevents_time32:
+	case SEN_io_pgetevents_time64:
+	case SEN_io_uring_enter:
+	/* Synchronization.  */
+	case SEN_futex_time32:
+	case SEN_futex_time64:
+	case SEN_futex_wait:
+	case SEN_futex_waitv:
+	case SEN_flock:
+	case SEN_msgrcv:
+	case SEN_msgsnd:
+	case SEN_semop:
+	case SEN_semtimedop:
+	case SEN_semtimedop_time32:
+	case SEN_semtimedop_time64:
+	case SEN_mq_timedreceive_time32:
+	case SEN_mq_timedreceive_time64:
+	case SEN_mq_timedsend_time32:
+	case SEN_mq_timedsend_time64:
+	/* Sleeps and waits.  */
+	case SEN_nanosleep_time32:
+	case SEN_nanosleep_time64:
+	case SEN_clock_nanosleep_time32:
+	case SEN_clock_nanosleep_time64:
+	case SEN_restart_syscall:
+	case SEN_pause:
+	case SEN_sigsuspend:
+	case SEN_rt_sigsuspend:
+	case SEN_rt_sigtimedwait_time32:
+	case SEN_rt_sigtimedwait_time64:
+	case SEN_wait4:
+	case SEN_waitid:
+	case SEN_waitpid:
+	/* Storage.  */
+	case SEN_fsync:
+	case SEN_fdatasync:
+	case SEN_msync:
+	case SEN_sync:
+	case SEN_syncfs:
+	case SEN_sync_file_range:
+	case SEN_sync_file_range2:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static size_t
+key_hash(const struct blocking_key *key)
+{
+	uint64_t h = ((uintptr_t) key->sys_name * 0x9e3779b97f4a7c15ULL)
+		     ^ (key->stack_id * 0xff51afd7ed558ccdULL);
+
+	for (const char *p = key->comm; *p; ++p) {
+		h ^= (unsigned char) *p;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h ^ (h >> 32);
+}
+
+static bool
+key_equal(const struct blocking_key *a, const struct blocking_key *b)
+{
+	return a->sys_name == b->sys_name && a->stack_id == b->stack_id
+	       && !strcmp(a->comm, b->comm);
+}
+
+static struct blocking_stats *stats_get(const struct blocking_key *);
+
+static void
+stats_grow(void)
+{
+	struct blocking_stats *old = stats;
+	const size_t old_size = stats_size;
+
+	stats_size = old_size ? old_size * 2 : 64;
+	stats = xcalloc(stats_size, sizeof(*stats));
+	stats_count = 0;
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old[i].used)
+			*stats_get(&old[i].key) = old[i];
+	}
+
+	free(old);
+}
+
+/* Finds the element with the key, creating a zeroed one if missing.  */
+static struct blocking_stats *
+stats_get(const struct blocking_key *key)
+{
+	if ((stats_count + 1) * 2 > stats_size)
+		stats_grow();
+
+	for (size_t i = key_hash(key);; ++i) {
+		struct blocking_stats *e = &stats[i & (stats_size - 1)];
+
+		if (!e->used) {
+			e->key = *key;
+			e->used = true;
+			++stats_count;
+			return e;
+		}
+
+		if (key_equal(&e->key, key))
+			return e;
+	}
+}
+
+void
+blocking_profile_exiting(struct tcb *tcp, const struct timespec *ts)
+{
+	if (!is_blocking_syscall(tcp))
+		return;
+
+	struct blocking_key key = {
+		.sys_name = tcp_sysent(tcp)->sys_name,
+	};
+	struct timespec dt;
+
+	strcpy(key.comm, tcp->comm);
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_mode)
+		key.stack_id = unwind_tcb_stack_id(tcp);
+#endif
+
+	struct blocking_stats *e = stats_get(&key);
+
+	ts_sub(&dt, ts, &tcp->etime);
+	ts_add(&e->total, &e->total, &dt);
+	++e->count;
+}
+
+static int
+stats_cmp(const void *a, const void *b)
+{
+	const struct blocking_stats *ea = *(void * const *) a;
+	const struct blocking_stats *eb = *(void * const *) b;
+
+	return ts_cmp(&eb->total, &ea->total);
+}
+
+void
+blocking_profile_summary(void)
+{
+	FILE *fp = blocking_profile_fp;
+	const struct blocking_stats **list =
+		xcalloc(stats_count + 1, sizeof(*list));
+	size_t n = 0;
+
+	for (size_t i = 0; i < stats_size; ++i) {
+		if (stats[i].used)
+			list[n++] = &stats[i];
+	}
+
+	qsort(list, n, sizeof(*list), stats_cmp);
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct blocking_stats *e = list[i];
+		const uint64_t us = e->total.tv_sec * 1000000ULL
+				    + e->total.tv_nsec / 1000;
+
+		if (!us)
+			continue;
+
+		fputs(e->key.comm[0] ? e->key.comm : "[unknown]", fp);
+#ifdef ENABLE_STACKTRACE
+		unwind_fprint_folded(fp, e->key.stack_id);
+#endif
+		fprintf(fp, ";%s %" PRIu64 "\n", e->key.sys_name, us);
+	}
+
+	free(list);
+	if (fclose(fp))
+		perror_msg("fclose");
+}
+
+void
+blocking_profile_init(FILE *fp)
+{
+	blocking_profile = true;
+	blocking_profile_fp = fp;
+}
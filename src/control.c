@@ -0,0 +1,365 @@
+/*
+ * Runtime control socket.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * With --control=SOCKET, strace listens on a unix stream socket and
+ * serves one client at a time from its main loop.  The protocol is line
+ * based: every command line is answered with zero or more lines of output
+ * followed by an "ok" or "error" line.  The commands are:
+ *
+ *   set EXPR		apply -e EXPR, e.g. "set trace=%file"
+ *   path add PATH	add PATH to the -P set
+ *   path clear		clear the -P set
+ *   output on|off	resume or pause tracing of syscalls
+ *   summary		print the -c summary collected so far
+ *   stats		print tracer statistics
+ *   help		list the commands
+ *
+ * As the qualifiers die on invalid expressions, every expression is tried
+ * in a child process first, so a typo cannot kill the tracer.
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "filter_seccomp.h"
+#include "number_set.h"
+
+#define CONTROL_LINE_MAX	4096
+
+bool output_paused;
+
+static const char *control_path;
+static int listen_fd = -1;
+static int client_fd = -1;
+static FILE *client_fp;
+static char line_buf[CONTROL_LINE_MAX];
+static size_t line_len;
+
+/* Writes to the client must not raise SIGPIPE in the tracer.  */
+static ssize_t
+client_write(void *cookie, const char *buf, size_t size)
+{
+	return send(*(int *) cookie, buf, size, MSG_NOSIGNAL);
+}
+
+static void
+close_client(void)
+{
+	if (client_fp)
+		fclose(client_fp);
+	if (client_fd >= 0)
+		close(client_fd);
+	client_fp = NULL;
+	client_fd = -1;
+	line_len = 0;
+}
+
+/* Tries to apply the expression in a child process.  */
+static bool
+check_qualify(const char *expr)
+{
+	fflush(NULL);
+
+	const pid_t pid = fork();
+
+	if (pid < 0) {
+		fprintf(client_fp, "fork: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (!pid) {
+		/* Do not leave SIGCHLD blocked by wait4_or_timers.  */
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+		/* Let the client see the error message.  */
+		dup2(client_fd, STDERR_FILENO);
+		qualify(expr);
+		_exit(0);
+	}
+
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			fprintf(client_fp, "waitpid: %s\n", strerror(errno));
+			return false;
+		}
+	}
+
+	return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+/* Returns true if the syscall set of the expression has widened.  */
+static bool
+trace_set_widened(const struct number_set *old_set)
+{
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (is_number_in_set_array(i, trace_set, p)
+			    && !is_number_in_set_array(i, old_set, p))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+control_set(const char *expr)
+{
+	if (!check_qualify(expr))
+		return false;
+
+	struct number_set *old_set =
+		alloc_number_set_array(SUPPORTED_PERSONALITIES);
+
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (is_number_in_set_array(i, trace_set, p))
+				add_number_to_set_array(i, old_set, p);
+		}
+	}
+
+	qualify(expr);
+
+	/* Injection counters restart with the new injection settings.  */
+	if (inject_set)
+		reset_tcb_inject_vecs();
+
+	if (seccomp_filtering && trace_set_widened(old_set))
+		fputs("the seccomp-bpf filter cannot be widened, syscalls"
+		      " that are not stopped at are not traced\n", client_fp);
+
+	free_number_set_array(old_set, SUPPORTED_PERSONALITIES);
+	return true;
+}
+
+static bool
+control_path_cmd(const char *arg)
+{
+	if (!strcmp(arg, "clear")) {
+		pathtrace_clear();
+		return true;
+	}
+
+	const char *path = STR_STRIP_PREFIX(arg, "add ");
+
+	if (path == arg || !*path) {
+		fputs("usage: path add PATH | path clear\n", client_fp);
+		return false;
+	}
+
+	pathtrace_select(path);
+	return true;
+}
+
+static bool
+control_output(const char *arg)
+{
+	if (!strcmp(arg, "on")) {
+		output_paused = false;
+	} else if (!strcmp(arg, "off")) {
+		output_paused = true;
+	} else {
+		fputs("usage: output on|off\n", client_fp);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+control_summary(void)
+{
+	if (!cflag) {
+		fputs("the summary requires -c or -C option\n", client_fp);
+		return false;
+	}
+
+	call_summary(client_fp);
+	return true;
+}
+
+static bool
+control_help(void)
+{
+	fputs("set EXPR\n"
+	      "path add PATH\n"
+	      "path clear\n"
+	      "output on|off\n"
+	      "summary\n"
+	      "stats\n"
+	      "help\n", client_fp);
+	return true;
+}
+
+static void
+run_command(char *cmd)
+{
+	const size_t len = strlen(cmd);
+	const char *arg;
+	bool ok;
+
+	if (len && cmd[len - 1] == '\r')
+		cmd[len - 1] = '\0';
+
+	arg = strchr(cmd, ' ');
+	if (arg) {
+		cmd[arg - cmd] = '\0';
+		for (++arg; *arg == ' '; ++arg)
+			;
+	} else {
+		arg = "";
+	}
+
+	debug_msg("control: %s %s", cmd, arg);
+
+	if (!*cmd)
+		return;
+
+	if (!strcmp(cmd, "set") && *arg) {
+		ok = control_set(arg);
+	} else if (!strcmp(cmd, "path")) {
+		ok = control_path_cmd(arg);
+	} else if (!strcmp(cmd, "output")) {
+		ok = control_output(arg);
+	} else if (!strcmp(cmd, "summary")) {
+		ok = control_summary();
+	} else if (!strcmp(cmd, "stats")) {
+		print_tracer_stats(client_fp);
+		ok = true;
+	} else if (!strcmp(cmd, "help")) {
+		ok = control_help();
+	} else {
+		fprintf(client_fp, "unknown command '%s'\n", cmd);
+		ok = false;
+	}
+
+	fputs(ok ? "ok\n" : "error\n", client_fp);
+}
+
+static void
+read_commands(void)
+{
+	for (;;) {
+		const ssize_t n = read(client_fd, line_buf + line_len,
+				       sizeof(line_buf) - line_len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			break;
+		if (n <= 0) {
+			close_client();
+			return;
+		}
+
+		line_len += n;
+
+		char *start = line_buf;
+		char *const end = line_buf + line_len;
+		char *nl;
+
+		while ((nl = memchr(start, '\n', end - start))) {
+			*nl = '\0';
+			run_command(start);
+			start = nl + 1;
+		}
+
+		line_len = end - start;
+		memmove(line_buf, start, line_len);
+
+		if (line_len == sizeof(line_buf)) {
+			fputs("command is too long\nerror\n", client_fp);
+			close_client();
+			return;
+		}
+	}
+
+	if (fflush(client_fp))
+		close_client();
+}
+
+int
+control_get_fd(void)
+{
+	return client_fd >= 0 ? client_fd : listen_fd;
+}
+
+void
+control_handle(void)
+{
+	if (client_fd >= 0) {
+		read_commands();
+		return;
+	}
+
+	client_fd = accept4(listen_fd, NULL, NULL,
+			    SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			perror_msg("accept: %s", control_path);
+		return;
+	}
+
+	static const cookie_io_functions_t io_funcs = {
+		.write = client_write,
+	};
+
+	client_fp = fopencookie(&client_fd, "w", io_funcs);
+	if (!client_fp) {
+		perror_msg("fopencookie");
+		close(client_fd);
+		client_fd = -1;
+	}
+}
+
+void
+control_finish(void)
+{
+	if (listen_fd < 0)
+		return;
+
+	close_client();
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(control_path);
+}
+
+void
+control_init(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		error_msg_and_die("%s: %s", path, strerror(ENAMETOOLONG));
+	strcpy(addr.sun_path, path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			   0);
+	if (listen_fd < 0)
+		perror_msg_and_die("socket");
+
+	/* The socket allows injecting faults into tracees.  */
+	const mode_t old_mask = umask(077);
+	const int rc = bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(old_mask);
+
+	if (rc || listen(listen_fd, 1))
+		perror_msg_and_die("%s", path);
+
+	control_path = path;
+}
@@ -15,6 +15,7 @@
  */
 
 #include "defs.h"
+#include "sample.h"
 #include "xstring.h"
 
 #include <stdarg.h>
@@ -599,6 +600,66 @@ calc_summary_stats(struct summary_stats *stats, struct call_counts *cc, const ch
 	stats->sc_name_max = MAX(stats->sc_name_max, strlen(sys_name));
 }
 
+static void
+ts_scale(struct timespec *ts, double scale)
+{
+	const double t = ts_float(ts) * scale;
+
+	ts->tv_sec = t;
+	ts->tv_nsec = (t - ts->tv_sec) * 1e9;
+}
+
+/* Turns the counts of the sampled syscalls into estimated totals.  */
+static void
+scale_call_counts(struct call_counts *cc, kernel_ulong_t scno)
+{
+	const double scale = sample_scale(scno);
+
+	cc->calls = cc->calls * scale + 0.5;
+	cc->errors = cc->errors * scale + 0.5;
+	ts_scale(&cc->time, scale);
+	ts_scale(&cc->wall_time, scale);
+}
+
+/*
+ * Replaces the counts of the current personality with copies scaled
+ * into estimated totals, so that the accumulators are left untouched
+ * and the summary can be printed more than once.
+ * The copies are freed by unscale_counts.
+ */
+static void
+scale_counts(struct unknown_call_bucket *scaled_unknown)
+{
+	counts = xarraydup(counts, nsyscalls, sizeof(*counts));
+	for (size_t i = 0; i < nsyscalls; ++i)
+		scale_call_counts(&counts[i], i);
+
+	if (!unknown_counts)
+		return;
+
+	*scaled_unknown = *unknown_counts;
+	scaled_unknown->entries = xarraydup(unknown_counts->entries,
+					    unknown_counts->len,
+					    sizeof(*unknown_counts->entries));
+	unknown_counts = scaled_unknown;
+	for (size_t i = 0; i < unknown_counts->len; ++i)
+		scale_call_counts(&unknown_counts->entries[i].call_counts,
+				  unknown_counts->entries[i].scno);
+}
+
+static void
+unscale_counts(struct call_counts *saved_counts,
+	       struct unknown_call_bucket *saved_unknown)
+{
+	free(counts);
+	counts = saved_counts;
+
+	if (unknown_counts != saved_unknown) {
+		free(unknown_counts->entries);
+		unknown_counts = saved_unknown;
+	}
+}
+
 static void
 call_summary_pers(FILE *outf)
 {
@@ -609,6 +670,12 @@ call_summary_pers(FILE *outf)
 	kernel_ulong_t *indices;
 	size_t indices_size = nsyscalls + get_unknown_bucket_size();
 	size_t last_column = 0;
+	struct call_counts *const saved_counts = counts;
+	struct unknown_call_bucket *const saved_unknown = unknown_counts;
+	struct unknown_call_bucket scaled_unknown;
+
+	if (sampling_enabled())
+		scale_counts(&scaled_unknown);
 
 	struct summary_stats stats = {
 		.tv_cum      	 = zero_ts,
@@ -849,6 +916,9 @@ call_summary_pers(FILE *outf)
 	}
 	fputc('\n', outf);
 
+	if (sampling_enabled())
+		unscale_counts(saved_counts, saved_unknown);
+
 #undef PC_
 #undef FC_
 }
@@ -858,6 +928,10 @@ call_summary(FILE *outf)
 {
 	const unsigned int old_pers = current_personality;
 
+	if (sampling_enabled())
+		fputs("System call counts and times are estimated"
+		      " from sampled system calls\n", outf);
+
 	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
 		if (!countv[i])
 			continue;
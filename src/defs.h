@@ -292,6 +292,8 @@ struct tcb {
 	struct timespec atime;	/* System time right after attach */
 	struct timespec etime;	/* Syscall entry time (CLOCK_MONOTONIC) */
 	struct timespec delay_expiration_time; /* When does the delay end */
+	size_t delay_heap_idx;	/* Position in the heap of delayed tcbs */
+	uint64_t delay_rng_state; /* State of the delay PRNG, 0 if unseeded */
 
 	/*
 	 * The ID of the PID namespace of this process
@@ -300,11 +302,14 @@ struct tcb {
 	 */
 	unsigned int pid_ns;
 
+	int tgid;		/* Thread group id, 0 if not known yet */
+
 # ifdef ENABLE_SECONTEXT
 	int last_dirfd; /* Use AT_FDCWD for 'not set' */
 # endif
 
 	struct mmap_cache_t *mmap_cache;
+	unsigned int mmap_cache_generation;
 
 	/*
 	 * Data that is stored during process wait traversal.
@@ -314,7 +319,13 @@ struct tcb {
 	size_t wait_data_idx;
 	/** Wait data storage for a delayed process. */
 	struct tcb_wait_data *delayed_wait_data;
+	/** Links the tcb into the wait list, or into the free list if free. */
 	struct list_item wait_list;
+	/** Links the tcb into the list of tracees paused by the duty cycle. */
+	struct list_item sample_list;
+
+	struct tcb_slab *slab;	/* The slab this tcb is allocated from */
+	size_t tcbtab_idx;	/* Position in tcbtab while in use */
 
 
 # ifdef HAVE_LINUX_KVM_H
@@ -372,6 +383,14 @@ struct tcb {
 						 * attached.
 						 */
 # define TCP_AFTER_KVM_RUN		0x80000	/* The process has returned from KVM_RUN ioctl */
+# define TCB_ENTRY_ONLY			0x100000	/* The current syscall has been
+						 * printed on entering,
+						 * its exit is not printed.
+						 */
+# define TCB_SAMPLE_PAUSED		0x200000	/* The tracee runs without
+						 * syscall stops until the next
+						 * duty cycle window.
+						 */
 
 /* qualifier flags */
 # define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -379,6 +398,7 @@ struct tcb {
 # define QUAL_VERBOSE	0x004	/* decode the structures of this syscall */
 # define QUAL_RAW	0x008	/* print all args in hex for this syscall */
 # define QUAL_INJECT	0x010	/* tamper with this system call on purpose */
+# define QUAL_ENTRY_ONLY 0x020	/* print this system call on entering only */
 
 # define DEFAULT_QUAL_FLAGS (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE)
 
@@ -390,6 +410,7 @@ struct tcb {
 # define abbrev(tcp)	((tcp)->qual_flg & QUAL_ABBREV)
 # define raw(tcp)	((tcp)->qual_flg & QUAL_RAW)
 # define inject(tcp)	((tcp)->qual_flg & QUAL_INJECT)
+# define entry_only(tcp)	((tcp)->qual_flg & QUAL_ENTRY_ONLY)
 # define filtered(tcp)	((tcp)->flags & TCB_FILTERED)
 # define hide_log(tcp)	((tcp)->flags & TCB_HIDE_LOG)
 # define check_exec_syscall(tcp)	((tcp)->flags & TCB_CHECK_EXEC_SYSCALL)
@@ -555,10 +576,12 @@ enum xflag_opts {
 extern unsigned xflag;
 extern bool followfork;
 extern bool output_separately;
+extern bool output_segmented;
 enum stack_trace_modes {
 	STACK_TRACE_OFF,
 	STACK_TRACE_ON,
 	STACK_TRACE_WITH_SRCINFO,
+	STACK_TRACE_DEFERRED,
 };
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
@@ -573,8 +596,10 @@ enum decode_kvm_run_structure_modes {
 };
 # ifdef HAVE_LINUX_KVM_H
 extern enum decode_kvm_run_structure_modes decode_kvm_run_structure;
+extern bool kvm_run_stats;
 # else
 #  define decode_kvm_run_structure DECODE_KVM_RUN_STRUCTURE_OFF
+#  define kvm_run_stats false
 # endif
 extern unsigned max_strlen;
 extern unsigned os_release;
@@ -850,6 +875,7 @@ extern const char *signame(const int);
 extern const char *sprintsigname(const int);
 
 extern void pathtrace_select_set(const char *, struct path_set *);
+extern void pathtrace_clear_set(struct path_set *);
 extern bool pathtrace_match_set(struct tcb *, struct path_set *,
 				struct number_set *);
 
@@ -859,6 +885,12 @@ pathtrace_select(const char *path)
 	return pathtrace_select_set(path, &global_path_set);
 }
 
+static inline void
+pathtrace_clear(void)
+{
+	pathtrace_clear_set(&global_path_set);
+}
+
 static inline bool
 pathtrace_match(struct tcb *tcp)
 {
@@ -891,6 +923,7 @@ getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
+extern char *getfd_description(struct tcb *, int);
 
 extern const char *xlookup(const struct xlat *, const uint64_t);
 extern const char *xlookup_le(const struct xlat *, uint64_t *);
@@ -1206,6 +1239,71 @@ extern kernel_ulong_t *
 fetch_indirect_syscall_args(struct tcb *, kernel_ulong_t addr, unsigned int n_args);
 
 extern void pidns_init(void);
+/** Drops cached PID namespace data of the tracee that is going away. */
+extern void pidns_forget_tcb(struct tcb *);
+
+extern bool decode_io_uring_rings;
+extern void io_uring_rings_init(void);
+extern void io_uring_rings_entering(struct tcb *);
+extern void io_uring_rings_exiting(struct tcb *);
+extern bool io_uring_rings_syscall(unsigned int sen);
+extern void io_uring_rings_forget_tcb(struct tcb *);
+extern void io_uring_rings_summary(FILE *);
+
+extern bool futex_profile;
+extern void futex_profile_init(void);
+extern void futex_profile_entering(struct tcb *);
+extern void futex_profile_exiting(struct tcb *);
+extern void futex_profile_summary(FILE *);
+
+extern bool blocking_profile;
+extern void blocking_profile_init(FILE *);
+extern void blocking_profile_exiting(struct tcb *, const struct timespec *);
+extern void blocking_profile_summary(void);
+
+extern bool poll_profile;
+extern void poll_profile_init(void);
+extern void poll_profile_entering(struct tcb *);
+extern void poll_profile_exiting(struct tcb *);
+extern void poll_profile_summary(FILE *);
+
+extern bool output_paused;
+extern void control_init(const char *path);
+extern int control_get_fd(void);
+extern void control_handle(void);
+extern void control_finish(void);
+extern void print_tracer_stats(FILE *);
+extern void reset_tcb_inject_vecs(void);
+
+extern bool output_compress;
+extern void output_compress_init(const char *arg);
+extern FILE *output_compress_open(FILE *);
+extern void output_compress_flush_later(void);
+extern void output_compress_tick(void);
+extern int output_compress_timeout(void);
+
+extern bool file_summary;
+extern void file_summary_init(void);
+extern void file_summary_exiting(struct tcb *, const struct timespec *);
+extern void file_summary_summary(FILE *);
+
+struct rusage;
+extern bool process_summary;
+extern bool process_summary_init(const char *format);
+extern void process_summary_start(struct tcb *);
+extern void process_summary_entering(struct tcb *);
+extern void process_summary_exiting(struct tcb *);
+extern bool process_summary_syscall(unsigned int sen);
+extern void process_summary_exited(struct tcb *, int status,
+				   const struct rusage *);
+extern void process_summary_summary(FILE *);
+
+extern void segmented_log_init(FILE *, const char *);
+extern FILE *segmented_log_open(unsigned int pid);
+extern void segmented_log_flush(void);
+extern void segmented_log_finish(void);
+
+extern int merge_logs(const char *prefix);
 
 /**
  * Returns PID as present in /proc of the tracer (can be different from tracee
@@ -1338,6 +1436,14 @@ extern size_t proc_status_get_id_list(int proc_pid,
 				      int *id_buf, size_t id_buf_size,
 				      const char *str, size_t str_size);
 
+/**
+ * Returns the thread group ID of the task with the given PID (as present
+ * in /proc), or the PID itself if the thread group ID cannot be obtained.
+ */
+extern int proc_status_get_tgid(int proc_pid);
+extern int get_tcb_tgid(struct tcb *);
+extern bool is_tgid_traced(int tgid, const struct tcb *except);
+
 /**
  * Print file descriptor fd owned by process with ID pid (from the PID NS
  * of the tracee).
@@ -1463,6 +1569,7 @@ extern void qualify_trace_fd(const char *);
 extern void qualify_abbrev(const char *);
 extern void qualify_verbose(const char *);
 extern void qualify_raw(const char *);
+extern void qualify_entry_only(const char *);
 extern void qualify_signals(const char *);
 extern void qualify_status(const char *);
 extern void qualify_quiet(const char *);
@@ -1627,12 +1734,19 @@ extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
 extern void unwind_tcb_discard(struct tcb *);
+extern void unwind_print_deferred(FILE *);
+extern size_t unwind_tcb_stack_id(struct tcb *);
+extern void unwind_fprint_folded(FILE *, size_t);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
 extern void kvm_run_structure_decoder_init(enum decode_kvm_run_structure_modes);
 extern void kvm_vcpu_info_free(struct tcb *);
 extern void kvm_run_structure_decode(struct tcb *);
+extern void kvm_run_stats_init(void);
+extern void kvm_run_stats_entering(struct tcb *);
+extern void kvm_run_stats_exiting(struct tcb *);
+extern void kvm_run_stats_summary(FILE *);
 # endif
 
 extern void namespace_auxstr_init(void);
@@ -1798,10 +1912,20 @@ extern void tprintf_comment(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2
 extern void tprints_comment(const char *str);
 
 /*
- * Staging output for status qualifier.
+ * Staging output for status qualifier and --collapse-repeats.
  */
-extern FILE *strace_open_memstream(struct tcb *tcp);
-extern void strace_close_memstream(struct tcb *tcp, bool publish);
+extern bool collapse_repeats;
+extern bool stage_output_active(const struct tcb *);
+extern void stage_output_begin(struct tcb *);
+extern void stage_output_mark_body(struct tcb *);
+extern void stage_output_skip_begin(struct tcb *);
+extern void stage_output_skip_end(struct tcb *);
+extern void stage_output_flush_repeats(struct tcb *);
+extern void stage_output_write(struct tcb *, const char *str, size_t len);
+extern int stage_output_vprintf(struct tcb *, const char *fmt, va_list)
+	ATTRIBUTE_FORMAT((printf, 2, 0));
+extern void stage_output_end(struct tcb *, bool publish);
+extern void stage_output_free(struct tcb *);
 
 static inline void
 printaddr_comment(const kernel_ulong_t addr)
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2018-2021 The strace developers.
+ * Copyright (c) 2018-2026 The strace developers.
  * All rights reserved.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
@@ -8,17 +8,47 @@
 #include "defs.h"
 #include "delay.h"
 
+#include <math.h>
+#include <sys/timerfd.h>
+
+enum delay_distr_type {
+	DELAY_FIXED,
+	DELAY_UNIFORM,
+	DELAY_EXPONENTIAL,
+	DELAY_LOGNORMAL,
+	DELAY_PARETO,
+	DELAY_EMPIRICAL,
+};
+
+struct delay_distr {
+	enum delay_distr_type type;
+	/* Fixed delay, minimum, mean, median, or scale, in nanoseconds.  */
+	double value;
+	/* Maximum of uniform, sigma of lognormal, or alpha of Pareto.  */
+	double param;
+	/* Delays of the empirical distribution and their cumulative weights. */
+	struct timespec *values;
+	uint64_t *weights;
+	size_t count;
+};
+
 struct inject_delay_data {
-	struct timespec ts_enter;
-	struct timespec ts_exit;
+	struct delay_distr enter;
+	struct delay_distr exit;
 };
 
 static struct inject_delay_data *delay_data_vec;
 static size_t delay_data_vec_capacity; /* size of the arena */
 static size_t delay_data_vec_size;     /* size of the used arena */
 
-static timer_t delay_timer = (timer_t) -1;
-static bool delay_timer_is_armed;
+/* Min-heap of delayed tcbs ordered by their delay_expiration_time.  */
+static struct tcb **delay_heap;
+static size_t delay_heap_capacity;
+static size_t delay_heap_size;
+
+static int delay_timer_fd = -1;
+/* The expiration time the timer is armed for, zero if disarmed.  */
+static struct timespec delay_timer_ts;
 
 static void
 expand_delay_data_vec(void)
@@ -46,55 +76,434 @@ alloc_delay_data(void)
 	return rval;
 }
 
-void
-fill_delay_data(uint16_t delay_idx, struct timespec *val, bool isenter)
+static double
+ts_to_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1e9 + ts->tv_nsec;
+}
+
+static bool
+parse_delay_ns(const char *str, double *ns)
+{
+	struct timespec ts;
+
+	if (parse_ts(str, &ts) < 0)
+		return false;
+
+	*ns = ts_to_ns(&ts);
+	return true;
+}
+
+static bool
+parse_positive_double(const char *str, double *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtod(str, &end);
+
+	return !errno && end != str && !*end && *val > 0 && isfinite(*val);
+}
+
+/*
+ * Loads a histogram of delays from the file, one "DELAY [WEIGHT]"
+ * bucket per line, where WEIGHT is 1 by default.
+ */
+static bool
+load_delay_histogram(const char *path, struct delay_distr *d)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror_msg("%s", path);
+		return false;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t capacity = 0, weights_capacity = 0;
+	uint64_t total = 0;
+	bool ok = true;
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		char delay[64];
+		unsigned long long weight = 1;
+
+		line[strcspn(line, "#")] = '\0';
+		int n = sscanf(line, "%63s %llu", delay, &weight);
+		if (n <= 0)
+			continue;
+
+		struct timespec ts;
+		if (parse_ts(delay, &ts) < 0) {
+			error_msg("%s: invalid delay '%s'", path, delay);
+			ok = false;
+			break;
+		}
+		if (!weight)
+			continue;
+
+		if (d->count == capacity)
+			d->values = xgrowarray(d->values, &capacity,
+					       sizeof(*d->values));
+		if (d->count == weights_capacity)
+			d->weights = xgrowarray(d->weights, &weights_capacity,
+						sizeof(*d->weights));
+		total += weight;
+		d->values[d->count] = ts;
+		d->weights[d->count] = total;
+		d->count++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (ok && !d->count) {
+		error_msg("%s: no delays found", path);
+		ok = false;
+	}
+
+	if (!ok) {
+		free(d->values);
+		free(d->weights);
+		d->values = NULL;
+		d->weights = NULL;
+		d->count = 0;
+	}
+
+	return ok;
+}
+
+/*
+ * Parses the delay specification: either a fixed delay, or
+ * a distribution name followed by comma-separated parameters.
+ */
+static bool
+parse_delay_distr(const char *spec, struct delay_distr *d)
+{
+	static const struct {
+		const char *name;
+		enum delay_distr_type type;
+	} distrs[] = {
+		{ "uniform",		DELAY_UNIFORM },
+		{ "exponential",	DELAY_EXPONENTIAL },
+		{ "exp",		DELAY_EXPONENTIAL },
+		{ "lognormal",		DELAY_LOGNORMAL },
+		{ "pareto",		DELAY_PARETO },
+		{ "empirical",		DELAY_EMPIRICAL },
+	};
+
+	memset(d, 0, sizeof(*d));
+
+	const char *comma = strchr(spec, ',');
+	if (!comma) {
+		d->type = DELAY_FIXED;
+		return parse_delay_ns(spec, &d->value);
+	}
+
+	const size_t name_len = comma - spec;
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(distrs); ++i) {
+		if (strlen(distrs[i].name) == name_len &&
+		    !strncmp(spec, distrs[i].name, name_len))
+			break;
+	}
+	if (i == ARRAY_SIZE(distrs))
+		return false;
+	d->type = distrs[i].type;
+
+	if (d->type == DELAY_EMPIRICAL)
+		return comma[1] && load_delay_histogram(comma + 1, d);
+
+	char *args = xstrdup(comma + 1);
+	char *second = strchr(args, ',');
+	bool ok = false;
+
+	if (second)
+		*second++ = '\0';
+
+	switch (d->type) {
+	case DELAY_EXPONENTIAL:
+		ok = !second && parse_delay_ns(args, &d->value);
+		break;
+	case DELAY_UNIFORM:
+		ok = second && parse_delay_ns(args, &d->value) &&
+		     parse_delay_ns(second, &d->param) &&
+		     d->value <= d->param;
+		break;
+	case DELAY_LOGNORMAL:
+		/* sigma of 0 is allowed and means the median.  */
+		ok = second && parse_delay_ns(args, &d->value) &&
+		     (!strcmp(second, "0") ||
+		      parse_positive_double(second, &d->param));
+		break;
+	case DELAY_PARETO:
+		ok = second && parse_delay_ns(args, &d->value) &&
+		     parse_positive_double(second, &d->param);
+		break;
+	default:
+		break;
+	}
+
+	free(args);
+	return ok;
+}
+
+bool
+fill_delay_data(uint16_t delay_idx, const char *spec, bool isenter)
 {
 	if (delay_idx >= delay_data_vec_size)
 		error_func_msg_and_die("delay_idx >= delay_data_vec_size");
 
-	struct timespec *ts;
+	struct delay_distr *d;
 	if (isenter)
-		ts = &(delay_data_vec[delay_idx].ts_enter);
+		d = &(delay_data_vec[delay_idx].enter);
 	else
-		ts = &(delay_data_vec[delay_idx].ts_exit);
+		d = &(delay_data_vec[delay_idx].exit);
+
+	return parse_delay_distr(spec, d);
+}
+
+/* Returns the next number of the per-tcb xorshift64* sequence.  */
+static uint64_t
+delay_rng_next(struct tcb *tcp)
+{
+	static uint64_t seed;
+
+	if (!tcp->delay_rng_state) {
+		if (!seed) {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			seed = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+		/* splitmix64 step to spread the seed.  */
+		uint64_t z = seed + (uint64_t) tcp->pid * 0x9e3779b97f4a7c15ULL;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		tcp->delay_rng_state = (z ^ (z >> 31)) ?: 1;
+	}
+
+	uint64_t x = tcp->delay_rng_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	tcp->delay_rng_state = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
 
-	*ts = *val;
+/* Returns a uniformly distributed number in (0, 1).  */
+static double
+delay_rng_double(struct tcb *tcp)
+{
+	return ((delay_rng_next(tcp) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+static void
+sample_delay(struct tcb *tcp, const struct delay_distr *d,
+	     struct timespec *ts)
+{
+	double ns;
+
+	switch (d->type) {
+	case DELAY_UNIFORM:
+		ns = d->value + (d->param - d->value) * delay_rng_double(tcp);
+		break;
+	case DELAY_EXPONENTIAL:
+		ns = -d->value * log(delay_rng_double(tcp));
+		break;
+	case DELAY_LOGNORMAL: {
+		/* Box-Muller transform.  */
+		const double u1 = delay_rng_double(tcp);
+		const double u2 = delay_rng_double(tcp);
+		const double z = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+		ns = d->value * exp(d->param * z);
+		break;
+	}
+	case DELAY_PARETO:
+		ns = d->value * pow(delay_rng_double(tcp), -1 / d->param);
+		break;
+	case DELAY_EMPIRICAL: {
+		const uint64_t w = delay_rng_next(tcp)
+				   % d->weights[d->count - 1];
+		size_t lo = 0, hi = d->count - 1;
+
+		/* Find the first bucket with cumulative weight above w.  */
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+
+			if (d->weights[mid] > w)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		*ts = d->values[lo];
+		return;
+	}
+	default:
+		ns = d->value;
+		break;
+	}
+
+	/* Heavy tails are capped at a day.  */
+	if (d->type != DELAY_FIXED && !(ns < 86400e9))
+		ns = 86400e9;
+	ts->tv_sec = ns / 1e9;
+	ts->tv_nsec = ns - ts->tv_sec * 1e9;
 }
 
 static bool
-is_delay_timer_created(void)
+delay_heap_less(const size_t i, const size_t j)
+{
+	return ts_cmp(&delay_heap[i]->delay_expiration_time,
+		      &delay_heap[j]->delay_expiration_time) < 0;
+}
+
+static void
+delay_heap_swap(const size_t i, const size_t j)
+{
+	struct tcb *const tcp = delay_heap[i];
+
+	delay_heap[i] = delay_heap[j];
+	delay_heap[j] = tcp;
+	delay_heap[i]->delay_heap_idx = i;
+	delay_heap[j]->delay_heap_idx = j;
+}
+
+static void
+delay_heap_sift_up(size_t i)
+{
+	while (i > 0) {
+		const size_t parent = (i - 1) / 2;
+
+		if (!delay_heap_less(i, parent))
+			break;
+		delay_heap_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void
+delay_heap_sift_down(size_t i)
+{
+	for (;;) {
+		const size_t left = 2 * i + 1;
+		const size_t right = left + 1;
+		size_t min = i;
+
+		if (left < delay_heap_size && delay_heap_less(left, min))
+			min = left;
+		if (right < delay_heap_size && delay_heap_less(right, min))
+			min = right;
+		if (min == i)
+			break;
+		delay_heap_swap(i, min);
+		i = min;
+	}
+}
+
+static void
+delay_heap_push(struct tcb *const tcp)
 {
-	return delay_timer != (timer_t) -1;
+	if (delay_heap_size == delay_heap_capacity)
+		delay_heap = xgrowarray(delay_heap, &delay_heap_capacity,
+					sizeof(*delay_heap));
+
+	tcp->delay_heap_idx = delay_heap_size;
+	delay_heap[delay_heap_size++] = tcp;
+	delay_heap_sift_up(tcp->delay_heap_idx);
+}
+
+static void
+delay_heap_remove(struct tcb *const tcp)
+{
+	const size_t i = tcp->delay_heap_idx;
+
+	if (i >= delay_heap_size || delay_heap[i] != tcp)
+		error_func_msg_and_die("pid %d is not delayed", tcp->pid);
+
+	if (i != --delay_heap_size) {
+		delay_heap_swap(i, delay_heap_size);
+		delay_heap_sift_up(i);
+		delay_heap_sift_down(i);
+	}
+}
+
+/* Arms the delay timer for the earliest expiration time, if any.  */
+static void
+update_delay_timer(void)
+{
+	static const struct timespec ts_zero;
+	const struct timespec *const ts = delay_heap_size
+		? &delay_heap[0]->delay_expiration_time : &ts_zero;
+
+	if (!ts_cmp(ts, &delay_timer_ts))
+		return;
+
+	if (delay_timer_fd < 0) {
+		delay_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_CLOEXEC | TFD_NONBLOCK);
+		if (delay_timer_fd < 0)
+			perror_msg_and_die("timerfd_create");
+	}
+
+	const struct itimerspec its = { .it_value = *ts };
+	if (timerfd_settime(delay_timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+		perror_msg_and_die("timerfd_settime");
+
+	delay_timer_ts = *ts;
+
+	if (delay_heap_size)
+		debug_func_msg("timer set to %lld.%09ld for pid %d",
+			       (long long) ts->tv_sec, (long) ts->tv_nsec,
+			       delay_heap[0]->pid);
 }
 
 bool
 is_delay_timer_armed(void)
 {
-	return delay_timer_is_armed;
+	return delay_heap_size;
+}
+
+int
+get_delay_timer_fd(void)
+{
+	return delay_timer_fd;
 }
 
 void
 delay_timer_expired(void)
 {
-	delay_timer_is_armed = false;
+	uint64_t expirations;
+
+	if (read(delay_timer_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		perror_msg_and_die("read timerfd");
 }
 
-void
-arm_delay_timer(const struct tcb *const tcp)
+struct tcb *
+pop_expired_delayed_tcb(const struct timespec *const ts_now)
 {
-	const struct itimerspec its = {
-		.it_value = tcp->delay_expiration_time
-	};
+	if (!delay_heap_size ||
+	    ts_cmp(ts_now, &delay_heap[0]->delay_expiration_time) <= 0) {
+		update_delay_timer();
+		return NULL;
+	}
 
-	if (timer_settime(delay_timer, TIMER_ABSTIME, &its, NULL))
-		perror_msg_and_die("timer_settime");
+	struct tcb *const tcp = delay_heap[0];
+	delay_heap_remove(tcp);
 
-	delay_timer_is_armed = true;
+	return tcp;
+}
 
-	debug_func_msg("timer set to %lld.%09ld for pid %d",
-		       (long long) tcp->delay_expiration_time.tv_sec,
-		       (long) tcp->delay_expiration_time.tv_nsec,
-		       tcp->pid);
+void
+undelay_tcb(struct tcb *const tcp)
+{
+	if (!syscall_delayed(tcp))
+		return;
+
+	delay_heap_remove(tcp);
+	tcp->flags &= ~TCB_DELAYED;
+	update_delay_timer();
 }
 
 void
@@ -105,31 +514,19 @@ delay_tcb(struct tcb *tcp, uint16_t delay_idx, bool isenter)
 
 	debug_func_msg("delaying pid %d on %s",
 		       tcp->pid, isenter ? "enter" : "exit");
+	if (syscall_delayed(tcp))
+		delay_heap_remove(tcp);
 	tcp->flags |= TCB_DELAYED;
 	tcp->flags |= TCB_TAMPERED_DELAYED;
 
-	struct timespec *ts_diff;
-	if (isenter)
-		ts_diff = &(delay_data_vec[delay_idx].ts_enter);
-	else
-		ts_diff = &(delay_data_vec[delay_idx].ts_exit);
+	struct timespec ts_diff;
+	sample_delay(tcp, isenter ? &delay_data_vec[delay_idx].enter
+				  : &delay_data_vec[delay_idx].exit, &ts_diff);
 
 	struct timespec ts_now;
 	clock_gettime(CLOCK_MONOTONIC, &ts_now);
-	ts_add(&tcp->delay_expiration_time, &ts_now, ts_diff);
-
-	if (is_delay_timer_created()) {
-		struct itimerspec its;
-		if (timer_gettime(delay_timer, &its))
-			perror_msg_and_die("timer_gettime");
-
-		const struct timespec *const ts_old = &its.it_value;
-		if (ts_nz(ts_old) && ts_cmp(ts_diff, ts_old) > 0)
-			return;
-	} else {
-		if (timer_create(CLOCK_MONOTONIC, NULL, &delay_timer))
-			perror_msg_and_die("timer_create");
-	}
+	ts_add(&tcp->delay_expiration_time, &ts_now, &ts_diff);
 
-	arm_delay_timer(tcp);
+	delay_heap_push(tcp);
+	update_delay_timer();
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2018-2021 The strace developers.
+ * Copyright (c) 2018-2026 The strace developers.
  * All rights reserved.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
@@ -9,10 +9,21 @@
 # define STRACE_DELAY_H
 
 uint16_t alloc_delay_data(void);
-void fill_delay_data(uint16_t delay_idx, struct timespec *val, bool isenter);
+/*
+ * Parses the delay specification, either a fixed delay or a distribution
+ * of delays, and stores it.  Returns false if the specification is invalid.
+ */
+bool fill_delay_data(uint16_t delay_idx, const char *spec, bool isenter);
 bool is_delay_timer_armed(void);
+/* Returns the timerfd that becomes readable when the delay timer expires.  */
+int get_delay_timer_fd(void);
 void delay_timer_expired(void);
-void arm_delay_timer(const struct tcb *);
+/*
+ * Removes the delayed tcb with the earliest expiration time
+ * if it has expired by ts_now, otherwise rearms the delay timer.
+ */
+struct tcb *pop_expired_delayed_tcb(const struct timespec *ts_now);
 void delay_tcb(struct tcb *, uint16_t delay_idx, bool isenter);
+void undelay_tcb(struct tcb *);
 
 #endif /* !STRACE_DELAY_H */
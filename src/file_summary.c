@@ -0,0 +1,386 @@
+/*
+ * File lookup summary.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The summary counts the successful and failed opens, stats, accesses,
+ * and readlinks of every path, and the time spent in them.  Paths are
+ * interned in a hash table, so the cost of a lookup does not depend
+ * on the number of syscalls.  Relative paths are resolved against
+ * the directory file descriptors of *at syscalls or the current working
+ * directory of the process, so that lookups of the same relative name
+ * in different directories are not counted together.  On exit, the most
+ * frequently looked up paths and directories are reported along with
+ * the number of failed and repeated lookups, which reveals ENOENT storms
+ * of library and interpreter path searches and repeated stats of the same
+ * files.
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include "sen.h"
+#include "xstring.h"
+
+#define FILE_SUMMARY_TOP	30	/* Paths and directories reported */
+
+bool file_summary;
+
+enum file_op {
+	FILE_OP_OPEN,
+	FILE_OP_STAT,
+	FILE_OP_ACCESS,
+	FILE_OP_READLINK,
+
+	FILE_OP_COUNT
+};
+
+static const char *const file_op_names[] = {
+	[FILE_OP_OPEN] = "open",
+	[FILE_OP_STAT] = "stat",
+	[FILE_OP_ACCESS] = "access",
+	[FILE_OP_READLINK] = "readlink",
+};
+
+struct file_stats {
+	char *path;
+	uint32_t hash;
+	uint64_t ok[FILE_OP_COUNT];
+	uint64_t failed[FILE_OP_COUNT];
+	/* Lookups of a path that has been looked up before.  */
+	uint64_t dups;
+	struct timespec time;
+};
+
+/* Open addressing hash table of file_stats, keyed by path.  */
+struct file_table {
+	struct file_stats *tab;
+	size_t size;
+	size_t count;
+};
+
+static struct file_table paths;
+
+static uint32_t
+hash_path(const char *path, const size_t len)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < len; ++i) {
+		h ^= (unsigned char) path[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static struct file_stats *
+find_slot(const struct file_table *t, const char *path, const size_t len,
+	  const uint32_t hash)
+{
+	for (size_t i = hash;; ++i) {
+		struct file_stats *e = &t->tab[i & (t->size - 1)];
+
+		if (!e->path || (e->hash == hash && !strncmp(e->path, path, len)
+				 && !e->path[len]))
+			return e;
+	}
+}
+
+static void
+table_grow(struct file_table *t)
+{
+	struct file_stats *old = t->tab;
+	const size_t old_size = t->size;
+
+	t->size = old_size ? old_size * 2 : 1024;
+	t->tab = xcalloc(t->size, sizeof(*t->tab));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old[i].path)
+			*find_slot(t, old[i].path, strlen(old[i].path),
+				   old[i].hash) = old[i];
+	}
+
+	free(old);
+}
+
+/* Finds the entry of the path, interning the path if missing.  */
+static struct file_stats *
+table_get(struct file_table *t, const char *path, const size_t len)
+{
+	if ((t->count + 1) * 2 > t->size)
+		table_grow(t);
+
+	const uint32_t hash = hash_path(path, len);
+	struct file_stats *e = find_slot(t, path, len, hash);
+
+	if (!e->path) {
+		e->path = xstrndup(path, len);
+		e->hash = hash;
+		++t->count;
+	}
+
+	return e;
+}
+
+/* Returns the operation and the path and dirfd arguments of the syscall.  */
+static bool
+get_file_op(const struct tcb *tcp, enum file_op *op, unsigned int *path_arg,
+	    int *dirfd)
+{
+	const unsigned int sen = tcp_sysent(tcp)->sen;
+
+	*dirfd = AT_FDCWD;
+	*path_arg = 0;
+
+	switch (sen) {
+	case SEN_open:
+	case SEN_creat:
+		*op = FILE_OP_OPEN;
+		return true;
+	case SEN_openat:
+	case SEN_openat2:
+		*op = FILE_OP_OPEN;
+		break;
+	case SEN_stat:
+	case SEN_lstat:
+	case SEN_stat64:
+	case SEN_lstat64:
+	case SEN_oldstat:
+	case SEN_oldlstat:
+		*op = FILE_OP_STAT;
+		return true;
+	case SEN_newfstatat:
+	case SEN_fstatat64:
+	case SEN_statx:
+		*op = FILE_OP_STAT;
+		break;
+	case SEN_access:
+		*op = FILE_OP_ACCESS;
+		return true;
+	case SEN_faccessat:
+	case SEN_faccessat2:
+		*op = FILE_OP_ACCESS;
+		break;
+	case SEN_readlink:
+		*op = FILE_OP_READLINK;
+		return true;
+	case SEN_readlinkat:
+		*op = FILE_OP_READLINK;
+		break;
+	default:
+		return false;
+	}
+
+	*dirfd = tcp->u_arg[0];
+	*path_arg = 1;
+	return true;
+}
+
+/*
+ * Gets the path of the directory the relative paths of the syscall
+ * are resolved against, returns false if it is not available.
+ */
+static bool
+get_dir_path(struct tcb *tcp, const int dirfd, char *buf,
+	     const unsigned int bufsize)
+{
+	if (dirfd != AT_FDCWD) {
+		if (getfdpath(tcp, dirfd, buf, bufsize) <= 0)
+			return false;
+	} else {
+		const int proc_pid = get_proc_pid(tcp->pid);
+
+		if (!proc_pid)
+			return false;
+
+		char linkpath[sizeof("/proc/%u/cwd") + sizeof(int) * 3];
+		xsprintf(linkpath, "/proc/%u/cwd", proc_pid);
+
+		const ssize_t n = readlink(linkpath, buf, bufsize - 1);
+
+		if (n <= 0)
+			return false;
+		buf[n] = '\0';
+	}
+
+	return buf[0] == '/';
+}
+
+static uint64_t
+lookups(const struct file_stats *e)
+{
+	uint64_t n = 0;
+
+	for (unsigned int i = 0; i < FILE_OP_COUNT; ++i)
+		n += e->ok[i] + e->failed[i];
+	return n;
+}
+
+void
+file_summary_exiting(struct tcb *tcp, const struct timespec *ts)
+{
+	enum file_op op;
+	unsigned int path_arg;
+	int dirfd;
+
+	if (!get_file_op(tcp, &op, &path_arg, &dirfd))
+		return;
+
+	static char name[PATH_MAX];
+	static char buf[PATH_MAX * 2];
+	const char *path = name;
+	size_t len;
+
+	if (umovestr(tcp, tcp->u_arg[path_arg], sizeof(name), name) <= 0
+	    || !name[0])
+		return;
+
+	if (name[0] != '/') {
+		char dir[PATH_MAX];
+
+		if (!get_dir_path(tcp, dirfd, dir, sizeof(dir)))
+			return;
+		len = xsnprintf(buf, sizeof(buf), "%s/%s",
+				dir[1] ? dir : "", name);
+		path = buf;
+	} else {
+		len = strlen(name);
+	}
+
+	struct file_stats *e = table_get(&paths, path, len);
+	struct timespec dt;
+
+	if (lookups(e))
+		++e->dups;
+	if (syserror(tcp))
+		++e->failed[op];
+	else
+		++e->ok[op];
+	ts_sub(&dt, ts, &tcp->etime);
+	ts_add(&e->time, &e->time, &dt);
+}
+
+static uint64_t
+failed_lookups(const struct file_stats *e)
+{
+	uint64_t n = 0;
+
+	for (unsigned int i = 0; i < FILE_OP_COUNT; ++i)
+		n += e->failed[i];
+	return n;
+}
+
+static int
+lookups_cmp(const void *a, const void *b)
+{
+	const struct file_stats *ea = *(const struct file_stats * const *) a;
+	const struct file_stats *eb = *(const struct file_stats * const *) b;
+	const uint64_t na = lookups(ea);
+	const uint64_t nb = lookups(eb);
+
+	if (na != nb)
+		return na < nb ? 1 : -1;
+	return strcmp(ea->path, eb->path);
+}
+
+static void
+print_top(FILE *outf, const char *title, const struct file_table *t)
+{
+	struct file_stats **list = xcalloc(t->count, sizeof(*list));
+	size_t n = 0;
+
+	for (size_t i = 0; i < t->size; ++i) {
+		if (t->tab[i].path)
+			list[n++] = &t->tab[i];
+	}
+
+	qsort(list, n, sizeof(*list), lookups_cmp);
+
+	fprintf(outf, "\n%s:\n%9s %9s %9s", title, "lookups", "failed", "dups");
+	for (unsigned int op = 0; op < FILE_OP_COUNT; ++op)
+		fprintf(outf, " %13s", file_op_names[op]);
+	fprintf(outf, " %11s path\n", "seconds");
+	fputs("--------- --------- ---------", outf);
+	for (unsigned int op = 0; op < FILE_OP_COUNT; ++op)
+		fputs(" -------------", outf);
+	fputs(" ----------- ----\n", outf);
+
+	for (size_t i = 0; i < MIN(n, FILE_SUMMARY_TOP); ++i) {
+		const struct file_stats *e = list[i];
+
+		fprintf(outf, "%9" PRIu64 " %9" PRIu64 " %9" PRIu64,
+			lookups(e), failed_lookups(e), e->dups);
+		for (unsigned int op = 0; op < FILE_OP_COUNT; ++op) {
+			char buf[sizeof(uint64_t) * 6 + 2];
+
+			xsprintf(buf, "%" PRIu64 "/%" PRIu64,
+				 e->ok[op], e->failed[op]);
+			fprintf(outf, " %13s", buf);
+		}
+		fprintf(outf, " %11.6f %s\n", ts_float(&e->time), e->path);
+	}
+
+	free(list);
+}
+
+void
+file_summary_summary(FILE *outf)
+{
+	struct file_table dirs = { NULL, 0, 0 };
+	struct file_stats total = { .path = NULL };
+
+	if (!paths.count)
+		return;
+
+	for (size_t i = 0; i < paths.size; ++i) {
+		const struct file_stats *e = &paths.tab[i];
+
+		if (!e->path)
+			continue;
+
+		const char *slash = strrchr(e->path, '/');
+		struct file_stats *d =
+			!slash ? table_get(&dirs, ".", 1)
+			       : table_get(&dirs, e->path,
+					   MAX(slash - e->path, 1));
+
+		for (unsigned int op = 0; op < FILE_OP_COUNT; ++op) {
+			d->ok[op] += e->ok[op];
+			d->failed[op] += e->failed[op];
+			total.ok[op] += e->ok[op];
+			total.failed[op] += e->failed[op];
+		}
+		d->dups += e->dups;
+		total.dups += e->dups;
+		ts_add(&d->time, &d->time, &e->time);
+		ts_add(&total.time, &total.time, &e->time);
+	}
+
+	fprintf(outf, "File lookup summary: %" PRIu64 " lookups of %zu paths"
+		" in %zu directories, %" PRIu64 " failed, %" PRIu64
+		" repeated, %.6f seconds\n",
+		lookups(&total), paths.count, dirs.count,
+		failed_lookups(&total), total.dups, ts_float(&total.time));
+
+	print_top(outf, "Most frequently looked up paths"
+		  " (successful/failed lookups)", &paths);
+	print_top(outf, "Most frequently looked up directories"
+		  " (successful/failed lookups)", &dirs);
+
+	for (size_t i = 0; i < dirs.size; ++i)
+		free(dirs.tab[i].path);
+	free(dirs.tab);
+}
+
+void
+file_summary_init(void)
+{
+	file_summary = true;
+}
@@ -32,6 +32,7 @@ bool decode_fd_set_updated = false;
 
 static struct number_set *abbrev_set;
 static struct number_set *raw_set;
+static struct number_set *entry_only_set;
 static struct number_set *verbose_set;
 
 /* Only syscall numbers are personality-specific so far.  */
@@ -142,15 +143,12 @@ parse_delay_token(const char *input, struct inject_opts *fopts, bool isenter)
 
        if (fopts->data.flags & flag) /* duplicate */
                return false;
-       struct timespec tsval;
-
-       if (parse_ts(input, &tsval) < 0) /* couldn't parse */
-               return false;
 
        if (fopts->data.delay_idx == (uint16_t) -1)
                fopts->data.delay_idx = alloc_delay_data();
-       /* populate .ts_enter or .ts_exit */
-       fill_delay_data(fopts->data.delay_idx, &tsval, isenter);
+       /* populate .enter or .exit */
+       if (!fill_delay_data(fopts->data.delay_idx, input, isenter))
+               return false;
        fopts->data.flags |= flag;
 
        return true;
@@ -531,6 +529,14 @@ qualify_raw(const char *const str)
 	qualify_syscall_tokens(str, raw_set);
 }
 
+void
+qualify_entry_only(const char *const str)
+{
+	if (!entry_only_set)
+		entry_only_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(str, entry_only_set);
+}
+
 static void
 qualify_inject_common(const char *const str,
 		      const bool fault_tokens_only,
@@ -636,6 +642,18 @@ qualify_kvm(const char *const str)
 			error_msg("-e kvm=%s option is not implemented"
 				  " for this architecture", str);
 		goto wrong_kvm_qualifier;
+#endif
+	} else if (strcmp(str, "stats") == 0) {
+#ifdef HAVE_LINUX_KVM_H
+		if (os_release >= KERNEL_VERSION(4, 16, 0))
+			kvm_run_stats_init();
+		else
+			error_msg("-e kvm=%s option needs"
+				  " Linux 4.16.0 or higher", str);
+#else
+		error_msg("-e kvm=%s option is not implemented"
+			  " for this architecture", str);
+		goto wrong_kvm_qualifier;
 #endif
 	} else {
 	wrong_kvm_qualifier:
@@ -697,6 +715,7 @@ static const struct qual_options {
 	{ "v",		qualify_verbose	},
 	{ "raw",	qualify_raw	},
 	{ "x",		qualify_raw	},
+	{ "entry-only",	qualify_entry_only },
 	{ "signal",	qualify_signals	},
 	{ "signals",	qualify_signals	},
 	{ "s",		qualify_signals	},
@@ -754,5 +773,7 @@ qual_flags(const unsigned int scno)
 		| (is_number_in_set_array(scno, raw_set, current_personality)
 		   ? QUAL_RAW : 0)
 		| (is_number_in_set_array(scno, inject_set, current_personality)
-		   ? QUAL_INJECT : 0);
+		   ? QUAL_INJECT : 0)
+		| (is_number_in_set_array(scno, entry_only_set, current_personality)
+		   ? QUAL_ENTRY_ONLY : 0);
 }
@@ -17,7 +17,9 @@
 
 #include "filter_seccomp.h"
 #include "number_set.h"
+#include "probe_cache.h"
 #include "scno.h"
+#include "sen.h"
 
 bool seccomp_filtering;
 bool seccomp_before_sysentry;
@@ -223,8 +225,14 @@ check_seccomp_order_tracer(int pid)
 }
 #endif /* HAVE_FORK */
 
-static void
-check_seccomp_order(void)
+enum seccomp_order {
+	SECCOMP_ORDER_UNSUPPORTED,
+	SECCOMP_ORDER_BEFORE_SYSENTRY,
+	SECCOMP_ORDER_AFTER_SYSENTRY,
+};
+
+static int
+probe_seccomp_order(void)
 {
 	seccomp_filtering = false;
 
@@ -233,7 +241,7 @@ check_seccomp_order(void)
 	int pid = fork();
 	if (pid < 0) {
 		perror_func_msg("fork");
-		return;
+		return SECCOMP_ORDER_UNSUPPORTED;
 	}
 
 	if (pid == 0)
@@ -250,6 +258,21 @@ check_seccomp_order(void)
 		}
 	}
 #endif /* HAVE_FORK */
+
+	if (!seccomp_filtering)
+		return SECCOMP_ORDER_UNSUPPORTED;
+	return seccomp_before_sysentry ? SECCOMP_ORDER_BEFORE_SYSENTRY
+				       : SECCOMP_ORDER_AFTER_SYSENTRY;
+}
+
+static void
+check_seccomp_order(void)
+{
+	const int order = probe_cache_run("seccomp_order",
+					  probe_seccomp_order);
+
+	seccomp_filtering = order != SECCOMP_ORDER_UNSUPPORTED;
+	seccomp_before_sysentry = order == SECCOMP_ORDER_BEFORE_SYSENTRY;
 }
 
 static bool
@@ -257,10 +280,16 @@ traced_by_seccomp(unsigned int scno, unsigned int p)
 {
 	unsigned int always_trace_flags =
 		TRACE_INDIRECT_SUBCALL | TRACE_SECCOMP_DEFAULT |
-		(stack_trace_mode ? MEMORY_MAPPING_CHANGE : 0) |
+		(stack_trace_mode || decode_io_uring_rings ?
+		 MEMORY_MAPPING_CHANGE : 0) |
 		(is_number_in_set(DECODE_PID_COMM, decode_pid_set) ?
 		 COMM_CHANGE : 0);
 	return sysent_vec[p][scno].sys_flags & always_trace_flags ||
+		(decode_io_uring_rings &&
+		 io_uring_rings_syscall(sysent_vec[p][scno].sen)) ||
+		(process_summary &&
+		 process_summary_syscall(sysent_vec[p][scno].sen)) ||
+		(kvm_run_stats && sysent_vec[p][scno].sen == SEN_ioctl) ||
 		is_number_in_set_array(scno, trace_set, p);
 }
 
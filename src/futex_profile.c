@@ -0,0 +1,548 @@
+/*
+ * Futex contention profiler.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * For every futex word, the profiler accounts the number of waits,
+ * the time spent blocked in them and its log2 histogram, and the number
+ * of wake calls and of the waiters they have woken up.  Waits are also
+ * accounted per thread, and every successful wait is attributed to the
+ * thread that has most recently issued a wake call on the same futex word,
+ * forming a waker->waiter edge.
+ */
+
+#include "defs.h"
+#include <linux/futex.h>
+#include "mmap_cache.h"
+#include "sen.h"
+
+#define XLAT_MACROS_ONLY
+#include "xlat/futexops.h"
+#undef XLAT_MACROS_ONLY
+
+#define FUTEX_PROFILE_HIST_SIZE	32	/* log2 buckets of microseconds */
+#define FUTEX_PROFILE_TOP	16	/* Rows printed in each report table */
+#define FUTEX_PROFILE_WAITV_MAX	128	/* FUTEX_WAITV_MAX */
+
+bool futex_profile;
+
+struct futex_key {
+	uint64_t a;
+	uint64_t b;
+};
+
+/* Per futex word statistics, keyed by tgid and uaddr.  */
+struct futex_word_stats {
+	struct futex_key key;
+	char *where;		/* Symbolized uaddr */
+	uint64_t waits;
+	uint64_t timeouts;
+	uint64_t mismatches;	/* EAGAIN, the value has changed */
+	struct timespec blocked;
+	struct timespec blocked_max;
+	uint64_t hist[FUTEX_PROFILE_HIST_SIZE];
+	uint64_t wakes;
+	uint64_t woken;
+	uint64_t woken_max;
+	int last_waker;
+};
+
+/* Per thread statistics, keyed by tid.  */
+struct futex_thread_stats {
+	struct futex_key key;
+	uint64_t waits;
+	struct timespec blocked;
+};
+
+/* Waker->waiter edges, keyed by waker and waiter tids, and uaddr.  */
+struct futex_edge_stats {
+	struct futex_key key;
+	uint64_t count;
+};
+
+/* Open addressing hash table, every element begins with struct futex_key. */
+struct futex_table {
+	char *elems;
+	size_t elem_size;
+	size_t size;
+	size_t count;
+};
+
+static struct futex_table words = {
+	.elem_size = sizeof(struct futex_word_stats)
+};
+static struct futex_table threads = {
+	.elem_size = sizeof(struct futex_thread_stats)
+};
+static struct futex_table edges = {
+	.elem_size = sizeof(struct futex_edge_stats)
+};
+
+/* The wait data saved on entering, see futex_profile_entering.  */
+struct futex_wait_data {
+	struct timespec start;
+	unsigned int nr;
+	kernel_ulong_t uaddr[];
+};
+
+static struct futex_key *
+table_elem(const struct futex_table *t, size_t i)
+{
+	return (struct futex_key *) (t->elems + i * t->elem_size);
+}
+
+static size_t
+key_hash(const struct futex_key *key)
+{
+	return ((key->a * 0x9e3779b97f4a7c15ULL) ^ key->b)
+	       * 0xff51afd7ed558ccdULL >> 32;
+}
+
+static bool
+key_is_empty(const struct futex_key *key)
+{
+	return !key->a && !key->b;
+}
+
+static void *table_get(struct futex_table *, const struct futex_key *,
+		       bool *created);
+
+static void
+table_grow(struct futex_table *t)
+{
+	struct futex_table old = *t;
+
+	t->size = old.size ? old.size * 2 : 64;
+	t->elems = xcalloc(t->size, t->elem_size);
+	t->count = 0;
+
+	for (size_t i = 0; i < old.size; ++i) {
+		struct futex_key *e = table_elem(&old, i);
+
+		if (!key_is_empty(e))
+			memcpy(table_get(t, e, NULL), e, t->elem_size);
+	}
+
+	free(old.elems);
+}
+
+/* Finds the element with the key, creating a zeroed one if missing.  */
+static void *
+table_get(struct futex_table *t, const struct futex_key *key, bool *created)
+{
+	if ((t->count + 1) * 2 > t->size)
+		table_grow(t);
+
+	for (size_t i = key_hash(key);; ++i) {
+		struct futex_key *e = table_elem(t, i & (t->size - 1));
+
+		if (e->a == key->a && e->b == key->b) {
+			if (created)
+				*created = false;
+			return e;
+		}
+
+		if (key_is_empty(e)) {
+			*e = *key;
+			++t->count;
+			if (created)
+				*created = true;
+			return e;
+		}
+	}
+}
+
+static void **
+table_sorted(const struct futex_table *t, int (*cmp)(const void *, const void *))
+{
+	void **list = xcalloc(t->count + 1, sizeof(*list));
+	size_t n = 0;
+
+	for (size_t i = 0; i < t->size; ++i) {
+		struct futex_key *e = table_elem(t, i);
+
+		if (!key_is_empty(e))
+			list[n++] = e;
+	}
+
+	qsort(list, n, sizeof(*list), cmp);
+	return list;
+}
+
+static char *
+symbolize_uaddr(struct tcb *tcp, kernel_ulong_t uaddr)
+{
+	if (mmap_cache_rebuild_if_invalid(tcp, __func__)
+	    == MMAP_CACHE_REBUILD_NOCACHE)
+		return NULL;
+
+	const struct mmap_cache_entry_t *m = mmap_cache_search(tcp, uaddr);
+	if (!m || !m->binary_filename)
+		return NULL;
+
+	return xasprintf("%s+%#lx", m->binary_filename,
+			 uaddr - m->start_addr + m->mmap_offset);
+}
+
+static struct futex_word_stats *
+get_word(struct tcb *tcp, kernel_ulong_t uaddr)
+{
+	const struct futex_key key = { get_tcb_tgid(tcp), uaddr };
+	bool created;
+	struct futex_word_stats *w = table_get(&words, &key, &created);
+
+	if (created)
+		w->where = symbolize_uaddr(tcp, uaddr);
+
+	return w;
+}
+
+enum futex_profile_op {
+	FUTEX_PROFILE_NONE,
+	FUTEX_PROFILE_WAIT,
+	FUTEX_PROFILE_WAKE,
+};
+
+/*
+ * Classifies the futex syscall being traced, stores the futex word
+ * it operates on to *uaddr, and the secondary futex word woken up by
+ * FUTEX_WAKE_OP to *uaddr2.
+ */
+static enum futex_profile_op
+futex_profile_op(struct tcb *tcp, kernel_ulong_t *uaddr,
+		 kernel_ulong_t *uaddr2)
+{
+	*uaddr = tcp->u_arg[0];
+	*uaddr2 = 0;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_futex_time32:
+	case SEN_futex_time64:
+		switch (tcp->u_arg[1] & 127) {
+		case FUTEX_WAIT:
+		case FUTEX_WAIT_BITSET:
+		case FUTEX_WAIT_REQUEUE_PI:
+		case FUTEX_LOCK_PI:
+		case FUTEX_LOCK_PI2:
+			return FUTEX_PROFILE_WAIT;
+		case FUTEX_WAKE_OP:
+			*uaddr2 = tcp->u_arg[4];
+			return FUTEX_PROFILE_WAKE;
+		case FUTEX_WAKE:
+		case FUTEX_WAKE_BITSET:
+		case FUTEX_REQUEUE:
+		case FUTEX_CMP_REQUEUE:
+		case FUTEX_CMP_REQUEUE_PI:
+		case FUTEX_UNLOCK_PI:
+			return FUTEX_PROFILE_WAKE;
+		}
+		return FUTEX_PROFILE_NONE;
+	case SEN_futex_wait:
+		return FUTEX_PROFILE_WAIT;
+	case SEN_futex_waitv:
+		*uaddr = 0;
+		return FUTEX_PROFILE_WAIT;
+	case SEN_futex_wake:
+		return FUTEX_PROFILE_WAKE;
+	case SEN_futex_requeue: {
+		struct futex_waitv w;
+
+		if (umove(tcp, tcp->u_arg[0], &w))
+			return FUTEX_PROFILE_NONE;
+		*uaddr = w.uaddr;
+		return FUTEX_PROFILE_WAKE;
+	}
+	}
+
+	return FUTEX_PROFILE_NONE;
+}
+
+void
+futex_profile_entering(struct tcb *tcp)
+{
+	kernel_ulong_t uaddr, uaddr2;
+
+	switch (futex_profile_op(tcp, &uaddr, &uaddr2)) {
+	case FUTEX_PROFILE_WAIT: {
+		unsigned int nr = 1;
+
+		if (tcp_sysent(tcp)->sen == SEN_futex_waitv)
+			nr = MIN(tcp->u_arg[1], FUTEX_PROFILE_WAITV_MAX);
+
+		struct futex_wait_data *d =
+			xzalloc(sizeof(*d) + nr * sizeof(d->uaddr[0]));
+		d->nr = nr;
+
+		if (tcp_sysent(tcp)->sen == SEN_futex_waitv) {
+			struct futex_waitv w;
+
+			for (unsigned int i = 0; i < nr; ++i) {
+				if (umove(tcp, tcp->u_arg[0] + i * sizeof(w),
+					  &w))
+					break;
+				d->uaddr[i] = w.uaddr;
+			}
+		} else {
+			d->uaddr[0] = uaddr;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &d->start);
+		if (set_tcb_priv_data(tcp, d, free))
+			free(d);
+		break;
+	}
+	case FUTEX_PROFILE_WAKE:
+		/*
+		 * Remember the waker before it is able to wake anybody up,
+		 * so that the waiter's return is always seen after that.
+		 */
+		get_word(tcp, uaddr)->last_waker = tcp->pid;
+		if (uaddr2)
+			get_word(tcp, uaddr2)->last_waker = tcp->pid;
+		break;
+	case FUTEX_PROFILE_NONE:
+		break;
+	}
+}
+
+static unsigned int
+hist_bucket(const struct timespec *ts)
+{
+	uint64_t us = ts->tv_sec * 1000000ULL + ts->tv_nsec / 1000;
+	unsigned int b = 0;
+
+	while (us && b < FUTEX_PROFILE_HIST_SIZE - 1) {
+		us >>= 1;
+		++b;
+	}
+
+	return b;
+}
+
+void
+futex_profile_exiting(struct tcb *tcp)
+{
+	kernel_ulong_t uaddr, uaddr2;
+
+	switch (futex_profile_op(tcp, &uaddr, &uaddr2)) {
+	case FUTEX_PROFILE_WAIT: {
+		const struct futex_wait_data *d = get_tcb_priv_data(tcp);
+		if (!d)
+			break;
+
+		struct timespec now, dt;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts_sub(&dt, &now, &d->start);
+
+		/* futex_waitv returns the index of the woken futex.  */
+		unsigned int idx = 0;
+		if (tcp_sysent(tcp)->sen == SEN_futex_waitv && !syserror(tcp)
+		    && (kernel_ulong_t) tcp->u_rval < d->nr)
+			idx = tcp->u_rval;
+		if (!d->uaddr[idx])
+			break;
+
+		struct futex_word_stats *w = get_word(tcp, d->uaddr[idx]);
+		w->waits++;
+		ts_add(&w->blocked, &w->blocked, &dt);
+		w->blocked_max = *ts_max(&w->blocked_max, &dt);
+		w->hist[hist_bucket(&dt)]++;
+		if (syserror(tcp)) {
+			if (tcp->u_error == ETIMEDOUT)
+				w->timeouts++;
+			else if (tcp->u_error == EAGAIN)
+				w->mismatches++;
+		}
+
+		const struct futex_key tkey = { tcp->pid, 0 };
+		struct futex_thread_stats *t = table_get(&threads, &tkey, NULL);
+		t->waits++;
+		ts_add(&t->blocked, &t->blocked, &dt);
+
+		if (!syserror(tcp) && w->last_waker
+		    && w->last_waker != tcp->pid) {
+			const struct futex_key ekey = {
+				(uint64_t) w->last_waker << 32
+				| (uint32_t) tcp->pid,
+				d->uaddr[idx]
+			};
+			struct futex_edge_stats *e =
+				table_get(&edges, &ekey, NULL);
+			e->count++;
+		}
+		break;
+	}
+	case FUTEX_PROFILE_WAKE: {
+		if (syserror(tcp))
+			break;
+
+		struct futex_word_stats *w = get_word(tcp, uaddr);
+		const uint64_t woken = tcp->u_rval;
+
+		w->wakes++;
+		w->woken += woken;
+		w->woken_max = MAX(w->woken_max, woken);
+		break;
+	}
+	case FUTEX_PROFILE_NONE:
+		break;
+	}
+}
+
+static int
+word_cmp(const void *a, const void *b)
+{
+	const struct futex_word_stats *wa = *(void * const *) a;
+	const struct futex_word_stats *wb = *(void * const *) b;
+	int rc = ts_cmp(&wb->blocked, &wa->blocked);
+
+	if (rc)
+		return rc;
+	if (wa->wakes != wb->wakes)
+		return wa->wakes < wb->wakes ? 1 : -1;
+	return wa->key.b < wb->key.b ? -1 : wa->key.b > wb->key.b;
+}
+
+static int
+thread_cmp(const void *a, const void *b)
+{
+	const struct futex_thread_stats *ta = *(void * const *) a;
+	const struct futex_thread_stats *tb = *(void * const *) b;
+	int rc = ts_cmp(&tb->blocked, &ta->blocked);
+
+	return rc ? rc : (ta->key.a > tb->key.a) - (ta->key.a < tb->key.a);
+}
+
+static int
+edge_cmp(const void *a, const void *b)
+{
+	const struct futex_edge_stats *ea = *(void * const *) a;
+	const struct futex_edge_stats *eb = *(void * const *) b;
+
+	if (ea->count != eb->count)
+		return ea->count < eb->count ? 1 : -1;
+	return (ea->key.a > eb->key.a) - (ea->key.a < eb->key.a);
+}
+
+static void
+print_futex_word(FILE *outf, const struct futex_word_stats *w)
+{
+	fprintf(outf, "%12.6f %11.6f %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+		" %9" PRIu64 " %9.2f %9" PRIu64 " %8d %#" PRIx64,
+		ts_float(&w->blocked), ts_float(&w->blocked_max),
+		w->waits, w->timeouts, w->mismatches, w->wakes,
+		w->wakes ? (double) w->woken / w->wakes : 0.0, w->woken_max,
+		(int) w->key.a, w->key.b);
+	if (w->where)
+		fprintf(outf, " (%s)", w->where);
+	fputc('\n', outf);
+}
+
+static void
+print_futex_hist(FILE *outf, const struct futex_word_stats *w)
+{
+	unsigned int lo = 0, hi = 0;
+	uint64_t max = 0;
+
+	for (unsigned int i = 0; i < FUTEX_PROFILE_HIST_SIZE; ++i) {
+		if (!w->hist[i])
+			continue;
+		if (!max)
+			lo = i;
+		hi = i;
+		max = MAX(max, w->hist[i]);
+	}
+
+	if (!max)
+		return;
+
+	fprintf(outf, "\n%#" PRIx64 " (pid %d)", w->key.b, (int) w->key.a);
+	if (w->where)
+		fprintf(outf, " %s", w->where);
+	fputs(":\n           usecs : count\n", outf);
+
+	for (unsigned int i = lo; i <= hi; ++i) {
+		const uint64_t from = i ? 1ULL << (i - 1) : 0;
+		const uint64_t to = (1ULL << i) - 1;
+		const unsigned int stars = w->hist[i] * 40 / max;
+
+		fprintf(outf, "%7" PRIu64 " -> %-7" PRIu64 " : %-9" PRIu64 " |",
+			from, to, w->hist[i]);
+		for (unsigned int j = 0; j < 40; ++j)
+			fputc(j < stars ? '*' : ' ', outf);
+		fputs("|\n", outf);
+	}
+}
+
+void
+futex_profile_summary(FILE *outf)
+{
+	if (!words.count)
+		return;
+
+	struct futex_word_stats **wl =
+		(struct futex_word_stats **) table_sorted(&words, word_cmp);
+	const size_t nw = MIN(words.count, FUTEX_PROFILE_TOP);
+
+	fputs("Futex contention summary:\n"
+	      "blocked-secs     longest     waits  timeouts    eagain"
+	      "     wakes avg-woken max-woken      pid uaddr\n"
+	      "------------ ----------- --------- --------- ---------"
+	      " --------- --------- --------- -------- ----------------\n",
+	      outf);
+	for (size_t i = 0; i < nw; ++i)
+		print_futex_word(outf, wl[i]);
+
+	fputs("\nFutex wait time histograms:\n", outf);
+	for (size_t i = 0; i < nw; ++i)
+		print_futex_hist(outf, wl[i]);
+
+	free(wl);
+
+	if (threads.count) {
+		struct futex_thread_stats **tl = (struct futex_thread_stats **)
+			table_sorted(&threads, thread_cmp);
+
+		fputs("\nFutex waits by thread:\n"
+		      "     tid     waits blocked-secs\n"
+		      "-------- --------- ------------\n", outf);
+		for (size_t i = 0; i < MIN(threads.count, FUTEX_PROFILE_TOP);
+		     ++i) {
+			fprintf(outf, "%8d %9" PRIu64 " %12.6f\n",
+				(int) tl[i]->key.a, tl[i]->waits,
+				ts_float(&tl[i]->blocked));
+		}
+
+		free(tl);
+	}
+
+	if (edges.count) {
+		struct futex_edge_stats **el = (struct futex_edge_stats **)
+			table_sorted(&edges, edge_cmp);
+
+		fputs("\nFutex wake edges:\n"
+		      "   waker   waiter     wakes uaddr\n"
+		      "-------- -------- --------- ----------------\n", outf);
+		for (size_t i = 0; i < MIN(edges.count, FUTEX_PROFILE_TOP);
+		     ++i) {
+			fprintf(outf, "%8d %8d %9" PRIu64 " %#" PRIx64 "\n",
+				(int) (el[i]->key.a >> 32),
+				(int) (uint32_t) el[i]->key.a,
+				el[i]->count, el[i]->key.b);
+		}
+
+		free(el);
+	}
+}
+
+void
+futex_profile_init(void)
+{
+	futex_profile = true;
+	mmap_cache_enable();
+}
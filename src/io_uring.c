@@ -7,9 +7,14 @@
  */
 
 #include "defs.h"
+#include "list.h"
+#include "mmap_notify.h"
+#include "sen.h"
+#include "xstring.h"
 
 #include "kernel_time_types.h"
 #define UAPI_LINUX_IO_URING_H_SKIP_LINUX_TIME_TYPES_H
+#include <linux/close_range.h>
 #include <linux/io_uring.h>
 #include <linux/io_uring/query.h>
 
@@ -180,6 +185,9 @@ print_io_uring_getevents_arg(struct tcb *tcp, const kernel_ulong_t addr)
 	tprint_struct_end();
 }
 
+static void print_io_uring_ring_sqes(struct tcb *);
+static void print_io_uring_ring_cqes(struct tcb *);
+
 SYS_FUNC(io_uring_enter)
 {
 	const int fd = tcp->u_arg[0];
@@ -189,6 +197,11 @@ SYS_FUNC(io_uring_enter)
 	const kernel_ulong_t sigset_addr = tcp->u_arg[4];
 	const kernel_ulong_t sigset_size = tcp->u_arg[5];
 
+	if (exiting(tcp)) {
+		print_io_uring_ring_cqes(tcp);
+		return RVAL_DECODED;
+	}
+
 	/* fd */
 	tprints_arg_name("fd");
 	printfd(tcp, fd);
@@ -240,6 +253,11 @@ SYS_FUNC(io_uring_enter)
 		PRINT_VAL_U(sigset_size);
 	}
 
+	if (decode_io_uring_rings) {
+		print_io_uring_ring_sqes(tcp);
+		return 0;
+	}
+
 	return RVAL_DECODED;
 }
 
@@ -1201,6 +1219,617 @@ print_io_uring_sqe(struct tcb *tcp, const kernel_ulong_t addr)
 	tprint_struct_end();
 }
 
+/*
+ * Tracking of submission and completion queue rings.
+ *
+ * Ring geometry is remembered on io_uring_setup exit and on mmap of
+ * the ring file descriptor; on io_uring_enter, newly submitted SQEs
+ * are read on entering, and newly posted CQEs are read on exiting.
+ * SQEs and CQEs are correlated by user_data to measure
+ * submit-to-complete latency of each operation.
+ */
+
+bool decode_io_uring_rings;
+
+struct uring_pending {
+	uint64_t user_data;
+	struct timespec ts;
+	uint8_t opcode;
+	bool used;
+};
+
+struct uring_ring {
+	struct list_item list;
+	int tgid;
+	int fd;
+	uint32_t flags;
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+	kernel_ulong_t sq_ring;		/* Address of the SQ ring, 0 if unknown */
+	kernel_ulong_t cq_ring;		/* Address of the CQ ring, 0 if unknown */
+	kernel_ulong_t sqes;		/* Address of the SQE array, 0 if unknown */
+	uint32_t cq_seen_tail;
+
+	/* Submitted SQEs with no CQE yet, hashed by user_data.  */
+	struct uring_pending *pending;
+	size_t pending_size;
+	size_t pending_count;
+};
+
+static EMPTY_LIST(uring_rings);
+
+struct uring_op_stats {
+	uint64_t count;
+	struct timespec total;
+	struct timespec min;
+	struct timespec max;
+};
+
+static struct uring_op_stats uring_op_stats[256];
+
+struct uring_cqe_rec {
+	struct io_uring_cqe cqe;
+	struct timespec latency;
+	int opcode;			/* -1 if the SQE has not been seen */
+};
+
+/* Snapshot of the rings taken by io_uring_enter, stored as tcb priv data.  */
+struct uring_enter_data {
+	kernel_ulong_t *sqe_addrs;
+	unsigned int sqe_count;
+	struct uring_cqe_rec *cqes;
+	unsigned int cqe_count;
+};
+
+static void
+free_uring_enter_data(void *p)
+{
+	struct uring_enter_data *d = p;
+
+	free(d->sqe_addrs);
+	free(d->cqes);
+	free(d);
+}
+
+static void
+free_uring_ring(struct uring_ring *ring)
+{
+	list_remove(&ring->list);
+	free(ring->pending);
+	free(ring);
+}
+
+static struct uring_ring *
+find_uring_ring(struct tcb *tcp, const int fd)
+{
+	struct uring_ring *ring;
+	int tgid = 0;
+
+	list_foreach(ring, &uring_rings, list) {
+		if (ring->fd != fd)
+			continue;
+		if (!tgid)
+			tgid = get_tcb_tgid(tcp);
+		if (ring->tgid == tgid)
+			return ring;
+	}
+
+	return NULL;
+}
+
+static size_t
+uring_pending_slot(const struct uring_ring *ring, const uint64_t user_data)
+{
+	uint64_t h = user_data * 0x9e3779b97f4a7c15ULL;
+
+	return (h >> 32) & (ring->pending_size - 1);
+}
+
+static struct uring_pending *
+uring_pending_find(struct uring_ring *ring, const uint64_t user_data)
+{
+	if (!ring->pending_count)
+		return NULL;
+
+	for (size_t i = uring_pending_slot(ring, user_data);;
+	     i = (i + 1) & (ring->pending_size - 1)) {
+		struct uring_pending *p = &ring->pending[i];
+
+		if (!p->used)
+			return NULL;
+		if (p->user_data == user_data)
+			return p;
+	}
+}
+
+static void
+uring_pending_insert(struct uring_ring *ring, const uint64_t user_data,
+		     const uint8_t opcode, const struct timespec *ts)
+{
+	if ((ring->pending_count + 1) * 2 > ring->pending_size) {
+		struct uring_pending *old = ring->pending;
+		const size_t old_size = ring->pending_size;
+
+		ring->pending_size = old_size ? old_size * 2 : 64;
+		ring->pending = xcalloc(ring->pending_size,
+					sizeof(*ring->pending));
+		ring->pending_count = 0;
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i].used)
+				uring_pending_insert(ring, old[i].user_data,
+						     old[i].opcode,
+						     &old[i].ts);
+		}
+		free(old);
+	}
+
+	size_t i = uring_pending_slot(ring, user_data);
+	while (ring->pending[i].used && ring->pending[i].user_data != user_data)
+		i = (i + 1) & (ring->pending_size - 1);
+
+	if (!ring->pending[i].used)
+		ring->pending_count++;
+	ring->pending[i] = (struct uring_pending) {
+		.user_data = user_data,
+		.ts = *ts,
+		.opcode = opcode,
+		.used = true,
+	};
+}
+
+/* Removes the entry using backward shift deletion.  */
+static void
+uring_pending_remove(struct uring_ring *ring, struct uring_pending *p)
+{
+	const size_t mask = ring->pending_size - 1;
+	size_t i = p - ring->pending;
+
+	for (size_t j = (i + 1) & mask; ring->pending[j].used;
+	     j = (j + 1) & mask) {
+		const size_t k = uring_pending_slot(ring,
+						    ring->pending[j].user_data);
+		/* Move j to i if k is cyclically outside of (i, j].  */
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			ring->pending[i] = ring->pending[j];
+			i = j;
+		}
+	}
+
+	ring->pending[i].used = false;
+	ring->pending_count--;
+}
+
+static void
+uring_op_stats_add(const uint8_t opcode, const struct timespec *latency)
+{
+	struct uring_op_stats *s = &uring_op_stats[opcode];
+
+	if (!s->count || ts_cmp(latency, &s->min) < 0)
+		s->min = *latency;
+	if (ts_cmp(latency, &s->max) > 0)
+		s->max = *latency;
+	ts_add(&s->total, &s->total, latency);
+	s->count++;
+}
+
+static bool
+uring_sqes_trackable(const struct uring_ring *ring)
+{
+	return ring->sq_ring && ring->sqes &&
+	       !(ring->flags & (IORING_SETUP_SQPOLL | IORING_SETUP_SQE_MIXED |
+				IORING_SETUP_SQ_REWIND));
+}
+
+static void
+uring_setup_exiting(struct tcb *tcp)
+{
+	struct io_uring_params params;
+
+	if (syserror(tcp) ||
+	    umove(tcp, tcp->u_arg[1], &params))
+		return;
+
+	const int fd = tcp->u_rval;
+	struct uring_ring *ring = find_uring_ring(tcp, fd);
+	if (ring)
+		free_uring_ring(ring);
+
+	ring = xzalloc(sizeof(*ring));
+	ring->tgid = get_tcb_tgid(tcp);
+	ring->fd = fd;
+	ring->flags = params.flags;
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	ring->sq_off = params.sq_off;
+	ring->cq_off = params.cq_off;
+
+	if (params.flags & IORING_SETUP_NO_MMAP) {
+		/* The rings are in the memory provided by the application.  */
+		ring->sq_ring = ring->cq_ring = params.cq_off.user_addr;
+		ring->sqes = params.sq_off.user_addr;
+	}
+
+	list_insert(&uring_rings, &ring->list);
+}
+
+static void
+uring_mmap_notify(struct tcb *tcp, bool has_result, void *unused)
+{
+	if (!has_result || syserror(tcp) || list_is_empty(&uring_rings))
+		return;
+
+	uint64_t offset;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+		offset = tcp->u_arg[5];
+		break;
+	case SEN_mmap_pgoff:
+		offset = (uint64_t) tcp->u_arg[5] * get_pagesize();
+		break;
+	case SEN_mmap_4koff:
+		offset = (uint64_t) tcp->u_arg[5] * 4096;
+		break;
+	default:
+		return;
+	}
+
+	struct uring_ring *ring = find_uring_ring(tcp, tcp->u_arg[4]);
+	if (!ring)
+		return;
+
+	const kernel_ulong_t addr = tcp->u_rval;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ring->sq_ring = addr;
+		if (!ring->cq_ring)
+			ring->cq_ring = addr;
+		break;
+	case IORING_OFF_CQ_RING:
+		ring->cq_ring = addr;
+		break;
+	case IORING_OFF_SQES:
+		ring->sqes = addr;
+		break;
+	}
+}
+
+static void
+uring_enter_entering(struct tcb *tcp)
+{
+	struct uring_ring *ring = find_uring_ring(tcp, tcp->u_arg[0]);
+	const uint32_t to_submit = tcp->u_arg[1];
+	uint32_t head, tail;
+
+	if (!ring || !to_submit || !uring_sqes_trackable(ring) ||
+	    umove(tcp, ring->sq_ring + ring->sq_off.head, &head) ||
+	    umove(tcp, ring->sq_ring + ring->sq_off.tail, &tail))
+		return;
+
+	uint32_t count = MIN(tail - head, MIN(to_submit, ring->sq_entries));
+	if (!count)
+		return;
+
+	struct uring_enter_data *d = xzalloc(sizeof(*d));
+	d->sqe_addrs = xcalloc(count, sizeof(*d->sqe_addrs));
+	if (set_tcb_priv_data(tcp, d, free_uring_enter_data)) {
+		free_uring_enter_data(d);
+		return;
+	}
+
+	const uint32_t mask = ring->sq_entries - 1;
+	const unsigned int sqe_size =
+		ring->flags & IORING_SETUP_SQE128 ? 128 : 64;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t idx = (head + i) & mask;
+		struct io_uring_sqe sqe;
+
+		if (!(ring->flags & IORING_SETUP_NO_SQARRAY) &&
+		    umove(tcp, ring->sq_ring + ring->sq_off.array
+			       + idx * sizeof(uint32_t), &idx))
+			break;
+
+		const kernel_ulong_t addr = ring->sqes
+			+ (kernel_ulong_t) (idx & mask) * sqe_size;
+		if (umove(tcp, addr, &sqe))
+			break;
+
+		d->sqe_addrs[d->sqe_count++] = addr;
+		uring_pending_insert(ring, sqe.user_data, sqe.opcode, &ts);
+	}
+}
+
+static void
+uring_enter_exiting(struct tcb *tcp)
+{
+	struct uring_ring *ring = find_uring_ring(tcp, tcp->u_arg[0]);
+	uint32_t tail;
+
+	if (!ring || !ring->cq_ring ||
+	    umove(tcp, ring->cq_ring + ring->cq_off.tail, &tail))
+		return;
+
+	uint32_t start = ring->cq_seen_tail;
+	if (tail - start > ring->cq_entries)
+		start = tail - ring->cq_entries;
+	ring->cq_seen_tail = tail;
+	if (tail == start)
+		return;
+
+	struct uring_enter_data *d = get_tcb_priv_data(tcp);
+	if (!d) {
+		d = xzalloc(sizeof(*d));
+		set_tcb_priv_data(tcp, d, free_uring_enter_data);
+	}
+	d->cqes = xcalloc(tail - start, sizeof(*d->cqes));
+
+	const uint32_t mask = ring->cq_entries - 1;
+	const unsigned int cqe_size = ring->flags & IORING_SETUP_CQE32
+				      ? 2 * sizeof(struct io_uring_cqe)
+				      : sizeof(struct io_uring_cqe);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	for (uint32_t i = start; i != tail; ++i) {
+		struct uring_cqe_rec *rec = &d->cqes[d->cqe_count];
+
+		if (umove(tcp, ring->cq_ring + ring->cq_off.cqes
+			       + (kernel_ulong_t) (i & mask) * cqe_size,
+			  &rec->cqe))
+			break;
+
+		/* A 32-byte CQE in a mixed ring takes two slots.  */
+		if ((ring->flags & IORING_SETUP_CQE_MIXED) &&
+		    (rec->cqe.flags & IORING_CQE_F_32) && i + 1 != tail)
+			++i;
+		if (rec->cqe.flags & IORING_CQE_F_SKIP)
+			continue;
+
+		rec->opcode = -1;
+		struct uring_pending *p =
+			uring_pending_find(ring, rec->cqe.user_data);
+		if (p) {
+			rec->opcode = p->opcode;
+			ts_sub(&rec->latency, &ts, &p->ts);
+			uring_op_stats_add(p->opcode, &rec->latency);
+			if (!(rec->cqe.flags & IORING_CQE_F_MORE))
+				uring_pending_remove(ring, p);
+		}
+		d->cqe_count++;
+	}
+}
+
+void
+io_uring_rings_entering(struct tcb *tcp)
+{
+	if (tcp_sysent(tcp)->sen == SEN_io_uring_enter)
+		uring_enter_entering(tcp);
+}
+
+/* Forgets the rings of the process with descriptors in [first, last].  */
+static void
+forget_uring_rings(struct tcb *tcp, const kernel_ulong_t first,
+		   const kernel_ulong_t last)
+{
+	struct uring_ring *ring, *tmp;
+	int tgid = 0;
+
+	if (syserror(tcp) || list_is_empty(&uring_rings))
+		return;
+
+	list_foreach_safe(ring, &uring_rings, list, tmp) {
+		if ((kernel_ulong_t) ring->fd < first
+		    || (kernel_ulong_t) ring->fd > last)
+			continue;
+		if (!tgid)
+			tgid = get_tcb_tgid(tcp);
+		if (ring->tgid == tgid)
+			free_uring_ring(ring);
+	}
+}
+
+/*
+ * Forgets the rings of the process when its last tracee goes away,
+ * so that a process that reuses the tgid is not bound to them.
+ * A tracee that has not looked up its tgid is taken for a group leader.
+ */
+void
+io_uring_rings_forget_tcb(struct tcb *tcp)
+{
+	struct uring_ring *ring, *tmp;
+	const int tgid = tcp->tgid ? tcp->tgid : tcp->pid;
+	bool checked = false;
+
+	list_foreach_safe(ring, &uring_rings, list, tmp) {
+		if (ring->tgid != tgid)
+			continue;
+		if (!checked) {
+			if (is_tgid_traced(tgid, tcp))
+				return;
+			checked = true;
+		}
+		free_uring_ring(ring);
+	}
+}
+
+void
+io_uring_rings_exiting(struct tcb *tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_io_uring_setup:
+		uring_setup_exiting(tcp);
+		break;
+	case SEN_io_uring_enter:
+		uring_enter_exiting(tcp);
+		break;
+	case SEN_close:
+		forget_uring_rings(tcp, tcp->u_arg[0], tcp->u_arg[0]);
+		break;
+	case SEN_dup2:
+	case SEN_dup3:
+		/* The new descriptor is closed first.  */
+		if (tcp->u_arg[0] != tcp->u_arg[1])
+			forget_uring_rings(tcp, tcp->u_arg[1], tcp->u_arg[1]);
+		break;
+	case SEN_close_range:
+		if (!(tcp->u_arg[2] & CLOSE_RANGE_CLOEXEC))
+			forget_uring_rings(tcp, tcp->u_arg[0], tcp->u_arg[1]);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		forget_uring_rings(tcp, 0, -1);
+		break;
+	}
+}
+
+/*
+ * Returns true if the syscall has to be seen on exiting to keep track
+ * of the rings, even if it is not traced.
+ */
+bool
+io_uring_rings_syscall(const unsigned int sen)
+{
+	switch (sen) {
+	case SEN_io_uring_setup:
+	case SEN_close:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_close_range:
+	case SEN_execve:
+	case SEN_execveat:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void
+io_uring_rings_init(void)
+{
+	if (decode_io_uring_rings)
+		return;
+
+	decode_io_uring_rings = true;
+	mmap_notify_register_client(uring_mmap_notify, NULL);
+}
+
+static void
+print_io_uring_ring_sqes(struct tcb *tcp)
+{
+	const struct uring_enter_data *d = get_tcb_priv_data(tcp);
+
+	if (!d || !d->sqe_count)
+		return;
+
+	tprint_comment_begin();
+	tprints_field_name("sqes");
+	tprint_array_begin();
+	for (unsigned int i = 0; i < d->sqe_count; ++i) {
+		if (i) {
+			tprint_array_next();
+			if (abbrev(tcp) && i >= max_strlen) {
+				tprint_more_data_follows();
+				break;
+			}
+		}
+		print_io_uring_sqe(tcp, d->sqe_addrs[i]);
+	}
+	tprint_array_end();
+	tprint_comment_end();
+}
+
+static void
+print_io_uring_ring_cqe(const struct uring_cqe_rec *rec)
+{
+	tprint_struct_begin();
+	PRINT_FIELD_X(rec->cqe, user_data);
+	tprint_struct_next();
+	PRINT_FIELD_D(rec->cqe, res);
+	tprint_struct_next();
+	PRINT_FIELD_X(rec->cqe, flags);
+	if (rec->opcode >= 0) {
+		tprint_struct_next();
+		tprints_field_name("opcode");
+		printxval(uring_ops, rec->opcode, "IORING_OP_???");
+		tprint_struct_next();
+		tprints_field_name("latency");
+		tprintf_string("%lld.%09ld", (long long) rec->latency.tv_sec,
+			       (long) rec->latency.tv_nsec);
+	}
+	tprint_struct_end();
+}
+
+static void
+print_io_uring_ring_cqes(struct tcb *tcp)
+{
+	const struct uring_enter_data *d = get_tcb_priv_data(tcp);
+
+	if (!d || !d->cqe_count)
+		return;
+
+	tprint_comment_begin();
+	tprints_field_name("cqes");
+	tprint_array_begin();
+	for (unsigned int i = 0; i < d->cqe_count; ++i) {
+		if (i) {
+			tprint_array_next();
+			if (abbrev(tcp) && i >= max_strlen) {
+				tprint_more_data_follows();
+				break;
+			}
+		}
+		print_io_uring_ring_cqe(&d->cqes[i]);
+	}
+	tprint_array_end();
+	tprint_comment_end();
+}
+
+void
+io_uring_rings_summary(FILE *outf)
+{
+	bool header = false;
+
+	for (unsigned int op = 0; op < ARRAY_SIZE(uring_op_stats); ++op) {
+		const struct uring_op_stats *s = &uring_op_stats[op];
+
+		if (!s->count)
+			continue;
+
+		if (!header) {
+			fprintf(outf, "%-28s %9s %11s %11s %11s %11s\n",
+				"io_uring op", "calls", "seconds",
+				"usecs/call", "shortest", "longest");
+			fprintf(outf, "%-28s %9s %11s %11s %11s %11s\n",
+				"----------------------------", "---------",
+				"-----------", "-----------", "-----------",
+				"-----------");
+			header = true;
+		}
+
+		const char *name = xlookup(uring_ops, op);
+		char buf[sizeof("IORING_OP_255")];
+		if (!name) {
+			xsprintf(buf, "IORING_OP_%u", op);
+			name = buf;
+		}
+
+		struct timespec avg;
+		ts_div(&avg, &s->total, s->count);
+		fprintf(outf, "%-28s %9" PRIu64 " %11.6f %11" PRIu64
+			" %11.6f %11.6f\n",
+			name, s->count, ts_float(&s->total),
+			(uint64_t) (ts_float(&avg) * 1e6),
+			ts_float(&s->min), ts_float(&s->max));
+	}
+}
+
 static int
 print_ioring_register_send_msg_ring(struct tcb *tcp, const kernel_ulong_t addr,
 				    const unsigned int nargs)
@@ -16,6 +16,7 @@
 # include "arch_kvm.c"
 # include "xmalloc.h"
 # include "mmap_cache.h"
+# include "sen.h"
 # include "xlat/kvm_exit_io.h"
 
 struct vcpu_info {
@@ -25,9 +26,19 @@ struct vcpu_info {
 	unsigned long mmap_addr;
 	unsigned long mmap_len;
 	bool resolved;
+
+	/* KVM_RUN statistics, see -e kvm=stats.  */
+	struct kvm_vcpu_stats *stats;
+	struct timespec run_start;	/* When KVM_RUN was entered */
+	struct timespec run_end;	/* When KVM_RUN last returned */
+	unsigned int last_exit;		/* Exit stats index of the last run */
+	uint64_t last_hot_key;		/* Hot list key of the last exit, 0 if none */
+	bool running;			/* KVM_RUN has been entered */
+	bool exited;			/* KVM_RUN has returned since then */
 };
 
 enum decode_kvm_run_structure_modes decode_kvm_run_structure;
+bool kvm_run_stats;
 
 static struct vcpu_info *
 vcpu_find(struct tcb *const tcp, int fd)
@@ -587,6 +598,387 @@ kvm_run_structure_decode(struct tcb * tcp)
 	tcp->vcpu_leaving = NULL;
 }
 
+/*
+ * KVM_RUN statistics: per-vCPU and per-exit-reason counts, the time spent
+ * in KVM_RUN (guest time), and the time spent by the VMM between returning
+ * from KVM_RUN and entering it again (VMM time), which is attributed
+ * to the exit reason that KVM_RUN returned with.  IO port and MMIO address
+ * exits are also accounted in hot lists.
+ */
+
+# define KVM_EXIT_STATS_OTHER	64	/* Exit reasons that do not fit */
+# define KVM_EXIT_STATS_ERROR	65	/* KVM_RUN failures */
+# define KVM_EXIT_STATS_SIZE	66
+# define KVM_HOT_LIST_SIZE	16
+
+struct kvm_exit_stats {
+	uint64_t count;
+	struct timespec guest_time;
+	struct timespec vmm_time;
+};
+
+struct kvm_vcpu_stats {
+	int tgid;
+	int cpuid;
+	struct kvm_exit_stats total;
+	struct kvm_exit_stats exits[KVM_EXIT_STATS_SIZE];
+};
+
+enum kvm_hot_kind {
+	KVM_HOT_IO = 1,
+	KVM_HOT_MMIO = 2,
+};
+
+struct kvm_hot_entry {
+	uint64_t key;	/* addr << 3 | kind << 1 | is_write, 0 if unused */
+	uint64_t count;
+	struct timespec vmm_time;
+};
+
+static struct kvm_vcpu_stats **vcpu_stats;
+static size_t vcpu_stats_count;
+static size_t vcpu_stats_size;
+
+/* Open addressing hash table of hot IO port and MMIO address exits.  */
+static struct kvm_hot_entry *hot_tab;
+static size_t hot_tab_size;
+static size_t hot_tab_count;
+
+static struct kvm_vcpu_stats *
+vcpu_stats_get(struct tcb *tcp, struct vcpu_info *info)
+{
+	const int tgid = get_tcb_tgid(tcp);
+
+	if (info->stats && info->stats->tgid == tgid
+	    && info->stats->cpuid == info->cpuid)
+		return info->stats;
+
+	for (size_t i = 0; i < vcpu_stats_count; ++i) {
+		if (vcpu_stats[i]->tgid == tgid
+		    && vcpu_stats[i]->cpuid == info->cpuid)
+			return info->stats = vcpu_stats[i];
+	}
+
+	if (vcpu_stats_count == vcpu_stats_size)
+		vcpu_stats = xgrowarray(vcpu_stats, &vcpu_stats_size,
+					sizeof(*vcpu_stats));
+
+	struct kvm_vcpu_stats *st = xzalloc(sizeof(*st));
+	st->tgid = tgid;
+	st->cpuid = info->cpuid;
+	vcpu_stats[vcpu_stats_count++] = st;
+
+	return info->stats = st;
+}
+
+static size_t
+hot_hash(uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static struct kvm_hot_entry *
+hot_lookup(uint64_t key, bool create)
+{
+	if (!hot_tab_size) {
+		if (!create)
+			return NULL;
+		hot_tab_size = 64;
+		hot_tab = xcalloc(hot_tab_size, sizeof(*hot_tab));
+	}
+
+	for (size_t i = hot_hash(key);; ++i) {
+		struct kvm_hot_entry *e = &hot_tab[i & (hot_tab_size - 1)];
+
+		if (e->key == key)
+			return e;
+		if (e->key)
+			continue;
+		if (!create)
+			return NULL;
+
+		if ((hot_tab_count + 1) * 2 > hot_tab_size) {
+			/* Rehash into a table twice as large.  */
+			struct kvm_hot_entry *old = hot_tab;
+			const size_t old_size = hot_tab_size;
+
+			hot_tab_size *= 2;
+			hot_tab = xcalloc(hot_tab_size, sizeof(*hot_tab));
+			for (size_t j = 0; j < old_size; ++j) {
+				if (!old[j].key)
+					continue;
+				for (size_t k = hot_hash(old[j].key);; ++k) {
+					e = &hot_tab[k & (hot_tab_size - 1)];
+					if (!e->key) {
+						*e = old[j];
+						break;
+					}
+				}
+			}
+			free(old);
+			return hot_lookup(key, true);
+		}
+
+		e->key = key;
+		++hot_tab_count;
+		return e;
+	}
+}
+
+static bool
+is_kvm_run(struct tcb *tcp)
+{
+	return tcp_sysent(tcp)->sen == SEN_ioctl
+	       && (unsigned int) tcp->u_arg[1] == KVM_RUN;
+}
+
+void
+kvm_run_stats_entering(struct tcb *tcp)
+{
+	if (!is_kvm_run(tcp))
+		return;
+
+	struct vcpu_info *info = vcpu_get_info(tcp, tcp->u_arg[0]);
+	if (!info)
+		return;
+
+	struct kvm_vcpu_stats *st = vcpu_stats_get(tcp, info);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (info->exited) {
+		struct timespec dt;
+		ts_sub(&dt, &now, &info->run_end);
+
+		ts_add(&st->total.vmm_time, &st->total.vmm_time, &dt);
+		struct kvm_exit_stats *es = &st->exits[info->last_exit];
+		ts_add(&es->vmm_time, &es->vmm_time, &dt);
+
+		if (info->last_hot_key) {
+			struct kvm_hot_entry *e =
+				hot_lookup(info->last_hot_key, false);
+			if (e)
+				ts_add(&e->vmm_time, &e->vmm_time, &dt);
+		}
+	}
+
+	info->run_start = now;
+	info->running = true;
+	info->exited = false;
+}
+
+void
+kvm_run_stats_exiting(struct tcb *tcp)
+{
+	if (!is_kvm_run(tcp))
+		return;
+
+	struct vcpu_info *info = vcpu_find(tcp, tcp->u_arg[0]);
+	if (!info || !info->running || !info->stats)
+		return;
+
+	struct kvm_vcpu_stats *st = info->stats;
+	struct timespec now, dt;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &info->run_start);
+
+	info->running = false;
+	info->exited = true;
+	info->run_end = now;
+	info->last_hot_key = 0;
+
+	/* Only the exit information is needed, not the whole kvm_run.  */
+	struct kvm_run run;
+	const size_t len = MAX(offsetof(struct kvm_run, io) + sizeof(run.io),
+			       offsetof(struct kvm_run, mmio) + sizeof(run.mmio));
+
+	if (syserror(tcp)) {
+		info->last_exit = KVM_EXIT_STATS_ERROR;
+	} else if (info->mmap_len < len
+		   || umoven(tcp, info->mmap_addr, len, &run) < 0) {
+		info->last_exit = KVM_EXIT_STATS_OTHER;
+	} else {
+		info->last_exit = run.exit_reason < KVM_EXIT_STATS_OTHER
+				  ? run.exit_reason : KVM_EXIT_STATS_OTHER;
+
+		if (run.exit_reason == KVM_EXIT_IO)
+			info->last_hot_key = (uint64_t) run.io.port << 3
+				| KVM_HOT_IO << 1
+				| (run.io.direction == KVM_EXIT_IO_OUT);
+		else if (run.exit_reason == KVM_EXIT_MMIO)
+			info->last_hot_key = (uint64_t) run.mmio.phys_addr << 3
+				| KVM_HOT_MMIO << 1
+				| !!run.mmio.is_write;
+	}
+
+	st->total.count++;
+	ts_add(&st->total.guest_time, &st->total.guest_time, &dt);
+	struct kvm_exit_stats *es = &st->exits[info->last_exit];
+	es->count++;
+	ts_add(&es->guest_time, &es->guest_time, &dt);
+
+	if (info->last_hot_key)
+		hot_lookup(info->last_hot_key, true)->count++;
+}
+
+static const char *
+kvm_exit_stats_name(unsigned int idx)
+{
+	if (idx == KVM_EXIT_STATS_ERROR)
+		return "error";
+
+	const char *name = idx < KVM_EXIT_STATS_OTHER
+			   ? xlookup(kvm_exit_reason, idx) : NULL;
+	return name ? name : "KVM_EXIT_???";
+}
+
+static void
+print_kvm_stats_divider(FILE *outf)
+{
+	fputs("------ ----------- ----------- --------- -----------"
+	      " ----------------\n", outf);
+}
+
+static void
+print_kvm_exit_stats(FILE *outf, const struct kvm_exit_stats *es,
+		     double vmm_total, const char *name)
+{
+	const double vmm = ts_float(&es->vmm_time);
+
+	fprintf(outf, "%6.2f %11.6f %11" PRIu64 " %9" PRIu64 " %11.6f %s\n",
+		vmm_total > 0 ? vmm * 100 / vmm_total : 0, vmm,
+		es->count ? (uint64_t) (vmm * 1e6 / es->count) : 0,
+		es->count, ts_float(&es->guest_time), name);
+}
+
+static int
+hot_entry_cmp(const void *a, const void *b)
+{
+	const struct kvm_hot_entry *const *ea = a;
+	const struct kvm_hot_entry *const *eb = b;
+
+	if ((*ea)->count != (*eb)->count)
+		return (*ea)->count < (*eb)->count ? 1 : -1;
+	return (*ea)->key < (*eb)->key ? -1 : (*ea)->key > (*eb)->key;
+}
+
+static void
+print_kvm_hot_list(FILE *outf, enum kvm_hot_kind kind)
+{
+	struct kvm_hot_entry **list = xcalloc(hot_tab_count, sizeof(*list));
+	size_t n = 0;
+
+	for (size_t i = 0; i < hot_tab_size; ++i) {
+		if (hot_tab[i].key && ((hot_tab[i].key >> 1) & 3) == kind)
+			list[n++] = &hot_tab[i];
+	}
+
+	if (n) {
+		qsort(list, n, sizeof(*list), hot_entry_cmp);
+
+		fprintf(outf, "\nKVM %s exits:\n"
+			"    exits    vmm-secs  usecs/exit %-5s %s\n"
+			"--------- ----------- ----------- ----- ----------------\n",
+			kind == KVM_HOT_IO ? "IO port" : "MMIO address",
+			"dir", kind == KVM_HOT_IO ? "port" : "address");
+
+		for (size_t i = 0; i < MIN(n, KVM_HOT_LIST_SIZE); ++i) {
+			const double vmm = ts_float(&list[i]->vmm_time);
+			const bool is_write = list[i]->key & 1;
+
+			fprintf(outf, "%9" PRIu64 " %11.6f %11" PRIu64
+				" %-5s %#" PRIx64 "\n",
+				list[i]->count, vmm,
+				(uint64_t) (vmm * 1e6 / list[i]->count),
+				kind == KVM_HOT_IO ? (is_write ? "out" : "in")
+						   : (is_write ? "write" : "read"),
+				list[i]->key >> 3);
+		}
+	}
+
+	free(list);
+}
+
+void
+kvm_run_stats_summary(FILE *outf)
+{
+	if (!vcpu_stats_count)
+		return;
+
+	/* Per-vCPU totals.  */
+	fputs("KVM vCPU summary:\n"
+	      "     pid  vcpu      runs   guest-secs     vmm-secs  % guest\n"
+	      "-------- ----- --------- ------------ ------------ --------\n",
+	      outf);
+
+	struct kvm_vcpu_stats all = { .tgid = 0 };
+
+	for (size_t i = 0; i < vcpu_stats_count; ++i) {
+		const struct kvm_vcpu_stats *st = vcpu_stats[i];
+		const double guest = ts_float(&st->total.guest_time);
+		const double vmm = ts_float(&st->total.vmm_time);
+
+		fprintf(outf, "%8d %5d %9" PRIu64 " %12.6f %12.6f %8.2f\n",
+			st->tgid, st->cpuid, st->total.count, guest, vmm,
+			guest + vmm > 0 ? guest * 100 / (guest + vmm) : 0);
+
+		ts_add(&all.total.vmm_time, &all.total.vmm_time,
+		       &st->total.vmm_time);
+		ts_add(&all.total.guest_time, &all.total.guest_time,
+		       &st->total.guest_time);
+		all.total.count += st->total.count;
+
+		for (size_t j = 0; j < KVM_EXIT_STATS_SIZE; ++j) {
+			struct kvm_exit_stats *es = &all.exits[j];
+
+			es->count += st->exits[j].count;
+			ts_add(&es->guest_time, &es->guest_time,
+			       &st->exits[j].guest_time);
+			ts_add(&es->vmm_time, &es->vmm_time,
+			       &st->exits[j].vmm_time);
+		}
+	}
+
+	/* Per-exit-reason totals, sorted by the VMM time.  */
+	const double vmm_total = ts_float(&all.total.vmm_time);
+	unsigned int order[KVM_EXIT_STATS_SIZE];
+	size_t n = 0;
+
+	for (unsigned int j = 0; j < KVM_EXIT_STATS_SIZE; ++j) {
+		if (!all.exits[j].count)
+			continue;
+
+		size_t k = n++;
+		for (; k > 0; --k) {
+			if (ts_cmp(&all.exits[order[k - 1]].vmm_time,
+				   &all.exits[j].vmm_time) >= 0)
+				break;
+			order[k] = order[k - 1];
+		}
+		order[k] = j;
+	}
+
+	fputs("\nKVM exit summary:\n"
+	      "% time    vmm-secs  usecs/exit     exits  guest-secs"
+	      " exit reason\n", outf);
+	print_kvm_stats_divider(outf);
+	for (size_t k = 0; k < n; ++k)
+		print_kvm_exit_stats(outf, &all.exits[order[k]], vmm_total,
+				     kvm_exit_stats_name(order[k]));
+	print_kvm_stats_divider(outf);
+	print_kvm_exit_stats(outf, &all.total, vmm_total, "total");
+
+	print_kvm_hot_list(outf, KVM_HOT_IO);
+	print_kvm_hot_list(outf, KVM_HOT_MMIO);
+}
+
+void
+kvm_run_stats_init(void)
+{
+	kvm_run_stats = true;
+	mmap_cache_enable();
+}
+
 void
 kvm_run_structure_decoder_init(enum decode_kvm_run_structure_modes mode)
 {
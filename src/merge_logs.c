@@ -0,0 +1,334 @@
+/*
+ * Merging of -ff log files.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * This is a native implementation of strace-log-merge: the PREFIX.PID
+ * files written by strace -ff -tt[t] are merged by timestamp, and every
+ * line is prefixed with the PID.  As every file is already ordered
+ * by time, the files are mapped into memory and merged using a heap
+ * of per-file cursors, so the memory used does not depend on the size
+ * of the logs.  Lines without a timestamp, like stack traces printed
+ * with -k, stay attached to the preceding line; those in the beginning
+ * of a file precede its first line with a timestamp.  Lines with equal
+ * timestamps are ordered by file name, just like the stable sort
+ * of strace-log-merge does.
+ */
+
+#include "defs.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct log_cursor {
+	const char *suffix;
+	/* The lines before the first line with a timestamp, if not printed.  */
+	const char *lead;
+	const char *pos;
+	const char *end;
+	/* The current line.  */
+	const char *line;
+	size_t line_len;
+	/* Timestamp digits of the current line without leading zeroes.  */
+	char key[48];
+	size_t key_len;
+};
+
+static struct log_cursor *cursors;
+static size_t *heap;
+static size_t heap_len;
+
+/* Appends the run of digits at *p to the key, returns its length.  */
+static size_t
+append_digits(struct log_cursor *c, const char **p)
+{
+	const char *start = *p;
+
+	for (; *p < c->end && isdigit((unsigned char) **p); ++*p) {
+		if (!c->key_len && **p == '0')
+			continue;
+		if (c->key_len >= sizeof(c->key))
+			return 0;
+		c->key[c->key_len++] = **p;
+	}
+
+	return *p - start;
+}
+
+/*
+ * Parses the timestamp in the beginning of the current line,
+ * which is one of "[[HH:]MM:]SS[.FRACTION] " and "SECONDS[.FRACTION] ".
+ */
+static bool
+parse_timestamp(struct log_cursor *c)
+{
+	const char *p = c->line;
+
+	c->key_len = 0;
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (c->end - p < 3 || !isdigit((unsigned char) p[0])
+		    || !isdigit((unsigned char) p[1]) || p[2] != ':')
+			break;
+		append_digits(c, &p);
+		++p;
+	}
+
+	if (!append_digits(c, &p) || p >= c->end)
+		return false;
+
+	if (*p == '.') {
+		++p;
+		if (!append_digits(c, &p) || p >= c->end)
+			return false;
+	}
+
+	return *p == ' ';
+}
+
+static void
+next_line(struct log_cursor *c)
+{
+	const char *nl = memchr(c->pos, '\n', c->end - c->pos);
+
+	c->line = c->pos;
+	c->line_len = (nl ? nl : c->end) - c->pos;
+	c->pos = nl ? nl + 1 : c->end;
+}
+
+/*
+ * Advances the cursor to the next line with a timestamp,
+ * returns false at the end of the file.
+ */
+static bool
+next_record(struct log_cursor *c)
+{
+	while (c->pos < c->end) {
+		next_line(c);
+		if (parse_timestamp(c))
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+cursor_less(const size_t a, const size_t b)
+{
+	const struct log_cursor *ca = &cursors[a];
+	const struct log_cursor *cb = &cursors[b];
+
+	if (ca->key_len != cb->key_len)
+		return ca->key_len < cb->key_len;
+
+	const int rc = memcmp(ca->key, cb->key, ca->key_len);
+
+	return rc ? rc < 0 : a < b;
+}
+
+static void
+heap_sift_down(size_t i)
+{
+	for (;;) {
+		size_t min = i;
+		const size_t l = 2 * i + 1;
+		const size_t r = l + 1;
+
+		if (l < heap_len && cursor_less(heap[l], heap[min]))
+			min = l;
+		if (r < heap_len && cursor_less(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		const size_t t = heap[i];
+		heap[i] = heap[min];
+		heap[min] = t;
+		i = min;
+	}
+}
+
+static void
+print_line(const struct log_cursor *c, const int width)
+{
+	printf("%-*s ", width, c->suffix);
+	fwrite(c->line, 1, c->line_len, stdout);
+	putchar('\n');
+}
+
+/* Prints the lines of the file before its first line with a timestamp.  */
+static void
+print_lead(struct log_cursor *c, const int width)
+{
+	struct log_cursor l = {
+		.suffix = c->suffix,
+		.pos = c->lead,
+		.end = c->line,
+	};
+
+	while (l.pos < l.end) {
+		next_line(&l);
+		if (l.line_len)
+			print_line(&l, width);
+	}
+
+	c->lead = NULL;
+}
+
+static bool
+is_log_suffix(const char *suffix)
+{
+	bool nonzero = false;
+
+	for (const char *p = suffix; *p; ++p) {
+		if (!isdigit((unsigned char) *p))
+			return false;
+		if (*p != '0')
+			nonzero = true;
+	}
+
+	return nonzero;
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/* Returns the sorted list of PREFIX.PID file names.  */
+static char **
+list_logs(const char *prefix, size_t *count)
+{
+	const char *slash = strrchr(prefix, '/');
+	const char *base = slash ? slash + 1 : prefix;
+	const size_t base_len = strlen(base);
+	const size_t dir_len = slash ? (size_t) (slash - prefix) + 1 : 0;
+	char *dir = slash ? xstrndup(prefix, dir_len) : xstrdup(".");
+	char **names = NULL;
+	size_t size = 0;
+	struct dirent *de;
+
+	DIR *d = opendir(dir);
+	if (!d)
+		perror_msg_and_die("opendir: %s", dir);
+
+	*count = 0;
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, base, base_len)
+		    || de->d_name[base_len] != '.'
+		    || !is_log_suffix(de->d_name + base_len + 1))
+			continue;
+
+		if (*count >= size)
+			names = xgrowarray(names, &size, sizeof(*names));
+
+		char *name = xmalloc(dir_len + strlen(de->d_name) + 1);
+		memcpy(name, prefix, dir_len);
+		strcpy(name + dir_len, de->d_name);
+		names[(*count)++] = name;
+	}
+
+	closedir(d);
+	free(dir);
+
+	if (*count)
+		qsort(names, *count, sizeof(*names), name_cmp);
+	return names;
+}
+
+static void
+map_log(struct log_cursor *c, const char *name, const size_t suffix_offset)
+{
+	struct stat st;
+	int fd = open(name, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st))
+		perror_msg_and_die("%s", name);
+
+	c->suffix = name + suffix_offset;
+	c->lead = c->pos = c->end = NULL;
+
+	if (st.st_size > 0) {
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (p == MAP_FAILED)
+			perror_msg_and_die("mmap: %s", name);
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+		c->lead = c->pos = p;
+		c->end = c->pos + st.st_size;
+	}
+
+	close(fd);
+}
+
+int
+merge_logs(const char *prefix)
+{
+	size_t count;
+	char **names = list_logs(prefix, &count);
+	const size_t suffix_offset = strlen(prefix) + 1;
+	int width = 0;
+
+	if (!count) {
+		error_msg("%s: strace output not found", prefix);
+		return 1;
+	}
+
+	cursors = xcalloc(count, sizeof(*cursors));
+	heap = xcalloc(count, sizeof(*heap));
+
+	for (size_t i = 0; i < count; ++i) {
+		map_log(&cursors[i], names[i], suffix_offset);
+		width = MAX(width, (int) strlen(cursors[i].suffix));
+		if (next_record(&cursors[i]))
+			heap[heap_len++] = i;
+	}
+
+	if (!heap_len) {
+		error_msg("%s.* files do not look like log files produced"
+			  " by 'strace -tt'", prefix);
+		return 1;
+	}
+
+	for (size_t i = heap_len / 2; i-- > 0; )
+		heap_sift_down(i);
+
+	while (heap_len) {
+		struct log_cursor *c = &cursors[heap[0]];
+		bool more = false;
+
+		if (c->lead)
+			print_lead(c, width);
+		print_line(c, width);
+
+		/* Lines without a timestamp follow the line before them.  */
+		while (c->pos < c->end) {
+			next_line(c);
+			if (parse_timestamp(c)) {
+				more = true;
+				break;
+			}
+			if (c->line_len)
+				print_line(c, width);
+		}
+
+		if (!more)
+			heap[0] = heap[--heap_len];
+		heap_sift_down(0);
+	}
+
+	if (fflush(stdout)) {
+		perror_msg("write");
+		return 1;
+	}
+
+	return 0;
+}
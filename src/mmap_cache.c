@@ -1,81 +1,417 @@
 /*
  * Copyright (c) 2013 Luca Clementi <luca.clementi@gmail.com>
- * Copyright (c) 2013-2021 The strace developers.
+ * Copyright (c) 2013-2026 The strace developers.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 
 #include "defs.h"
 #include <limits.h>
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "largefile_wrappers.h"
 #include "mmap_cache.h"
 #include "mmap_notify.h"
+#include "sen.h"
 #include "xstring.h"
 
-static unsigned int mmap_cache_generation;
+/* Caches of all traced address spaces.  */
+static EMPTY_LIST(mmap_cache_list);
 
 static void
-mmap_cache_invalidate(struct tcb *tcp, void *unused)
+mmap_cache_invalidate(struct mmap_cache_t *cache, struct tcb *tcp,
+		      const char *reason)
 {
-	mmap_cache_generation++;
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0);
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, tgid=%d, reason=%s",
+		       cache->generation, tcp, cache->entry, cache->tgid,
+		       reason);
+	cache->stale = true;
 }
 
-void
-mmap_cache_enable(void)
+static void
+free_entries(struct mmap_cache_t *cache)
 {
-	static bool use_mmap_cache;
-
-	if (!use_mmap_cache) {
-		mmap_notify_register_client(mmap_cache_invalidate, NULL);
-		use_mmap_cache = true;
+	while (cache->size) {
+		unsigned int i = --cache->size;
+		free(cache->entry[i].binary_filename);
+		cache->entry[i].binary_filename = NULL;
 	}
+	cache->last_hit = 0;
 }
 
 /* deleting the cache */
 static void
 delete_mmap_cache(struct tcb *tcp, const char *caller)
 {
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0, caller);
+	struct mmap_cache_t *cache = tcp->mmap_cache;
+
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, caller=%s",
+		       cache ? cache->generation : 0, tcp,
+		       cache ? cache->entry : 0, caller);
+
+	if (!cache)
+		return;
 
-	if (!tcp->mmap_cache)
+	tcp->mmap_cache = NULL;
+	if (--cache->refcount)
 		return;
 
-	while (tcp->mmap_cache->size) {
-		unsigned int i = --tcp->mmap_cache->size;
-		free(tcp->mmap_cache->entry[i].binary_filename);
-		tcp->mmap_cache->entry[i].binary_filename = NULL;
+	list_remove(&cache->list);
+	free_entries(cache);
+	free(cache->entry);
+	free(cache);
+}
+
+/*
+ * Attach the tcb to the cache of its thread group,
+ * creating an empty stale cache if there is none yet.
+ */
+static struct mmap_cache_t *
+get_mmap_cache(struct tcb *tcp)
+{
+	if (tcp->mmap_cache)
+		return tcp->mmap_cache;
+
+	const int tgid = get_tcb_tgid(tcp);
+	struct mmap_cache_t *cache;
+
+	list_foreach(cache, &mmap_cache_list, list) {
+		if (cache->tgid == tgid)
+			goto found;
 	}
 
-	free(tcp->mmap_cache->entry);
-	tcp->mmap_cache->entry = NULL;
+	cache = xzalloc(sizeof(*cache));
+	cache->free_fn = delete_mmap_cache;
+	cache->generation = 1;
+	cache->tgid = tgid;
+	cache->stale = true;
+	list_insert(&mmap_cache_list, &cache->list);
+
+found:
+	cache->refcount++;
+	tcp->mmap_cache = cache;
+	tcp->mmap_cache_generation = 0;
+	return cache;
+}
 
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
+/* Returns the index of the first entry that ends above addr.  */
+static unsigned int
+lower_bound(const struct mmap_cache_t *cache, unsigned long addr)
+{
+	unsigned int lower = 0;
+	unsigned int upper = cache->size;
+
+	while (lower < upper) {
+		unsigned int mid = lower + (upper - lower) / 2;
+
+		if (cache->entry[mid].end_addr <= addr)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+	return lower;
+}
+
+static struct mmap_cache_entry_t *
+insert_entry(struct mmap_cache_t *cache, unsigned int idx)
+{
+	if (cache->size >= cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+	memmove(&cache->entry[idx + 1], &cache->entry[idx],
+		(cache->size - idx) * sizeof(*cache->entry));
+	cache->size++;
+	return &cache->entry[idx];
+}
+
+/* Split the entry containing addr, if any, into two at addr.  */
+static void
+split_at(struct mmap_cache_t *cache, unsigned long addr)
+{
+	unsigned int i = lower_bound(cache, addr);
+
+	if (i >= cache->size || cache->entry[i].start_addr >= addr)
+		return;
+
+	struct mmap_cache_entry_t *hi = insert_entry(cache, i + 1);
+	struct mmap_cache_entry_t *lo = hi - 1;
+
+	*hi = *lo;
+	hi->binary_filename = xstrdup(lo->binary_filename);
+	hi->start_addr = addr;
+	hi->mmap_offset += addr - lo->start_addr;
+	lo->end_addr = addr;
+}
+
+/* Returns the range of entries covering [start, end) after splitting.  */
+static unsigned int
+split_range(struct mmap_cache_t *cache, unsigned long start,
+	    unsigned long end, unsigned int *last)
+{
+	split_at(cache, start);
+	split_at(cache, end);
+
+	unsigned int first = lower_bound(cache, start);
+	unsigned int i = first;
+	while (i < cache->size && cache->entry[i].start_addr < end)
+		++i;
+	*last = i;
+	return first;
+}
+
+static void
+remove_range(struct mmap_cache_t *cache, unsigned long start,
+	     unsigned long end)
+{
+	unsigned int last;
+	unsigned int first = split_range(cache, start, end, &last);
+
+	for (unsigned int i = first; i < last; ++i)
+		free(cache->entry[i].binary_filename);
+	memmove(&cache->entry[first], &cache->entry[last],
+		(cache->size - last) * sizeof(*cache->entry));
+	cache->size -= last - first;
+	cache->last_hit = 0;
+}
+
+static unsigned char
+prot_to_protections(kernel_ulong_t prot)
+{
+	return 0
+		| ((prot & PROT_READ)  ? MMAP_CACHE_PROT_READABLE  : 0)
+		| ((prot & PROT_WRITE) ? MMAP_CACHE_PROT_WRITABLE  : 0)
+		| ((prot & PROT_EXEC)  ? MMAP_CACHE_PROT_EXECUTABLE: 0);
+}
+
+static unsigned long
+page_align(kernel_ulong_t len)
+{
+	const unsigned long mask = get_pagesize() - 1;
+
+	return (len + mask) & ~mask;
 }
 
 /*
- * caching of /proc/ID/maps for each process to speed up stack tracing
- *
- * The cache must be refreshed after syscalls that affect memory mappings,
- * e.g. mmap, mprotect, munmap, execve.
+ * Add a file-backed mapping the same way it is shown in /proc/PID/maps.
+ * Returns false if the file cannot be identified.
  */
-extern enum mmap_cache_rebuild_result
-mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+static bool
+add_file_mapping(struct tcb *tcp, struct mmap_cache_t *cache,
+		 unsigned long start, unsigned long end, int fd,
+		 kernel_ulong_t prot, kernel_ulong_t flags,
+		 unsigned long long offset)
 {
-	if (tcp->mmap_cache
-	    && tcp->mmap_cache->generation != mmap_cache_generation)
-		delete_mmap_cache(tcp, caller);
+	char path[PATH_MAX + 1];
+	bool deleted = false;
+
+	if (getfdpath_pid(tcp->pid, fd, path, sizeof(path) - 10,
+			  &deleted) < 0)
+		return false;
+	if (deleted)
+		strcat(path, " (deleted)");
+
+	char fdpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int) * 3];
+	strace_stat_t st;
+
+	xsprintf(fdpath, "/proc/%u/fd/%u", get_proc_pid(tcp->pid), fd);
+	if (stat_file(fdpath, &st))
+		return false;
+
+	struct mmap_cache_entry_t *entry =
+		insert_entry(cache, lower_bound(cache, start));
+	entry->start_addr = start;
+	entry->end_addr = end;
+	entry->mmap_offset = offset;
+	entry->protections = prot_to_protections(prot)
+		| ((flags & MAP_TYPE) != MAP_PRIVATE
+		   ? MMAP_CACHE_PROT_SHARED : 0);
+	entry->major = major(st.st_dev);
+	entry->minor = minor(st.st_dev);
+	entry->binary_filename = xstrdup(path);
+	return true;
+}
 
-	if (tcp->mmap_cache)
-		return MMAP_CACHE_REBUILD_READY;
+static bool
+update_mmap(struct tcb *tcp, struct mmap_cache_t *cache,
+	    unsigned long long offset)
+{
+	const unsigned long start = tcp->u_rval;
+	const unsigned long end = start + page_align(tcp->u_arg[1]);
+	const kernel_ulong_t prot = tcp->u_arg[2];
+	const kernel_ulong_t flags = tcp->u_arg[3];
+
+	remove_range(cache, start, end);
+	if (flags & MAP_ANONYMOUS) {
+		/*
+		 * Shared anonymous mappings are backed by shmem files
+		 * and shown as "/dev/zero (deleted)".
+		 */
+		return (flags & MAP_TYPE) == MAP_PRIVATE;
+	}
+
+	return add_file_mapping(tcp, cache, start, end, tcp->u_arg[4],
+				prot, flags, offset);
+}
+
+static bool
+update_mprotect(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long start = tcp->u_arg[0];
+	const unsigned long end = start + page_align(tcp->u_arg[1]);
+	const unsigned char protections = prot_to_protections(tcp->u_arg[2]);
+	unsigned int last;
+	unsigned int first = split_range(cache, start, end, &last);
+
+	for (unsigned int i = first; i < last; ++i) {
+		cache->entry[i].protections &= MMAP_CACHE_PROT_SHARED;
+		cache->entry[i].protections |= protections;
+	}
+	return true;
+}
+
+static bool
+update_mremap(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long old_start = tcp->u_arg[0];
+	const unsigned long old_end = old_start + page_align(tcp->u_arg[1]);
+	const unsigned long new_start = tcp->u_rval;
+	const unsigned long new_end = new_start + page_align(tcp->u_arg[2]);
+	const kernel_ulong_t flags = tcp->u_arg[3];
+	struct mmap_cache_entry_t moved = { .binary_filename = NULL };
+
+	/* The mapping being moved has to be described by a single entry.  */
+	unsigned int i = lower_bound(cache, old_start);
+	if (i < cache->size && cache->entry[i].start_addr < old_end) {
+		if (cache->entry[i].start_addr > old_start
+		    || cache->entry[i].end_addr < old_end)
+			return false;
+		moved = cache->entry[i];
+		moved.mmap_offset += old_start - moved.start_addr;
+		moved.binary_filename = xstrdup(moved.binary_filename);
+	}
+
+	if (old_end > old_start && !(flags & MREMAP_DONTUNMAP))
+		remove_range(cache, old_start, old_end);
+	remove_range(cache, new_start, new_end);
+
+	if (moved.binary_filename) {
+		moved.start_addr = new_start;
+		moved.end_addr = new_end;
+		*insert_entry(cache, lower_bound(cache, new_start)) = moved;
+	}
+	return true;
+}
+
+static bool
+update_brk(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long brk_end = page_align(tcp->u_rval);
+
+	for (unsigned int i = 0; i < cache->size; ++i) {
+		struct mmap_cache_entry_t *entry = &cache->entry[i];
+
+		if (strcmp(entry->binary_filename, "[heap]"))
+			continue;
+		if (brk_end <= entry->start_addr)
+			return false;
+		if (i + 1 < cache->size
+		    && brk_end > cache->entry[i + 1].start_addr)
+			return false;
+		entry->end_addr = brk_end;
+		return true;
+	}
+
+	/* The heap has not been created yet.  */
+	return false;
+}
+
+/*
+ * Apply the result of a syscall that changes memory mappings
+ * to the cache.  Returns false if the change cannot be applied
+ * incrementally.
+ */
+static bool
+update_mmap_cache(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+		return update_mmap(tcp, cache, tcp->u_arg[5]);
+	case SEN_mmap_pgoff:
+		return update_mmap(tcp, cache,
+				   (unsigned long long) tcp->u_arg[5]
+				   * get_pagesize());
+	case SEN_mmap_4koff:
+		return update_mmap(tcp, cache,
+				   (unsigned long long) tcp->u_arg[5] << 12);
+	case SEN_munmap:
+		remove_range(cache, tcp->u_arg[0],
+			     tcp->u_arg[0] + page_align(tcp->u_arg[1]));
+		return true;
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		return update_mprotect(tcp, cache);
+	case SEN_mremap:
+		return update_mremap(tcp, cache);
+	case SEN_brk:
+		return update_brk(tcp, cache);
+	default:
+		/* execve, shmat, old_mmap, etc.  */
+		return false;
+	}
+}
+
+static void
+mmap_cache_notify(struct tcb *tcp, bool has_result, void *unused)
+{
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
+
+	if (cache->stale)
+		return;
+
+	if (!has_result) {
+		mmap_cache_invalidate(cache, tcp, "no syscall result");
+		return;
+	}
+
+	/* Failed syscalls do not change mappings.  */
+	if (syserror(tcp))
+		return;
+
+	if (!update_mmap_cache(tcp, cache)) {
+		mmap_cache_invalidate(cache, tcp, tcp_sysent(tcp)->sys_name);
+		return;
+	}
+
+	cache->generation++;
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, tgid=%d, updated by %s",
+		       cache->generation, tcp, cache->entry, cache->tgid,
+		       tcp_sysent(tcp)->sys_name);
+}
+
+void
+mmap_cache_enable(void)
+{
+	static bool use_mmap_cache;
+
+	if (!use_mmap_cache) {
+		mmap_notify_register_client(mmap_cache_notify, NULL);
+		use_mmap_cache = true;
+	}
+}
+
+/*
+ * Read /proc/ID/maps into the cache.
+ */
+static void
+rebuild_mmap_cache(struct tcb *tcp, struct mmap_cache_t *cache,
+		   const char *caller)
+{
+	free_entries(cache);
+	cache->stale = false;
+	cache->generation++;
 
 	char filename[sizeof("/proc/4294967296/maps")];
 	xsprintf(filename, "/proc/%u/maps", get_proc_pid(tcp->pid));
@@ -83,16 +419,10 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 	FILE *fp = fopen_stream(filename, "r");
 	if (!fp) {
 		perror_msg("fopen: %s", filename);
-		return MMAP_CACHE_REBUILD_NOCACHE;
+		cache->stale = true;
+		return;
 	}
 
-	struct mmap_cache_t cache = {
-		.free_fn = delete_mmap_cache,
-		.generation = mmap_cache_generation
-	};
-
-	/* start with a small dynamically-allocated array and then expand it */
-	size_t allocated = 0;
 	char buffer[PATH_MAX + 80];
 
 	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
@@ -132,8 +462,8 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		 * sanity check to make sure that we're storing
 		 * non-overlapping regions in ascending order
 		 */
-		if (cache.size > 0) {
-			entry = &cache.entry[cache.size - 1];
+		if (cache->size > 0) {
+			entry = &cache->entry[cache->size - 1];
 			if (entry->start_addr == start_addr &&
 			    entry->end_addr == end_addr) {
 				/* duplicate entry, e.g. [vsyscall] */
@@ -151,11 +481,7 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			}
 		}
 
-		if (cache.size >= allocated)
-			cache.entry = xgrowarray(cache.entry, &allocated,
-						 sizeof(*cache.entry));
-
-		entry = &cache.entry[cache.size];
+		entry = insert_entry(cache, cache->size);
 		entry->start_addr = start_addr;
 		entry->end_addr = end_addr;
 		entry->mmap_offset = mmap_offset;
@@ -169,44 +495,60 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		entry->major = major;
 		entry->minor = minor;
 		entry->binary_filename = xstrdup(binary_path);
-		cache.size++;
 	}
 	fclose(fp);
 
-	if (!cache.size)
-		return MMAP_CACHE_REBUILD_NOCACHE;
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, tgid=%d, size=%u, caller=%s",
+		       cache->generation, tcp, cache->entry, cache->tgid,
+		       cache->size, caller);
+}
 
-	tcp->mmap_cache = xobjdup(&cache);
+/*
+ * caching of /proc/ID/maps for each address space to speed up stack tracing
+ *
+ * The cache is updated after syscalls that affect memory mappings,
+ * e.g. mmap, mprotect, munmap, and is rebuilt after execve.
+ *
+ * Returns MMAP_CACHE_REBUILD_RENEWED if the cache has changed since
+ * the last call for this tcb.
+ */
+extern enum mmap_cache_rebuild_result
+mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+{
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
 
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache->generation, mmap_cache_generation,
-		       tcp, tcp->mmap_cache->entry, caller);
+	if (cache->stale)
+		rebuild_mmap_cache(tcp, cache, caller);
+
+	if (!cache->size)
+		return MMAP_CACHE_REBUILD_NOCACHE;
 
+	if (tcp->mmap_cache_generation == cache->generation)
+		return MMAP_CACHE_REBUILD_READY;
+
+	tcp->mmap_cache_generation = cache->generation;
 	return MMAP_CACHE_REBUILD_RENEWED;
 }
 
 struct mmap_cache_entry_t *
 mmap_cache_search(struct tcb *tcp, unsigned long ip)
 {
-	if (!tcp->mmap_cache)
+	struct mmap_cache_t *cache = tcp->mmap_cache;
+
+	if (!cache || !cache->size)
 		return NULL;
 
-	int lower = 0;
-	int upper = (int) tcp->mmap_cache->size - 1;
+	/* Consecutive lookups tend to hit the same mapping.  */
+	struct mmap_cache_entry_t *entry = &cache->entry[cache->last_hit];
+	if (ip >= entry->start_addr && ip < entry->end_addr)
+		return entry;
 
-	while (lower <= upper) {
-		int mid = (upper + lower) / 2;
-		struct mmap_cache_entry_t *entry = &tcp->mmap_cache->entry[mid];
+	unsigned int i = lower_bound(cache, ip);
+	if (i >= cache->size || ip < cache->entry[i].start_addr)
+		return NULL;
 
-		if (ip >= entry->start_addr &&
-		    ip < entry->end_addr)
-			return entry;
-		else if (ip < entry->start_addr)
-			upper = mid - 1;
-		else
-			lower = mid + 1;
-	}
-	return NULL;
+	cache->last_hit = i;
+	return &cache->entry[i];
 }
 
 struct mmap_cache_entry_t *
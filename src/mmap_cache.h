@@ -7,16 +7,31 @@
 #ifndef STRACE_MMAP_CACHE_H
 # define STRACE_MMAP_CACHE_H
 
+# include "list.h"
+
 /*
  * Keep a sorted array of cache entries,
  * so that we can binary search through it.
+ *
+ * The cache describes an address space, so it is shared by all threads
+ * of a thread group.  It is updated incrementally from the results
+ * of syscalls that change memory mappings, and is rebuilt from
+ * /proc/PID/maps only when such an update is not possible.
  */
 
 struct mmap_cache_t {
 	struct mmap_cache_entry_t *entry;
 	void (*free_fn)(struct tcb *, const char *caller);
 	unsigned int size;
+	size_t allocated;
+	/* Incremented on every change of the cache contents.  */
 	unsigned int generation;
+	unsigned int last_hit;
+	unsigned int refcount;
+	int tgid;
+	/* The cache has to be rebuilt from /proc/PID/maps.  */
+	bool stale;
+	struct list_item list;
 };
 
 struct mmap_cache_entry_t {
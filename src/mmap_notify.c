@@ -25,9 +25,9 @@ mmap_notify_register_client(mmap_notify_fn fn, void *data)
 }
 
 void
-mmap_notify_report(struct tcb *tcp)
+mmap_notify_report(struct tcb *tcp, bool has_result)
 {
 	for (struct mmap_notify_client *client = clients;
 	     client; client = client->next)
-		client->fn(tcp, client->data);
+		client->fn(tcp, has_result, client->data);
 }
@@ -9,12 +9,18 @@
 
 # include "defs.h"
 
-typedef void (*mmap_notify_fn)(struct tcb *, void *);
+/*
+ * Clients are notified on exiting a syscall that may have changed
+ * memory mappings of the tracee.  If the boolean argument is true,
+ * the syscall result has been fetched and tcp->u_rval/tcp->u_error
+ * are valid.
+ */
+typedef void (*mmap_notify_fn)(struct tcb *, bool, void *);
 
 extern void
 mmap_notify_register_client(mmap_notify_fn, void *);
 
 extern void
-mmap_notify_report (struct tcb *);
+mmap_notify_report(struct tcb *, bool has_result);
 
 #endif /* !STRACE_MMAP_NOTIFY_H */
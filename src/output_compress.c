@@ -0,0 +1,263 @@
+/*
+ * Compressed trace output.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * With --output-compress=gzip[:LEVEL], the files written with -o FILE
+ * (one per process with -ff) are gzip compressed by strace itself instead
+ * of a "|gzip" pipe.  The trace output stream is a fopencookie stream
+ * with a large buffer that feeds zlib, so the rest of strace keeps
+ * printing to a FILE.  These streams are not flushed after every line:
+ * the main loop calls output_compress_tick() before waiting for tracee
+ * events, and waits no longer than output_compress_timeout(), so the
+ * output is flushed and compressed data is synced with Z_SYNC_FLUSH
+ * at most once in OUTPUT_COMPRESS_SYNC_INTERVAL, even if the tracees
+ * go quiet.  Thus the file can be followed with "tail -f | zcat",
+ * and everything written before the last sync can be decompressed
+ * even if strace is killed.
+ */
+
+#include "defs.h"
+#include "list.h"
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#define OUTPUT_COMPRESS_BUF_SIZE	(256 * 1024)
+#define OUTPUT_COMPRESS_SYNC_INTERVAL	1000	/* milliseconds */
+
+bool output_compress;
+
+/* Whether lines have been printed since the last sync.  */
+static bool sync_pending;
+static struct timespec last_sync;
+
+#ifdef HAVE_ZLIB
+
+static int compress_level = Z_DEFAULT_COMPRESSION;
+
+struct compress_stream {
+	FILE *fp;
+	FILE *cfp;
+	z_stream zs;
+	/* Whether there is input that has not been synced.  */
+	bool dirty;
+	bool failed;
+	struct list_item list;
+	unsigned char out[OUTPUT_COMPRESS_BUF_SIZE];
+};
+
+static EMPTY_LIST(streams);
+
+/*
+ * Passes the input to zlib and writes out the compressed data,
+ * returns false on error.
+ */
+static bool
+compress_data(struct compress_stream *cs, const char *buf, size_t size,
+	      int flush)
+{
+	if (cs->failed)
+		return false;
+
+	cs->zs.next_in = (unsigned char *) buf;
+	cs->zs.avail_in = size;
+
+	do {
+		cs->zs.next_out = cs->out;
+		cs->zs.avail_out = sizeof(cs->out);
+
+		const int rc = deflate(&cs->zs, flush);
+
+		if (rc == Z_STREAM_ERROR) {
+			error_msg("deflate: %s", cs->zs.msg ? cs->zs.msg : "error");
+			cs->failed = true;
+			return false;
+		}
+
+		const size_t len = sizeof(cs->out) - cs->zs.avail_out;
+
+		if (len && fwrite(cs->out, 1, len, cs->fp) != len) {
+			cs->failed = true;
+			return false;
+		}
+	} while (!cs->zs.avail_out);
+
+	return true;
+}
+
+static ssize_t
+compress_write(void *cookie, const char *buf, size_t size)
+{
+	struct compress_stream *cs = cookie;
+
+	if (!compress_data(cs, buf, size, Z_NO_FLUSH))
+		return -1;
+	cs->dirty = true;
+
+	return size;
+}
+
+static void
+sync_stream(struct compress_stream *cs)
+{
+	/* Pass the buffered lines to zlib.  */
+	if (fflush(cs->cfp))
+		perror_msg("fflush");
+
+	if (!cs->dirty)
+		return;
+
+	cs->dirty = false;
+	if (!compress_data(cs, NULL, 0, Z_SYNC_FLUSH) || fflush(cs->fp))
+		perror_msg("write");
+}
+
+static int
+compress_close(void *cookie)
+{
+	struct compress_stream *cs = cookie;
+	bool ok = compress_data(cs, NULL, 0, Z_FINISH);
+
+	list_remove(&cs->list);
+	deflateEnd(&cs->zs);
+	if (fclose(cs->fp))
+		ok = false;
+	free(cs);
+
+	return ok ? 0 : EOF;
+}
+
+FILE *
+output_compress_open(FILE *fp)
+{
+	struct compress_stream *cs = xzalloc(sizeof(*cs));
+
+	/* 16 + MAX_WBITS selects the gzip format.  */
+	if (deflateInit2(&cs->zs, compress_level, Z_DEFLATED, 16 + MAX_WBITS,
+			 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		error_msg_and_die("deflateInit2 failed");
+
+	cs->fp = fp;
+
+	static const cookie_io_functions_t io_funcs = {
+		.write = compress_write,
+		.close = compress_close,
+	};
+
+	FILE *cfp = fopencookie(cs, "w", io_funcs);
+	if (!cfp)
+		perror_msg_and_die("fopencookie");
+	setvbuf(cfp, NULL, _IOFBF, OUTPUT_COMPRESS_BUF_SIZE);
+	cs->cfp = cfp;
+	list_insert(&streams, &cs->list);
+
+	return cfp;
+}
+
+static void
+sync_streams(void)
+{
+	struct compress_stream *cs;
+
+	list_foreach(cs, &streams, list)
+		sync_stream(cs);
+}
+
+#else /* !HAVE_ZLIB */
+
+FILE *
+output_compress_open(FILE *fp)
+{
+	return fp;
+}
+
+static void
+sync_streams(void)
+{
+}
+
+#endif /* HAVE_ZLIB */
+
+/*
+ * Called instead of fflush after a line has been printed, the line is
+ * synced by output_compress_tick() within OUTPUT_COMPRESS_SYNC_INTERVAL.
+ */
+void
+output_compress_flush_later(void)
+{
+	sync_pending = true;
+}
+
+/* Returns the number of milliseconds until the next sync is due.  */
+static int64_t
+time_to_sync(const struct timespec *now)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, now, &last_sync);
+	return OUTPUT_COMPRESS_SYNC_INTERVAL
+	       - ((int64_t) dt.tv_sec * 1000 + dt.tv_nsec / 1000000);
+}
+
+void
+output_compress_tick(void)
+{
+	if (!sync_pending)
+		return;
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (time_to_sync(&now) > 0)
+		return;
+
+	sync_streams();
+	sync_pending = false;
+	last_sync = now;
+}
+
+int
+output_compress_timeout(void)
+{
+	if (!sync_pending)
+		return -1;
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return MAX(time_to_sync(&now), 0);
+}
+
+void
+output_compress_init(const char *arg)
+{
+	const char *level = STR_STRIP_PREFIX(arg, "gzip");
+
+	if (level == arg) {
+		if (!strncmp(arg, "zstd", 4))
+			error_msg_and_die("zstd compression is not supported,"
+					  " use --output-compress=gzip");
+		error_msg_and_help("invalid --output-compress argument: '%s'",
+				   arg);
+	}
+
+#ifdef HAVE_ZLIB
+	if (*level) {
+		if (*level != ':'
+		    || (compress_level = string_to_uint_upto(level + 1, 9)) < 0)
+			error_msg_and_help("invalid --output-compress level:"
+					   " '%s'", level);
+	}
+#else
+	error_msg_and_die("--output-compress: strace is built without zlib");
+#endif
+
+	output_compress = true;
+}
@@ -72,13 +72,15 @@ fdmatch(struct tcb *tcp, int fd, struct path_set *set, struct number_set *fdset)
 
 /*
  * Add a path to the set we're tracing.
- * Specifying NULL will delete all paths.
+ * The set takes ownership of the malloc'ed path.
  */
 static void
-storepath(const char *path, struct path_set *set)
+storepath(char *path, struct path_set *set)
 {
-	if (pathmatch(path, set))
+	if (pathmatch(path, set)) {
+		free(path);
 		return; /* already in table */
+	}
 
 	if (set->num_selected >= set->size)
 		set->paths_selected =
@@ -164,15 +166,15 @@ getfdpath_pid(pid_t pid, int fd, char *buf, unsigned bufsize, bool *deleted)
 }
 
 /*
- * Add a path to the set we're tracing.  Also add the canonicalized
- * version of the path.  Specifying NULL will delete all paths.
+ * Add a copy of the path to the set we're tracing.  Also add
+ * the canonicalized version of the path.
  */
 void
 pathtrace_select_set(const char *path, struct path_set *set)
 {
 	char *rpath;
 
-	storepath(path, set);
+	storepath(xstrdup(path), set);
 
 	rpath = realpath(path, NULL);
 
@@ -203,6 +205,15 @@ pathtrace_select_set(const char *path, struct path_set *set)
 	storepath(rpath, set);
 }
 
+/* Delete all paths from the set.  */
+void
+pathtrace_clear_set(struct path_set *set)
+{
+	for (size_t i = 0; i < set->num_selected; ++i)
+		free((void *) set->paths_selected[i].path);
+	set->num_selected = 0;
+}
+
 static bool
 match_xselect_args(struct tcb *tcp, const kernel_ulong_t *args,
 		   struct path_set *set, struct number_set *fdset)
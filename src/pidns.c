@@ -43,6 +43,7 @@ static struct trie *ns_pid_to_proc_pid[PT_COUNT];
 static struct trie *proc_data_cache;
 
 static bool ns_get_parent_enotty = false;
+static bool ns_get_pid_from_pidns_enotty = false;
 
 static const char tid_str[]  = "NSpid:\t";
 static const char tgid_str[] = "NStgid:\t";
@@ -311,6 +312,51 @@ fail:
 	return false;
 }
 
+/**
+ * Adds all (NS, ID) pairs of the process to the ns_pid_to_proc_pid index,
+ * so that later lookups of the process from other namespaces
+ * do not need to scan /proc.
+ */
+static void
+index_proc_data(struct proc_data *pd, enum pid_type type)
+{
+	const int id_count = pd->id_count[type];
+
+	if (!pd->ns_count || id_count < pd->ns_count)
+		return;
+
+	for (int i = 0; i < pd->ns_count; i++)
+		put_proc_pid(pd->ns_hierarchy[i],
+			     pd->id_hierarchy[type][id_count - i - 1],
+			     type, pd->proc_pid);
+}
+
+/**
+ * Removes the proc_data and the index entries pointing to it.
+ */
+static void
+forget_proc_data(struct proc_data *pd)
+{
+	for (int type = 0; type < PT_COUNT; type++) {
+		const int id_count = pd->id_count[type];
+
+		if (!pd->ns_count || id_count < pd->ns_count)
+			continue;
+
+		for (int i = 0; i < pd->ns_count; i++) {
+			unsigned int ns = pd->ns_hierarchy[i];
+			int ns_id = pd->id_hierarchy[type][id_count - i - 1];
+
+			if (get_cached_proc_pid(ns, ns_id, type)
+			    == pd->proc_pid)
+				put_proc_pid(ns, ns_id, type, 0);
+		}
+	}
+
+	trie_set(proc_data_cache, pd->proc_pid, (uint64_t) (uintptr_t) NULL);
+	free(pd);
+}
+
 /**
  * Parameters for id translation
  */
@@ -412,7 +458,11 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		if (proc_pid < 1 || proc_pid > INT_MAX || errno)
 			continue;
 
-		if (read_task_dir) {
+		/*
+		 * Process-wide ids are the same in all threads,
+		 * there is no need to read task directories for them.
+		 */
+		if (read_task_dir && tip->type == PT_TID) {
 			char task_dir_path[PATH_MAX + 1];
 			xsprintf(task_dir_path, "/proc/%ld/task", proc_pid);
 			translate_id_dir(tip, task_dir_path, false);
@@ -421,7 +471,24 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		if (tip->result_id)
 			break;
 
+		/*
+		 * Cached entries with the ids of the requested type
+		 * have already been checked by proc_data_cache_iterator_fn.
+		 */
+		struct proc_data *pd = (struct proc_data *) (uintptr_t)
+			trie_get(proc_data_cache, proc_pid);
+		if (pd && pd->ns_count &&
+		    pd->id_count[tip->type] >= pd->ns_count)
+			continue;
+
 		translate_id_proc_pid(tip, proc_pid);
+		if (tip->result_id)
+			break;
+
+		pd = (struct proc_data *) (uintptr_t)
+			trie_get(proc_data_cache, proc_pid);
+		if (pd)
+			index_proc_data(pd, tip->type);
 	}
 
 	closedir(dir);
@@ -455,6 +522,74 @@ proc_data_cache_iterator_fn(void* fn_data, uint64_t key, uint64_t val)
 	translate_id_proc_pid(tip, pd->proc_pid);
 }
 
+/**
+ * Translates a TID or a TGID to our namespace using NS_GET_PID_FROM_PIDNS
+ * and NS_GET_TGID_FROM_PIDNS ioctl commands, without reading /proc.
+ *
+ * @param tcp  The tracee whose PID namespace the id belongs to.
+ * @param ns   The PID namespace of the tracee.
+ * @return     The translated id, 0 if translation is not possible.
+ */
+static int
+translate_id_ioctl(struct tcb *tcp, unsigned int ns, int from_id,
+		   enum pid_type type)
+{
+	static int ns_fd = -1;
+	static unsigned int ns_fd_ns;
+
+	if (ns_get_pid_from_pidns_enotty ||
+	    (type != PT_TID && type != PT_TGID) || !is_proc_ours())
+		return 0;
+
+	if (ns_fd < 0 || ns_fd_ns != ns) {
+		char path[PATH_MAX + 1];
+		strace_stat_t st;
+
+		if (ns_fd >= 0)
+			close(ns_fd);
+		ns_fd = -1;
+
+		xsprintf(path, "/proc/%s/ns/pid", pid_to_str(tcp->pid));
+		int fd = open_file(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return 0;
+
+		if (fstat_fd(fd, &st) || st.st_ino != ns) {
+			close(fd);
+			return 0;
+		}
+
+		ns_fd = fd;
+		ns_fd_ns = ns;
+	}
+
+	int id = ioctl(ns_fd, type == PT_TID ? NS_GET_PID_FROM_PIDNS
+					     : NS_GET_TGID_FROM_PIDNS,
+		       (unsigned long) from_id);
+	if (id > 0)
+		return id;
+
+	if (errno == ENOTTY || errno == EINVAL) {
+		ns_get_pid_from_pidns_enotty = true;
+		debug_func_msg("NS_GET_PID_FROM_PIDNS ioctl command "
+			       "is not supported");
+	}
+
+	return 0;
+}
+
+void
+pidns_forget_tcb(struct tcb *tcp)
+{
+	if (!proc_data_cache || !is_proc_ours())
+		return;
+
+	struct proc_data *pd = (struct proc_data *) (uintptr_t)
+		trie_get(proc_data_cache, tcp->pid);
+	if (pd)
+		forget_proc_data(pd);
+}
+
 int
 translate_pid(struct tcb *tcp, int from_id, enum pid_type type,
               int *proc_pid_ptr)
@@ -494,6 +629,21 @@ translate_pid(struct tcb *tcp, int from_id, enum pid_type type,
 			goto exit;
 	}
 
+	/*
+	 * Ask the kernel directly, if it knows how to, on a cache miss.
+	 * The ioctl is only used when /proc is ours, so the id it returns
+	 * is also the proc_pid to be cached.
+	 */
+	if (tcp) {
+		int id = translate_id_ioctl(tcp, tip.from_ns, from_id, type);
+		if (id) {
+			put_proc_pid(tip.from_ns, from_id, type, id);
+			if (proc_pid_ptr)
+				*proc_pid_ptr = id;
+			return id;
+		}
+	}
+
 	/* Iterate through the cache, find potential proc_data */
 	trie_iterate_keys(proc_data_cache, 0, pid_max - 1,
 		proc_data_cache_iterator_fn, &tip);
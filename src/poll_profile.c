@@ -0,0 +1,585 @@
+/*
+ * Event loop readiness profiler.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * For each of the epoll, poll, and select families of syscalls,
+ * the profiler accounts the number of wakeups, the number of ready events
+ * and its log2 histogram, the number of wakeups without any events,
+ * the time spent waiting, and the log2 histogram of the requested timeouts.
+ * The readiness of individual file descriptors is counted in a table
+ * of a fixed size using the space-saving algorithm: when the table is full,
+ * a new descriptor replaces the least frequent one and inherits its count,
+ * so the counts of the most frequent descriptors are estimated with
+ * an error bounded by the count they have inherited.
+ */
+
+#include "defs.h"
+#include <poll.h>
+#include <linux/eventpoll.h>
+#include "kernel_timespec.h"
+#include "kernel_timeval.h"
+#include "largefile_wrappers.h"
+#include "sen.h"
+#include "xstring.h"
+
+#define POLL_PROFILE_HIST_SIZE	24	/* log2 buckets */
+#define POLL_PROFILE_FDS	256	/* Readiness table entries */
+#define POLL_PROFILE_TOP	16	/* Descriptors printed in the report */
+#define POLL_PROFILE_CHUNK	64	/* Elements fetched at once */
+#define POLL_PROFILE_DESC_SIZE	96
+
+bool poll_profile;
+
+enum poll_family {
+	POLL_FAMILY_NONE = -1,
+	POLL_FAMILY_EPOLL,
+	POLL_FAMILY_POLL,
+	POLL_FAMILY_SELECT,
+	POLL_FAMILY_COUNT
+};
+
+static const char *const poll_family_names[] = {
+	[POLL_FAMILY_EPOLL] = "epoll",
+	[POLL_FAMILY_POLL] = "poll",
+	[POLL_FAMILY_SELECT] = "select",
+};
+
+struct poll_family_stats {
+	uint64_t wakeups;
+	uint64_t empty;		/* Wakeups without events, timeouts */
+	uint64_t errors;
+	uint64_t events;
+	uint64_t events_max;
+	uint64_t events_hist[POLL_PROFILE_HIST_SIZE];
+	uint64_t timeout_infinite;
+	uint64_t timeout_hist[POLL_PROFILE_HIST_SIZE];	/* milliseconds */
+	struct timespec waited;
+	struct timespec first;
+	struct timespec last;
+};
+
+static struct poll_family_stats families[POLL_FAMILY_COUNT];
+
+/*
+ * Ready file descriptors, keyed by tgid, epoll descriptor (-1 for poll
+ * and select), and the descriptor or, for epoll, the user data.
+ */
+struct poll_fd_stats {
+	int tgid;
+	int epfd;
+	uint64_t data;
+	int fd;			/* -1 if the epoll user data is unresolved */
+	enum poll_family family;
+	uint64_t count;
+	uint64_t error;		/* Count inherited from the evicted entry */
+	char desc[POLL_PROFILE_DESC_SIZE];
+};
+
+static struct poll_fd_stats fds[POLL_PROFILE_FDS];
+static unsigned int fds_count;
+
+/* The wait data saved on entering, see poll_profile_entering.  */
+struct poll_wait_data {
+	struct timespec start;
+	int64_t timeout_ms;	/* -1 if infinite */
+};
+
+static enum poll_family
+get_poll_family(const struct tcb *tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_epoll_wait:
+	case SEN_epoll_pwait:
+	case SEN_epoll_pwait2:
+		return POLL_FAMILY_EPOLL;
+	case SEN_poll_time32:
+	case SEN_poll_time64:
+	case SEN_ppoll_time32:
+	case SEN_ppoll_time64:
+		return POLL_FAMILY_POLL;
+	case SEN_select:
+#if HAVE_ARCH_OLD_SELECT
+	case SEN_oldselect:
+#endif
+	case SEN_pselect6_time32:
+	case SEN_pselect6_time64:
+		return POLL_FAMILY_SELECT;
+	default:
+		return POLL_FAMILY_NONE;
+	}
+}
+
+/* Returns the arguments of a select family syscall.  */
+static const kernel_ulong_t *
+get_select_args(struct tcb *tcp)
+{
+#if HAVE_ARCH_OLD_SELECT
+	if (tcp_sysent(tcp)->sen == SEN_oldselect)
+		return fetch_indirect_syscall_args(tcp, tcp->u_arg[0], 5);
+#endif
+	return tcp->u_arg;
+}
+
+static int64_t
+ms_ceil(int64_t sec, int64_t nsec)
+{
+	if (sec < 0 || nsec < 0)
+		return 0;
+	return sec * 1000 + (nsec + 999999) / 1000000;
+}
+
+static int64_t
+fetch_timespec64_ms(struct tcb *tcp, kernel_ulong_t addr)
+{
+	kernel_timespec64_t ts;
+
+	if (!addr || umove(tcp, addr, &ts))
+		return -1;
+	return ms_ceil(ts.tv_sec, ts.tv_nsec);
+}
+
+static int64_t
+fetch_timespec32_ms(struct tcb *tcp, kernel_ulong_t addr)
+{
+#if HAVE_ARCH_TIME32_SYSCALLS || HAVE_ARCH_TIMESPEC32
+	kernel_timespec32_t ts;
+
+	if (!addr || umove(tcp, addr, &ts))
+		return -1;
+	return ms_ceil(ts.tv_sec, ts.tv_nsec);
+#else
+	return -1;
+#endif
+}
+
+static int64_t
+fetch_timeval_ms(struct tcb *tcp, kernel_ulong_t addr)
+{
+	if (!addr)
+		return -1;
+
+	if (current_klongsize < sizeof(kernel_long_t)) {
+		struct {
+			int32_t tv_sec;
+			int32_t tv_usec;
+		} tv;
+
+		if (umove(tcp, addr, &tv))
+			return -1;
+		return ms_ceil(tv.tv_sec, tv.tv_usec * 1000LL);
+	}
+
+	kernel_old_timeval_t tv;
+
+	if (umove(tcp, addr, &tv))
+		return -1;
+	return ms_ceil(tv.tv_sec, tv.tv_usec * 1000LL);
+}
+
+/* Returns the requested timeout in milliseconds, or -1 if infinite.  */
+static int64_t
+get_timeout_ms(struct tcb *tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_epoll_wait:
+	case SEN_epoll_pwait:
+		return MAX((int) tcp->u_arg[3], -1);
+	case SEN_epoll_pwait2:
+		return fetch_timespec64_ms(tcp, tcp->u_arg[3]);
+	case SEN_poll_time32:
+	case SEN_poll_time64:
+		return MAX((int) tcp->u_arg[2], -1);
+	case SEN_ppoll_time32:
+		return fetch_timespec32_ms(tcp, tcp->u_arg[2]);
+	case SEN_ppoll_time64:
+		return fetch_timespec64_ms(tcp, tcp->u_arg[2]);
+	case SEN_pselect6_time32:
+		return fetch_timespec32_ms(tcp, tcp->u_arg[4]);
+	case SEN_pselect6_time64:
+		return fetch_timespec64_ms(tcp, tcp->u_arg[4]);
+	default: {
+		const kernel_ulong_t *args = get_select_args(tcp);
+
+		return args ? fetch_timeval_ms(tcp, args[4]) : -1;
+	}
+	}
+}
+
+static unsigned int
+hist_bucket(uint64_t val)
+{
+	unsigned int b = 0;
+
+	while (val && b < POLL_PROFILE_HIST_SIZE - 1) {
+		val >>= 1;
+		++b;
+	}
+
+	return b;
+}
+
+/*
+ * Finds the epoll registered file descriptor with the given user data
+ * in /proc/$pid/fdinfo/$epfd.
+ */
+static int
+resolve_epoll_data(struct tcb *tcp, int epfd, uint64_t data)
+{
+	static const char fdinfo_path[] = "/proc/%d/fdinfo/%d";
+	char path[sizeof(fdinfo_path) + sizeof(int) * 3 * 2];
+	char line[128];
+	int fd = -1;
+
+	xsprintf(path, fdinfo_path, tcp->pid, epfd);
+	FILE *fp = fopen_stream(path, "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		int tfd;
+		unsigned int events;
+		unsigned long long tdata;
+
+		if (sscanf(line, "tfd: %d events: %x data: %llx",
+			   &tfd, &events, &tdata) == 3 && tdata == data) {
+			fd = tfd;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return fd;
+}
+
+static void
+count_ready_fd(struct tcb *tcp, enum poll_family family, int epfd,
+	       uint64_t data)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct poll_fd_stats *min = NULL;
+
+	for (unsigned int i = 0; i < fds_count; ++i) {
+		struct poll_fd_stats *e = &fds[i];
+
+		if (e->tgid == tgid && e->epfd == epfd && e->data == data
+		    && e->family == family) {
+			e->count++;
+			return;
+		}
+		if (!min || e->count < min->count)
+			min = e;
+	}
+
+	struct poll_fd_stats *e;
+	uint64_t error = 0;
+
+	if (fds_count < POLL_PROFILE_FDS) {
+		e = &fds[fds_count++];
+	} else {
+		e = min;
+		error = min->count;
+	}
+
+	*e = (struct poll_fd_stats) {
+		.tgid = tgid,
+		.epfd = epfd,
+		.data = data,
+		.fd = epfd < 0 ? (int) data : resolve_epoll_data(tcp, epfd,
+								   data),
+		.family = family,
+		.count = error + 1,
+		.error = error,
+	};
+
+	char *desc = e->fd >= 0 ? getfd_description(tcp, e->fd) : NULL;
+	if (desc) {
+		xsprintf(e->desc, "%.*s", (int) sizeof(e->desc) - 1, desc);
+		free(desc);
+	}
+}
+
+static void
+count_epoll_events(struct tcb *tcp, unsigned int n)
+{
+	struct epoll_event ev[POLL_PROFILE_CHUNK];
+	const int epfd = tcp->u_arg[0];
+
+	for (unsigned int i = 0; i < n; i += POLL_PROFILE_CHUNK) {
+		const unsigned int nr = MIN(n - i, POLL_PROFILE_CHUNK);
+
+		if (umoven(tcp, tcp->u_arg[1] + i * sizeof(ev[0]),
+			   nr * sizeof(ev[0]), ev))
+			return;
+		for (unsigned int j = 0; j < nr; ++j)
+			count_ready_fd(tcp, POLL_FAMILY_EPOLL, epfd,
+				       ev[j].data);
+	}
+}
+
+static void
+count_poll_events(struct tcb *tcp, unsigned int n)
+{
+	struct pollfd pfd[POLL_PROFILE_CHUNK];
+	const unsigned int nfds = MIN(tcp->u_arg[1], 1024 * 1024);
+
+	for (unsigned int i = 0; i < nfds && n; i += POLL_PROFILE_CHUNK) {
+		const unsigned int nr = MIN(nfds - i, POLL_PROFILE_CHUNK);
+
+		if (umoven(tcp, tcp->u_arg[0] + i * sizeof(pfd[0]),
+			   nr * sizeof(pfd[0]), pfd))
+			return;
+		for (unsigned int j = 0; j < nr && n; ++j) {
+			if (pfd[j].fd < 0 || !pfd[j].revents)
+				continue;
+			count_ready_fd(tcp, POLL_FAMILY_POLL, -1, pfd[j].fd);
+			--n;
+		}
+	}
+}
+
+static void
+count_select_events(struct tcb *tcp)
+{
+	const kernel_ulong_t *args = get_select_args(tcp);
+	if (!args)
+		return;
+
+	/* The same limits as in decode_select.  */
+	const int nfds = MIN(MAX((int) args[0], 0), 1024 * 1024);
+	const unsigned int fdsize =
+		(((nfds + 7) / 8) + current_wordsize - 1) & -current_wordsize;
+	if (!fdsize)
+		return;
+
+	/* The kernel stores the ready descriptors in place.  */
+	kernel_ulong_t addr[3] = { args[1], args[2], args[3] };
+	void *ready = xzalloc(fdsize);
+	void *set = xmalloc(fdsize);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(addr); ++i) {
+		if (!addr[i] || umoven(tcp, addr[i], fdsize, set))
+			continue;
+		for (unsigned int j = 0; j < fdsize; ++j)
+			((unsigned char *) ready)[j] |=
+				((unsigned char *) set)[j];
+	}
+
+	for (int fd = 0;; ++fd) {
+		fd = next_set_bit(ready, fd, nfds);
+		if (fd < 0)
+			break;
+		count_ready_fd(tcp, POLL_FAMILY_SELECT, -1, fd);
+	}
+
+	free(set);
+	free(ready);
+}
+
+void
+poll_profile_entering(struct tcb *tcp)
+{
+	if (get_poll_family(tcp) == POLL_FAMILY_NONE)
+		return;
+
+	struct poll_wait_data *d = xmalloc(sizeof(*d));
+
+	d->timeout_ms = get_timeout_ms(tcp);
+	clock_gettime(CLOCK_MONOTONIC, &d->start);
+	if (set_tcb_priv_data(tcp, d, free))
+		free(d);
+}
+
+void
+poll_profile_exiting(struct tcb *tcp)
+{
+	const enum poll_family family = get_poll_family(tcp);
+	if (family == POLL_FAMILY_NONE)
+		return;
+
+	const struct poll_wait_data *d = get_tcb_priv_data(tcp);
+	if (!d)
+		return;
+
+	struct poll_family_stats *f = &families[family];
+	struct timespec now, dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &d->start);
+	ts_add(&f->waited, &f->waited, &dt);
+	if (!ts_nz(&f->first))
+		f->first = d->start;
+	f->last = now;
+
+	if (d->timeout_ms < 0)
+		f->timeout_infinite++;
+	else
+		f->timeout_hist[hist_bucket(d->timeout_ms)]++;
+
+	if (syserror(tcp)) {
+		f->errors++;
+		return;
+	}
+
+	const uint64_t events = tcp->u_rval;
+
+	f->wakeups++;
+	f->events += events;
+	f->events_max = MAX(f->events_max, events);
+	f->events_hist[hist_bucket(events)]++;
+	if (!events) {
+		f->empty++;
+		return;
+	}
+
+	switch (family) {
+	case POLL_FAMILY_EPOLL:
+		count_epoll_events(tcp, MIN(events, (unsigned int) INT_MAX));
+		break;
+	case POLL_FAMILY_POLL:
+		count_poll_events(tcp, MIN(events, (unsigned int) INT_MAX));
+		break;
+	case POLL_FAMILY_SELECT:
+		count_select_events(tcp);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+print_poll_hist(FILE *outf, const char *title, const uint64_t *hist)
+{
+	unsigned int lo = 0, hi = 0;
+	uint64_t max = 0;
+
+	for (unsigned int i = 0; i < POLL_PROFILE_HIST_SIZE; ++i) {
+		if (!hist[i])
+			continue;
+		if (!max)
+			lo = i;
+		hi = i;
+		max = MAX(max, hist[i]);
+	}
+
+	if (!max)
+		return;
+
+	fprintf(outf, "%16s : count\n", title);
+	for (unsigned int i = lo; i <= hi; ++i) {
+		const uint64_t from = i ? 1ULL << (i - 1) : 0;
+		const uint64_t to = (1ULL << i) - 1;
+		const unsigned int stars = hist[i] * 40 / max;
+
+		fprintf(outf, "%7" PRIu64 " -> %-7" PRIu64 " : %-9" PRIu64 " |",
+			from, to, hist[i]);
+		for (unsigned int j = 0; j < 40; ++j)
+			fputc(j < stars ? '*' : ' ', outf);
+		fputs("|\n", outf);
+	}
+}
+
+static int
+fd_cmp(const void *a, const void *b)
+{
+	const struct poll_fd_stats *fa = a;
+	const struct poll_fd_stats *fb = b;
+
+	if (fa->count != fb->count)
+		return fa->count < fb->count ? 1 : -1;
+	if (fa->tgid != fb->tgid)
+		return fa->tgid < fb->tgid ? -1 : 1;
+	if (fa->family != fb->family)
+		return fa->family < fb->family ? -1 : 1;
+	return fa->data < fb->data ? -1 : fa->data > fb->data;
+}
+
+void
+poll_profile_summary(FILE *outf)
+{
+	bool any = false;
+
+	for (unsigned int i = 0; i < POLL_FAMILY_COUNT; ++i) {
+		const struct poll_family_stats *f = &families[i];
+
+		if (!f->wakeups && !f->errors)
+			continue;
+
+		if (!any) {
+			fputs("Event loop readiness summary:\n"
+			      "family     wakeups wakeups/s     empty"
+			      "    errors    events avg-events max-events"
+			      "  waited-secs\n"
+			      "------ ----------- --------- ---------"
+			      " --------- --------- ---------- ----------"
+			      " ------------\n", outf);
+			any = true;
+		}
+
+		struct timespec span;
+		ts_sub(&span, &f->last, &f->first);
+		const double secs = ts_float(&span);
+
+		fprintf(outf, "%-6s %11" PRIu64 " %9.1f %9" PRIu64
+			" %9" PRIu64 " %9" PRIu64 " %10.2f %10" PRIu64
+			" %12.6f\n",
+			poll_family_names[i], f->wakeups,
+			secs > 0 ? f->wakeups / secs : 0.0,
+			f->empty, f->errors, f->events,
+			f->wakeups ? (double) f->events / f->wakeups : 0.0,
+			f->events_max, ts_float(&f->waited));
+	}
+
+	if (!any)
+		return;
+
+	for (unsigned int i = 0; i < POLL_FAMILY_COUNT; ++i) {
+		const struct poll_family_stats *f = &families[i];
+
+		if (!f->wakeups && !f->errors)
+			continue;
+
+		fprintf(outf, "\n%s:\n", poll_family_names[i]);
+		print_poll_hist(outf, "events", f->events_hist);
+		print_poll_hist(outf, "timeout msecs", f->timeout_hist);
+		if (f->timeout_infinite)
+			fprintf(outf, "%16s : %-9" PRIu64 "\n", "infinite",
+				f->timeout_infinite);
+	}
+
+	if (!fds_count)
+		return;
+
+	qsort(fds, fds_count, sizeof(fds[0]), fd_cmp);
+
+	fputs("\nMost frequently ready file descriptors:\n"
+	      "    ready      pid family       fd description\n"
+	      "--------- -------- ------ -------- -----------\n", outf);
+	for (unsigned int i = 0; i < MIN(fds_count, POLL_PROFILE_TOP); ++i) {
+		const struct poll_fd_stats *e = &fds[i];
+
+		fprintf(outf, "%c%8" PRIu64 " %8d %-6s ",
+			e->error ? '~' : ' ', e->count, e->tgid,
+			poll_family_names[e->family]);
+		if (e->fd >= 0)
+			fprintf(outf, "%8d", e->fd);
+		else
+			fprintf(outf, "%#8" PRIx64, e->data);
+		if (e->epfd >= 0)
+			fprintf(outf, " epfd %d", e->epfd);
+		if (e->desc[0])
+			fprintf(outf, " %s", e->desc);
+		fputc('\n', outf);
+	}
+}
+
+void
+poll_profile_init(void)
+{
+	poll_profile = true;
+}
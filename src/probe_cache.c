@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Some kernel capability probes fork and trace helper processes,
+ * which is a noticeable part of the startup time of short-lived
+ * strace invocations.  Their results depend on the running kernel
+ * and on the restrictions strace is running under, so they are cached
+ * in a file keyed by strace version, kernel release and build,
+ * boot id, and seccomp mode of strace.
+ */
+
+#include "defs.h"
+#include "probe_cache.h"
+#include "xstring.h"
+
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+struct probe_cache_entry {
+	char name[32];
+	int value;
+};
+
+static char *cache_path;
+static char *cache_key;
+static bool cache_loaded;
+static struct probe_cache_entry *entries;
+static size_t entries_count;
+static size_t entries_size;
+
+static char *
+default_cache_path(void)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	char *path;
+
+	if (dir && *dir == '/') {
+		if (asprintf(&path, "%s/strace/probes", dir) < 0)
+			return NULL;
+	} else {
+		const char *home = getenv("HOME");
+		if (!home || *home != '/')
+			return NULL;
+		if (asprintf(&path, "%s/.cache/strace/probes", home) < 0)
+			return NULL;
+	}
+
+	return path;
+}
+
+void
+probe_cache_enable(const char *path)
+{
+	free(cache_path);
+	cache_path = path ? xstrdup(path) : default_cache_path();
+	if (!cache_path)
+		debug_msg("probe cache: no cache location");
+}
+
+/* Reads the first line of the file into buf, stripping the newline.  */
+static bool
+read_line(const char *name, char *buf, size_t size)
+{
+	FILE *fp = fopen(name, "r");
+	if (!fp)
+		return false;
+
+	bool ok = fgets(buf, size, fp) != NULL;
+	fclose(fp);
+	if (ok)
+		buf[strcspn(buf, "\n")] = '\0';
+
+	return ok;
+}
+
+static unsigned int
+get_seccomp_mode(void)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1U;
+
+	char buf[256];
+	unsigned int mode = -1U;
+	unsigned int filters = 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (sscanf(buf, "Seccomp: %u", &mode) == 1)
+			continue;
+		if (sscanf(buf, "Seccomp_filters: %u", &filters) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return mode == -1U ? mode : mode << 16 | filters;
+}
+
+/*
+ * Returns the key the cached results are valid for,
+ * or NULL if there is no reliable key.
+ */
+static char *
+make_cache_key(void)
+{
+	struct utsname u;
+	char boot_id[64];
+
+	if (uname(&u) < 0 ||
+	    !read_line("/proc/sys/kernel/random/boot_id",
+		       boot_id, sizeof(boot_id)) || !*boot_id)
+		return NULL;
+
+	const unsigned int seccomp_mode = get_seccomp_mode();
+	if (seccomp_mode == -1U)
+		return NULL;
+
+	char *key;
+	if (asprintf(&key, "%s/%zu %s %s %s %#x", PACKAGE_VERSION,
+		     sizeof(kernel_ulong_t) * 8, u.release, u.version,
+		     boot_id, seccomp_mode) < 0)
+		return NULL;
+
+	return key;
+}
+
+static void
+add_entry(const char *name, const int value)
+{
+	if (entries_count >= entries_size)
+		entries = xgrowarray(entries, &entries_size, sizeof(*entries));
+
+	struct probe_cache_entry *e = &entries[entries_count++];
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->name[sizeof(e->name) - 1] = '\0';
+	e->value = value;
+}
+
+static void
+load_cache(void)
+{
+	cache_loaded = true;
+
+	/* Cached results are not to be trusted by a set-user-ID strace.  */
+	if (getuid() != geteuid())
+		return;
+
+	cache_key = make_cache_key();
+	if (!cache_key) {
+		debug_msg("probe cache: cannot identify the running kernel");
+		return;
+	}
+
+	FILE *fp = fopen(cache_path, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			debug_perror_msg("probe cache: %s", cache_path);
+		return;
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len = getline(&line, &size, fp);
+
+	if (len > 0 && line[len - 1] == '\n')
+		line[--len] = '\0';
+	if (len < 0 || strcmp(line, cache_key)) {
+		debug_msg("probe cache: %s is stale", cache_path);
+	} else {
+		char name[sizeof(entries->name)];
+		int value;
+
+		while (getline(&line, &size, fp) > 0) {
+			if (sscanf(line, "%31s %d", name, &value) == 2)
+				add_entry(name, value);
+		}
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+static void
+mkdir_parents(const char *path)
+{
+	char *dir = xstrdup(path);
+
+	for (char *p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(dir, 0700) && errno != EEXIST) {
+			debug_perror_msg("probe cache: mkdir: %s", dir);
+			break;
+		}
+		*p = '/';
+	}
+
+	free(dir);
+}
+
+static void
+save_cache(void)
+{
+	char *tmp;
+
+	mkdir_parents(cache_path);
+	if (asprintf(&tmp, "%s.XXXXXX", cache_path) < 0)
+		return;
+
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		debug_perror_msg("probe cache: mkstemp: %s", tmp);
+		free(tmp);
+		return;
+	}
+
+	FILE *fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto fail;
+	}
+
+	fprintf(fp, "%s\n", cache_key);
+	for (size_t i = 0; i < entries_count; ++i)
+		fprintf(fp, "%s %d\n", entries[i].name, entries[i].value);
+
+	if (fclose(fp) || rename(tmp, cache_path)) {
+		debug_perror_msg("probe cache: %s", cache_path);
+		goto fail;
+	}
+
+	free(tmp);
+	return;
+
+fail:
+	unlink(tmp);
+	free(tmp);
+}
+
+static bool
+lookup_entry(const char *name, int *value)
+{
+	for (size_t i = 0; i < entries_count; ++i) {
+		if (!strcmp(entries[i].name, name)) {
+			*value = entries[i].value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int
+probe_cache_run(const char *name, int (*probe)(void))
+{
+	struct timespec start, end;
+	bool cached = false;
+	int value;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (cache_path && !cache_loaded)
+		load_cache();
+
+	if (cache_key && lookup_entry(name, &value)) {
+		cached = true;
+	} else {
+		value = probe();
+		if (cache_key) {
+			add_entry(name, value);
+			save_cache();
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ts_sub(&end, &end, &start);
+	debug_msg("probe %s: %d%s in %.6f seconds", name, value,
+		  cached ? " (cached)" : "", ts_float(&end));
+
+	return value;
+}
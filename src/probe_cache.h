@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_PROBE_CACHE_H
+# define STRACE_PROBE_CACHE_H
+
+/*
+ * Enables caching of probe results in the file specified by path,
+ * or in the default location if path is NULL.
+ */
+extern void probe_cache_enable(const char *path);
+
+/*
+ * Returns the cached result of the probe specified by name,
+ * invoking the probe and caching its result if there is none.
+ */
+extern int probe_cache_run(const char *name, int (*probe)(void));
+
+#endif /* !STRACE_PROBE_CACHE_H */
@@ -0,0 +1,585 @@
+/*
+ * Process lifecycle summary.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The summary keeps a record for every traced process (but not thread):
+ * its parent, the time it has been spawned at, the time spent between
+ * the spawn and the first successful exec* syscall, the time spent
+ * in successful exec* syscalls, its lifetime, exit status, and the CPU
+ * time reported by wait4 when the process has terminated.  On exit,
+ * the records are printed as a tree along with the slowest subtrees,
+ * either as text, as JSON, or in the folded stack format with the CPU
+ * time of every process, ready to be rendered as a flame graph.
+ */
+
+#include "defs.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "sen.h"
+#include "xstring.h"
+
+#define PROCESS_SUMMARY_TOP	10	/* Subtrees printed in the report */
+#define NO_RECORD		((size_t) -1)
+
+bool process_summary;
+
+static enum {
+	PROCESS_SUMMARY_TEXT,
+	PROCESS_SUMMARY_JSON,
+	PROCESS_SUMMARY_FOLDED,
+} process_summary_format;
+
+struct process_record {
+	int pid;
+	int status;
+	bool exited;
+	unsigned int execs;
+	size_t parent;
+	char comm[PROC_COMM_LEN];
+	/* The file name of the last successful exec*.  */
+	char *exec_name;
+	/* The file name of the exec* in progress.  */
+	char *exec_pending;
+	struct timespec spawn;
+	struct timespec exec_entry;	/* Entry of the last exec* */
+	struct timespec first_exec;	/* Entry of the first successful exec* */
+	struct timespec exec_time;	/* Time spent in successful exec* */
+	struct timespec end;
+	struct timespec cpu;
+
+	/* Filled in by the report.  */
+	size_t first_child;
+	size_t next_sibling;
+	size_t subtree_count;
+	struct timespec subtree_end;
+};
+
+/* Records in the order of creation, parents precede their children.  */
+static struct process_record *records;
+static size_t records_size;
+static size_t records_count;
+
+/*
+ * Open addressing hash table of the latest record for each pid.
+ * A pid can have several records if it has been reused.
+ */
+struct pid_slot {
+	int pid;
+	size_t idx;
+};
+
+static struct pid_slot *slots;
+static size_t slots_size;
+static size_t slots_count;
+
+static struct pid_slot *slot_get(int pid);
+
+static void
+slots_grow(void)
+{
+	struct pid_slot *old = slots;
+	const size_t old_size = slots_size;
+
+	slots_size = old_size ? old_size * 2 : 256;
+	slots = xcalloc(slots_size, sizeof(*slots));
+	slots_count = 0;
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old[i].pid)
+			*slot_get(old[i].pid) = old[i];
+	}
+
+	free(old);
+}
+
+/* Finds the slot of the pid, creating one without a record if missing.  */
+static struct pid_slot *
+slot_get(const int pid)
+{
+	if ((slots_count + 1) * 2 > slots_size)
+		slots_grow();
+
+	for (size_t i = (unsigned int) pid * 0x9e3779b9U;; ++i) {
+		struct pid_slot *s = &slots[i & (slots_size - 1)];
+
+		if (!s->pid) {
+			s->pid = pid;
+			s->idx = NO_RECORD;
+			++slots_count;
+			return s;
+		}
+
+		if (s->pid == pid)
+			return s;
+	}
+}
+
+/* Returns the record of the live process with the pid.  */
+static struct process_record *
+record_find(const int pid)
+{
+	const size_t idx = slot_get(pid)->idx;
+
+	if (idx == NO_RECORD || records[idx].exited)
+		return NULL;
+	return &records[idx];
+}
+
+static struct process_record *
+record_new(struct tcb *tcp, const int pid)
+{
+	if (records_count >= records_size)
+		records = xgrowarray(records, &records_size, sizeof(*records));
+
+	const size_t idx = records_count++;
+	struct process_record *r = &records[idx];
+
+	memset(r, 0, sizeof(*r));
+	r->pid = pid;
+	r->parent = NO_RECORD;
+	clock_gettime(CLOCK_MONOTONIC, &r->spawn);
+
+	if (tcp) {
+		if (!tcp->comm[0])
+			maybe_load_task_comm(tcp);
+		strcpy(r->comm, tcp->comm);
+	}
+
+	slot_get(pid)->idx = idx;
+	return r;
+}
+
+void
+process_summary_start(struct tcb *tcp)
+{
+	if (record_find(tcp->pid) || get_tcb_tgid(tcp) != tcp->pid)
+		return;
+
+	record_new(tcp, tcp->pid);
+}
+
+static void
+process_summary_clone(struct tcb *tcp)
+{
+	int proc_pid = 0;
+	const int pid = translate_pid(tcp, tcp->u_rval, PT_TID, &proc_pid);
+
+	if (!pid)
+		return;
+
+	struct process_record *r = record_find(pid);
+
+	if (!r) {
+		/* Threads are accounted to their processes.  */
+		if (!proc_pid || proc_status_get_tgid(proc_pid) != proc_pid)
+			return;
+		r = record_new(NULL, pid);
+		strcpy(r->comm, tcp->comm);
+	}
+
+	const struct process_record *parent = record_find(get_tcb_tgid(tcp));
+
+	if (parent && r->parent == NO_RECORD && parent != r)
+		r->parent = parent - records;
+}
+
+static void
+process_summary_execve_entering(struct tcb *tcp)
+{
+	struct process_record *r = record_find(get_tcb_tgid(tcp));
+
+	if (!r)
+		return;
+
+	const kernel_ulong_t addr =
+		tcp->u_arg[tcp_sysent(tcp)->sen == SEN_execveat ? 1 : 0];
+	static char path[PATH_MAX];
+
+	clock_gettime(CLOCK_MONOTONIC, &r->exec_entry);
+	free(r->exec_pending);
+	r->exec_pending = umovestr(tcp, addr, sizeof(path), path) > 0
+			  ? xstrdup(path) : NULL;
+}
+
+static void
+process_summary_execve_exiting(struct tcb *tcp)
+{
+	struct process_record *r = record_find(get_tcb_tgid(tcp));
+
+	if (!r || !r->exec_entry.tv_sec)
+		return;
+
+	struct timespec now, dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &r->exec_entry);
+	ts_add(&r->exec_time, &r->exec_time, &dt);
+	if (!r->execs++)
+		r->first_exec = r->exec_entry;
+
+	free(r->exec_name);
+	r->exec_name = r->exec_pending;
+	r->exec_pending = NULL;
+}
+
+/*
+ * Returns true if the syscall has to be seen on exiting to build
+ * the process tree, even if it is not traced.
+ */
+bool
+process_summary_syscall(const unsigned int sen)
+{
+	switch (sen) {
+	case SEN_clone:
+	case SEN_clone3:
+	case SEN_fork:
+	case SEN_vfork:
+	case SEN_execve:
+	case SEN_execveat:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void
+process_summary_entering(struct tcb *tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_execve:
+	case SEN_execveat:
+		process_summary_execve_entering(tcp);
+		break;
+	}
+}
+
+void
+process_summary_exiting(struct tcb *tcp)
+{
+	if (syserror(tcp))
+		return;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_clone:
+	case SEN_clone3:
+	case SEN_fork:
+	case SEN_vfork:
+		if ((kernel_long_t) tcp->u_rval > 0)
+			process_summary_clone(tcp);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		process_summary_execve_exiting(tcp);
+		break;
+	}
+}
+
+void
+process_summary_exited(struct tcb *tcp, const int status,
+		       const struct rusage *ru)
+{
+	struct process_record *r = record_find(tcp->pid);
+
+	if (!r)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &r->end);
+	r->exited = true;
+	r->status = status;
+	r->cpu.tv_sec = ru->ru_utime.tv_sec + ru->ru_stime.tv_sec;
+	r->cpu.tv_nsec = (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000;
+	if (r->cpu.tv_nsec >= 1000000000) {
+		r->cpu.tv_nsec -= 1000000000;
+		++r->cpu.tv_sec;
+	}
+}
+
+static const char *
+record_name(const struct process_record *r)
+{
+	for (; r; r = r->parent == NO_RECORD ? NULL : &records[r->parent]) {
+		if (r->exec_name)
+			return r->exec_name;
+		if (r->comm[0])
+			return r->comm;
+	}
+
+	return "?";
+}
+
+static const char *
+record_status(const struct process_record *r)
+{
+	static char buf[sizeof("killed SIGRTMAX-NN (core dumped)")
+			+ sizeof(int) * 3];
+
+	if (!r->exited)
+		return "running";
+	if (WIFEXITED(r->status))
+		xsprintf(buf, "exit %d", WEXITSTATUS(r->status));
+	else
+		xsprintf(buf, "killed %s%s", sprintsigname(WTERMSIG(r->status)),
+			 WCOREDUMP(r->status) ? " (core dumped)" : "");
+	return buf;
+}
+
+static double
+record_lifetime(const struct process_record *r)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, &r->end, &r->spawn);
+	return ts_float(&dt);
+}
+
+static double
+record_spawn_to_exec(const struct process_record *r)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, &r->first_exec, &r->spawn);
+	return ts_float(&dt);
+}
+
+static double
+record_subtree_time(const struct process_record *r)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, &r->subtree_end, &r->spawn);
+	return ts_float(&dt);
+}
+
+/* Links the children and computes the subtree statistics.  */
+static void
+build_tree(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (size_t i = 0; i < records_count; ++i) {
+		struct process_record *r = &records[i];
+
+		if (!r->exited)
+			r->end = now;
+		r->first_child = r->next_sibling = NO_RECORD;
+		r->subtree_count = 1;
+		r->subtree_end = r->end;
+	}
+
+	/* Children are created after their parents.  */
+	for (size_t i = records_count; i-- > 0; ) {
+		struct process_record *r = &records[i];
+
+		if (r->parent == NO_RECORD)
+			continue;
+
+		struct process_record *p = &records[r->parent];
+
+		r->next_sibling = p->first_child;
+		p->first_child = i;
+		p->subtree_count += r->subtree_count;
+		if (ts_cmp(&r->subtree_end, &p->subtree_end) > 0)
+			p->subtree_end = r->subtree_end;
+	}
+}
+
+static void
+print_text_record(FILE *outf, const size_t idx, const unsigned int depth)
+{
+	const struct process_record *r = &records[idx];
+
+	fprintf(outf, "%8d ", r->pid);
+	if (r->execs)
+		fprintf(outf, "%10.6f %10.6f", record_spawn_to_exec(r),
+			ts_float(&r->exec_time));
+	else
+		fprintf(outf, "%10s %10s", "-", "-");
+	fprintf(outf, " %10.6f %10.6f %-16s %*s%s\n",
+		record_lifetime(r), ts_float(&r->cpu), record_status(r),
+		(int) MIN(depth, 32) * 2, "", record_name(r));
+
+	for (size_t i = r->first_child; i != NO_RECORD;
+	     i = records[i].next_sibling)
+		print_text_record(outf, i, depth + 1);
+}
+
+static void
+print_json_string(FILE *outf, const char *str)
+{
+	fputc('"', outf);
+	for (const unsigned char *p = (const unsigned char *) str; *p; ++p) {
+		if (*p == '"' || *p == '\\')
+			fprintf(outf, "\\%c", *p);
+		else if (*p < ' ' || *p == 0x7f)
+			fprintf(outf, "\\u%04x", *p);
+		else
+			fputc(*p, outf);
+	}
+	fputc('"', outf);
+}
+
+static void
+print_json_record(FILE *outf, const size_t idx)
+{
+	const struct process_record *r = &records[idx];
+
+	fprintf(outf, "{\"pid\":%d,\"command\":", r->pid);
+	print_json_string(outf, record_name(r));
+	if (r->execs)
+		fprintf(outf, ",\"spawn_to_exec\":%.6f,\"exec\":%.6f",
+			record_spawn_to_exec(r), ts_float(&r->exec_time));
+	fprintf(outf, ",\"lifetime\":%.6f,\"cpu\":%.6f,\"status\":",
+		record_lifetime(r), ts_float(&r->cpu));
+	print_json_string(outf, record_status(r));
+	fputs(",\"children\":[", outf);
+	for (size_t i = r->first_child; i != NO_RECORD;
+	     i = records[i].next_sibling) {
+		print_json_record(outf, i);
+		if (records[i].next_sibling != NO_RECORD)
+			fputc(',', outf);
+	}
+	fputs("]}", outf);
+}
+
+static void
+print_folded_name(FILE *outf, const struct process_record *r)
+{
+	if (r->parent != NO_RECORD) {
+		print_folded_name(outf, &records[r->parent]);
+		fputc(';', outf);
+	}
+
+	const char *name = record_name(r);
+	const char *slash = strrchr(name, '/');
+
+	for (const char *p = slash ? slash + 1 : name; *p; ++p)
+		fputc(*p == ';' || *p == ' ' ? '_' : *p, outf);
+}
+
+/* Prints the CPU time of every process less the time of its children.  */
+static void
+print_folded(FILE *outf)
+{
+	for (size_t i = 0; i < records_count; ++i) {
+		const struct process_record *r = &records[i];
+		int64_t us = r->cpu.tv_sec * 1000000LL + r->cpu.tv_nsec / 1000;
+
+		for (size_t c = r->first_child; c != NO_RECORD;
+		     c = records[c].next_sibling) {
+			us -= records[c].cpu.tv_sec * 1000000LL
+			      + records[c].cpu.tv_nsec / 1000;
+		}
+
+		if (us <= 0)
+			continue;
+
+		print_folded_name(outf, r);
+		fprintf(outf, " %" PRId64 "\n", us);
+	}
+}
+
+static int
+subtree_cmp(const void *a, const void *b)
+{
+	const struct process_record *ra = &records[*(const size_t *) a];
+	const struct process_record *rb = &records[*(const size_t *) b];
+	struct timespec da, db;
+
+	ts_sub(&da, &ra->subtree_end, &ra->spawn);
+	ts_sub(&db, &rb->subtree_end, &rb->spawn);
+
+	const int rc = ts_cmp(&db, &da);
+
+	return rc ? rc : (ra > rb) - (ra < rb);
+}
+
+void
+process_summary_summary(FILE *outf)
+{
+	if (!records_count)
+		return;
+
+	build_tree();
+
+	if (process_summary_format == PROCESS_SUMMARY_FOLDED) {
+		print_folded(outf);
+		return;
+	}
+
+	size_t *top = xcalloc(records_count, sizeof(*top));
+
+	for (size_t i = 0; i < records_count; ++i)
+		top[i] = i;
+	qsort(top, records_count, sizeof(*top), subtree_cmp);
+
+	const size_t ntop = MIN(records_count, PROCESS_SUMMARY_TOP);
+
+	if (process_summary_format == PROCESS_SUMMARY_JSON) {
+		fputs("{\"processes\":[", outf);
+		for (size_t i = 0, n = 0; i < records_count; ++i) {
+			if (records[i].parent != NO_RECORD)
+				continue;
+			if (n++)
+				fputc(',', outf);
+			print_json_record(outf, i);
+		}
+		fputs("],\"slowest_subtrees\":[", outf);
+		for (size_t i = 0; i < ntop; ++i) {
+			const struct process_record *r = &records[top[i]];
+
+			fprintf(outf, "%s{\"pid\":%d,\"command\":",
+				i ? "," : "", r->pid);
+			print_json_string(outf, record_name(r));
+			fprintf(outf, ",\"time\":%.6f,\"processes\":%zu}",
+				record_subtree_time(r), r->subtree_count);
+		}
+		fputs("]}\n", outf);
+	} else {
+		fputs("Process summary:\n"
+		      "     pid spawn-exec  exec-secs   lifetime   cpu-secs"
+		      " status           command\n"
+		      "-------- ---------- ---------- ---------- ----------"
+		      " ---------------- -------\n", outf);
+		for (size_t i = 0; i < records_count; ++i) {
+			if (records[i].parent == NO_RECORD)
+				print_text_record(outf, i, 0);
+		}
+
+		fputs("\nSlowest subtrees:\n"
+		      "  subtree-secs  processes      pid command\n"
+		      "-------------- ---------- -------- -------\n", outf);
+		for (size_t i = 0; i < ntop; ++i) {
+			const struct process_record *r = &records[top[i]];
+
+			fprintf(outf, "%14.6f %10zu %8d %s\n",
+				record_subtree_time(r), r->subtree_count,
+				r->pid, record_name(r));
+		}
+	}
+
+	free(top);
+}
+
+bool
+process_summary_init(const char *format)
+{
+	if (!format || !strcmp(format, "text"))
+		process_summary_format = PROCESS_SUMMARY_TEXT;
+	else if (!strcmp(format, "json"))
+		process_summary_format = PROCESS_SUMMARY_JSON;
+	else if (!strcmp(format, "folded"))
+		process_summary_format = PROCESS_SUMMARY_FOLDED;
+	else
+		return false;
+
+	process_summary = true;
+	return true;
+}
@@ -9,6 +9,7 @@
 #include "defs.h"
 #include "kill_save_errno.h"
 #include "ptrace.h"
+#include "probe_cache.h"
 #include "ptrace_syscall_info.h"
 #include "scno.h"
 
@@ -808,6 +809,18 @@ done:
 	return ptrace_stop == ARRAY_SIZE(si) * 2;
 }
 
+static int
+probe_ptrace_get_syscall_info(void)
+{
+	return do_test_ptrace_get_syscall_info();
+}
+
+static int
+probe_ptrace_set_syscall_info(void)
+{
+	return do_test_ptrace_set_syscall_info();
+}
+
 #endif /* HAVE_FORK */
 
 /*
@@ -831,7 +844,8 @@ test_ptrace_get_syscall_info(void)
 #ifdef HAVE_FORK
 	if (!ptrace_get_syscall_info_supported)
 		ptrace_get_syscall_info_supported =
-			do_test_ptrace_get_syscall_info();
+			probe_cache_run("ptrace_get_syscall_info",
+					probe_ptrace_get_syscall_info);
 #endif /* HAVE_FORK */
 
 	if (ptrace_get_syscall_info_supported)
@@ -855,7 +869,8 @@ test_ptrace_set_syscall_info(void)
 	 */
 #ifdef HAVE_FORK
 	ptrace_set_syscall_info_supported =
-		do_test_ptrace_set_syscall_info();
+		probe_cache_run("ptrace_set_syscall_info",
+				probe_ptrace_set_syscall_info);
 #endif /* HAVE_FORK */
 
 	if (ptrace_set_syscall_info_supported)
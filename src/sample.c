@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Syscall sampling bounds the tracing overhead on busy tracees.
+ * With a sample rate of N, only 1 in N invocations of every syscall
+ * is traced.  With a duty cycle of ON/PERIOD, only the syscalls made
+ * during the first ON of every PERIOD are traced; outside of these
+ * windows the tracees that have no seccomp filter are restarted with
+ * PTRACE_CONT and run without syscall stops until the next window begins.
+ *
+ * The summary counts are scaled by the ratio of the syscalls seen
+ * to the syscalls sampled, and by the ratio of the tracing time
+ * to the time covered by the duty cycle windows.
+ */
+
+#include "defs.h"
+#include "list.h"
+#include "sample.h"
+#include <sys/timerfd.h>
+
+#define NS_IN_S 1000000000ULL
+
+struct sample_counts {
+	uint64_t seen;
+	uint64_t sampled;
+};
+
+static unsigned int sample_rate = 1;
+/* The last element of each array counts unknown syscalls.  */
+static struct sample_counts *sample_countv[SUPPORTED_PERSONALITIES];
+
+static bool duty_cycle;
+static uint64_t duty_on_ns;
+static uint64_t duty_period_ns;
+static struct timespec duty_origin;
+static int duty_timer_fd = -1;
+/* The tracees restarted with PTRACE_CONT outside of the duty cycle window.  */
+static EMPTY_LIST(paused_tcbs);
+
+void
+set_sample_rate(unsigned int rate)
+{
+	sample_rate = rate;
+}
+
+bool
+set_duty_cycle(const char *spec)
+{
+	const char *slash = strchr(spec, '/');
+	struct timespec on, period;
+
+	if (!slash)
+		return false;
+
+	char *on_str = xstrndup(spec, slash - spec);
+	int rc = parse_ts(on_str, &on);
+	free(on_str);
+
+	if (rc < 0 || parse_ts(slash + 1, &period) < 0)
+		return false;
+
+	duty_on_ns = on.tv_sec * NS_IN_S + on.tv_nsec;
+	duty_period_ns = period.tv_sec * NS_IN_S + period.tv_nsec;
+	if (!duty_on_ns || duty_on_ns > duty_period_ns)
+		return false;
+
+	duty_cycle = duty_on_ns < duty_period_ns;
+	return true;
+}
+
+bool
+sampling_enabled(void)
+{
+	return sample_rate > 1 || duty_cycle;
+}
+
+bool
+duty_cycle_enabled(void)
+{
+	return duty_cycle;
+}
+
+/* Returns the time elapsed since the beginning of the first window.  */
+static uint64_t
+duty_elapsed_ns(void)
+{
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!ts_nz(&duty_origin))
+		duty_origin = now;
+
+	ts_sub(&elapsed, &now, &duty_origin);
+	return elapsed.tv_sec * NS_IN_S + elapsed.tv_nsec;
+}
+
+static bool
+in_duty_window(void)
+{
+	return duty_elapsed_ns() % duty_period_ns < duty_on_ns;
+}
+
+bool
+sample_syscall(struct tcb *tcp)
+{
+	if (duty_cycle && !in_duty_window())
+		return false;
+
+	if (sample_rate == 1)
+		return true;
+
+	struct sample_counts **sc = &sample_countv[current_personality];
+
+	if (!*sc)
+		*sc = xcalloc(nsyscalls + 1, sizeof(**sc));
+
+	struct sample_counts *c =
+		&(*sc)[scno_in_range(tcp->scno) ? tcp->scno : nsyscalls];
+
+	if (c->seen++ % sample_rate)
+		return false;
+
+	c->sampled++;
+	return true;
+}
+
+static void
+arm_sample_timer(void)
+{
+	duty_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_CLOEXEC | TFD_NONBLOCK);
+	if (duty_timer_fd < 0)
+		perror_msg_and_die("timerfd_create");
+
+	/* Fire at the beginning of every window from now on.  */
+	const uint64_t next = (duty_elapsed_ns() / duty_period_ns + 1)
+			      * duty_period_ns;
+	struct itimerspec its = {
+		.it_interval = {
+			.tv_sec = duty_period_ns / NS_IN_S,
+			.tv_nsec = duty_period_ns % NS_IN_S,
+		},
+		.it_value = {
+			.tv_sec = next / NS_IN_S,
+			.tv_nsec = next % NS_IN_S,
+		},
+	};
+	ts_add(&its.it_value, &its.it_value, &duty_origin);
+
+	if (timerfd_settime(duty_timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+		perror_msg_and_die("timerfd_settime");
+
+	debug_func_msg("duty cycle timer set to %lld.%09ld every %.9f seconds",
+		       (long long) its.it_value.tv_sec,
+		       (long) its.it_value.tv_nsec,
+		       ts_float(&its.it_interval));
+}
+
+bool
+sample_pause_tcb(struct tcb *tcp)
+{
+	if (in_duty_window())
+		return false;
+
+	if (duty_timer_fd < 0)
+		arm_sample_timer();
+
+	tcp->flags |= TCB_SAMPLE_PAUSED;
+	list_append(&paused_tcbs, &tcp->sample_list);
+	return true;
+}
+
+void
+sample_unpause_tcb(struct tcb *tcp)
+{
+	if (!(tcp->flags & TCB_SAMPLE_PAUSED))
+		return;
+
+	tcp->flags &= ~TCB_SAMPLE_PAUSED;
+	list_remove(&tcp->sample_list);
+}
+
+struct tcb *
+sample_pop_paused_tcb(void)
+{
+	struct list_item *elem = list_remove_head(&paused_tcbs);
+
+	if (!elem)
+		return NULL;
+
+	struct tcb *tcp = list_elem(elem, struct tcb, sample_list);
+
+	tcp->flags &= ~TCB_SAMPLE_PAUSED;
+	return tcp;
+}
+
+bool
+is_sample_timer_armed(void)
+{
+	return duty_timer_fd >= 0;
+}
+
+int
+get_sample_timer_fd(void)
+{
+	return duty_timer_fd;
+}
+
+void
+sample_timer_expired(void)
+{
+	uint64_t expirations;
+
+	if (read(duty_timer_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		perror_msg_and_die("read timerfd");
+}
+
+double
+sample_scale(kernel_ulong_t scno)
+{
+	double scale = 1;
+	const struct sample_counts *sc = sample_countv[current_personality];
+
+	if (sc) {
+		sc += scno_in_range(scno) ? scno : nsyscalls;
+		if (sc->sampled)
+			scale = (double) sc->seen / sc->sampled;
+	}
+
+	if (duty_cycle) {
+		const uint64_t elapsed = duty_elapsed_ns();
+		const uint64_t covered =
+			elapsed / duty_period_ns * duty_on_ns
+			+ MIN(elapsed % duty_period_ns, duty_on_ns);
+
+		if (covered)
+			scale *= (double) elapsed / covered;
+	}
+
+	return scale;
+}
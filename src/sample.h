@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_SAMPLE_H
+# define STRACE_SAMPLE_H
+
+void set_sample_rate(unsigned int rate);
+/* Parses ON/PERIOD duty cycle specification, returns false if invalid.  */
+bool set_duty_cycle(const char *spec);
+bool sampling_enabled(void);
+bool duty_cycle_enabled(void);
+/* Returns false if the syscall being entered is not to be traced.  */
+bool sample_syscall(struct tcb *);
+/*
+ * Returns true if the tracee is outside of the duty cycle window and can be
+ * restarted with PTRACE_CONT until the beginning of the next window.
+ */
+bool sample_pause_tcb(struct tcb *);
+/* Removes the tracee from the list of paused tracees, if it is there.  */
+void sample_unpause_tcb(struct tcb *);
+/* Returns the next paused tracee removed from the list, or NULL.  */
+struct tcb *sample_pop_paused_tcb(void);
+bool is_sample_timer_armed(void);
+/* Returns the timerfd that becomes readable when a duty cycle window begins. */
+int get_sample_timer_fd(void);
+void sample_timer_expired(void);
+/* Returns the factor the counts of the syscall are to be scaled by.  */
+double sample_scale(kernel_ulong_t scno);
+
+#endif /* !STRACE_SAMPLE_H */
@@ -0,0 +1,282 @@
+/*
+ * Segmented -ff output.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * With --output-segmented, the traces of all processes are written into
+ * a single file instead of a FILE.PID file per process.  After the magic
+ * line, the file consists of segments, each of them being a header line
+ * "@ PID LINES" followed by LINES lines of the trace of process PID.
+ * Consecutive lines of the same process are coalesced into one segment.
+ *
+ * On exit, an index is appended: an "@index COUNT" line followed by
+ * COUNT lines "PID OFFSET SEGMENTS LINES", where OFFSET is the file offset
+ * of the first segment of PID, and an "@end OFFSET" line with the file
+ * offset of the index.
+ *
+ * Every tracee gets a cookie stream instead of a file, so the traces are
+ * collected without a file descriptor and an inode per tracee.
+ */
+
+#include "defs.h"
+
+#define SEGMENTED_LOG_MAGIC "strace-segmented-log 1\n"
+/* The size a segment is written out at when it has grown larger.  */
+#define SEGMENT_MAX_SIZE 65536
+
+bool output_segmented;
+
+struct segment_stream {
+	unsigned int pid;
+	/* The unterminated last line written to the stream.  */
+	char *partial;
+	size_t partial_len;
+	size_t partial_size;
+};
+
+struct segment_index {
+	unsigned int pid;
+	uint64_t offset;
+	uint64_t segments;
+	uint64_t lines;
+};
+
+static FILE *log_fp;
+static const char *log_name;
+static uint64_t log_offset;
+
+/* The segment being collected.  */
+static unsigned int seg_pid;
+static char *seg_buf;
+static size_t seg_len;
+static size_t seg_size;
+static uint64_t seg_lines;
+
+/* Open addressing hash table of segment_index, keyed by pid.  */
+static struct segment_index *index_tab;
+static size_t index_size;
+static size_t index_count;
+
+static struct segment_index *index_get(unsigned int pid);
+
+static void
+index_grow(void)
+{
+	struct segment_index *old = index_tab;
+	const size_t old_size = index_size;
+
+	index_size = old_size ? old_size * 2 : 64;
+	index_tab = xcalloc(index_size, sizeof(*index_tab));
+	index_count = 0;
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old[i].pid)
+			*index_get(old[i].pid) = old[i];
+	}
+
+	free(old);
+}
+
+/* Finds the entry of the pid, creating a zeroed one if missing.  */
+static struct segment_index *
+index_get(const unsigned int pid)
+{
+	if ((index_count + 1) * 2 > index_size)
+		index_grow();
+
+	for (size_t i = pid * 0x9e3779b9U;; ++i) {
+		struct segment_index *e = &index_tab[i & (index_size - 1)];
+
+		if (!e->pid) {
+			e->pid = pid;
+			++index_count;
+			return e;
+		}
+
+		if (e->pid == pid)
+			return e;
+	}
+}
+
+static void
+write_segment(void)
+{
+	if (!seg_len)
+		return;
+
+	struct segment_index *e = index_get(seg_pid);
+
+	if (!e->segments)
+		e->offset = log_offset;
+	++e->segments;
+	e->lines += seg_lines;
+
+	const int n = fprintf(log_fp, "@ %u %" PRIu64 "\n", seg_pid, seg_lines);
+
+	if (n < 0 || fwrite(seg_buf, 1, seg_len, log_fp) != seg_len)
+		perror_msg("%s", log_name);
+	else
+		log_offset += n + seg_len;
+
+	seg_len = 0;
+	seg_lines = 0;
+}
+
+/*
+ * Prepares the segment for appending len bytes of the trace of the pid,
+ * starting a new segment if needed.
+ */
+static void
+reserve_segment(const unsigned int pid, const size_t len)
+{
+	if (seg_len && (seg_pid != pid || seg_len + len > SEGMENT_MAX_SIZE))
+		write_segment();
+
+	seg_pid = pid;
+	while (seg_size < seg_len + len)
+		seg_buf = xgrowarray(seg_buf, &seg_size, 1);
+}
+
+static void
+append_segment(const char *buf, const size_t len)
+{
+	memcpy(seg_buf + seg_len, buf, len);
+	seg_len += len;
+
+	for (const char *p = buf, *end = buf + len;
+	     (p = memchr(p, '\n', end - p)); ++p)
+		++seg_lines;
+}
+
+static void
+append_partial(struct segment_stream *s, const char *buf, const size_t len)
+{
+	while (s->partial_size < s->partial_len + len)
+		s->partial = xgrowarray(s->partial, &s->partial_size, 1);
+
+	memcpy(s->partial + s->partial_len, buf, len);
+	s->partial_len += len;
+}
+
+static ssize_t
+segment_stream_write(void *cookie, const char *buf, size_t size)
+{
+	struct segment_stream *s = cookie;
+	const char *nl = memrchr(buf, '\n', size);
+
+	if (!nl) {
+		append_partial(s, buf, size);
+		return size;
+	}
+
+	/* Segments contain complete lines only.  */
+	const size_t len = nl + 1 - buf;
+
+	reserve_segment(s->pid, s->partial_len + len);
+	append_segment(s->partial, s->partial_len);
+	append_segment(buf, len);
+	s->partial_len = 0;
+	append_partial(s, nl + 1, size - len);
+
+	return size;
+}
+
+static int
+segment_stream_close(void *cookie)
+{
+	struct segment_stream *s = cookie;
+
+	if (s->partial_len) {
+		reserve_segment(s->pid, s->partial_len + 1);
+		append_segment(s->partial, s->partial_len);
+		append_segment("\n", 1);
+	}
+
+	free(s->partial);
+	free(s);
+	return 0;
+}
+
+FILE *
+segmented_log_open(const unsigned int pid)
+{
+	static const cookie_io_functions_t io_funcs = {
+		.write = segment_stream_write,
+		.close = segment_stream_close,
+	};
+	struct segment_stream *s = xzalloc(sizeof(*s));
+
+	s->pid = pid;
+	index_get(pid);
+
+	FILE *fp = fopencookie(s, "w", io_funcs);
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+	return fp;
+}
+
+void
+segmented_log_flush(void)
+{
+	write_segment();
+	if (fflush(log_fp))
+		perror_msg("%s", log_name);
+}
+
+static int
+index_cmp(const void *a, const void *b)
+{
+	const struct segment_index *ea = a;
+	const struct segment_index *eb = b;
+
+	return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+void
+segmented_log_finish(void)
+{
+	struct segment_index *list = xcalloc(index_count + 1, sizeof(*list));
+	size_t n = 0;
+
+	write_segment();
+
+	for (size_t i = 0; i < index_size; ++i) {
+		if (index_tab[i].pid)
+			list[n++] = index_tab[i];
+	}
+
+	qsort(list, n, sizeof(*list), index_cmp);
+
+	fprintf(log_fp, "@index %zu\n", n);
+	for (size_t i = 0; i < n; ++i) {
+		fprintf(log_fp, "%u %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			list[i].pid, list[i].offset,
+			list[i].segments, list[i].lines);
+	}
+	fprintf(log_fp, "@end %" PRIu64 "\n", log_offset);
+
+	free(list);
+	if (fclose(log_fp))
+		perror_msg("%s", log_name);
+}
+
+void
+segmented_log_init(FILE *fp, const char *name)
+{
+	log_fp = fp;
+	log_name = name;
+
+	fputs(SEGMENTED_LOG_MAGIC, fp);
+	if (fflush(fp))
+		perror_msg_and_die("%s", name);
+
+	const off_t offset = ftello(fp);
+	if (offset < 0)
+		perror_msg_and_die("%s", name);
+	log_offset = offset;
+}
@@ -8,69 +8,278 @@
  */
 
 /*
- * open_memstream returns a FILE stream that allows writing to a
- * dynamically growing buffer, that can be either copied to
- * tcp->outf (syscall successful) or dropped (syscall failed)
+ * Syscall output is staged in a per-tcb growable buffer that is either
+ * copied to tcp->outf (syscall output is to be published) or dropped.
+ * The buffer is allocated once and reused for all syscalls of the tcb,
+ * including the ones that are resumed after being unfinished.
+ *
+ * With --collapse-repeats, every syscall line is staged, and a line that
+ * is identical to the previous line of the tcb is not published; when
+ * the tcb prints a different line, a single "[previous line repeated
+ * N times over X ms]" line is printed instead of the repeats.  The leader
+ * (pid and timestamps) and the -T time are not compared.
  */
 
 #include "defs.h"
+#include <stdarg.h>
 
 struct staged_output_data {
-	char *memfptr;
-	size_t memfloc;
-	FILE *real_outf;	/* Backup for real outf while staging */
+	char *buf;
+	size_t size;		/* Allocated size of buf */
+	size_t len;		/* Length of the staged output */
+	bool active;
+
+	/* Offset of the text after the leader.  */
+	size_t body;
+	/* Offsets of the text that is not compared, if skip_end > 0.  */
+	size_t skip_begin;
+	size_t skip_end;
+
+	/* The compared text of the last published line.  */
+	char *prev;
+	size_t prev_size;
+	size_t prev_len;
+	bool prev_valid;
+	struct timespec prev_ts;
+
+	/* The repeats of the last published line that are not printed.  */
+	uint64_t repeats;
+	struct timespec last_ts;
+	/* The leader of the last repeat.  */
+	char *leader;
+	size_t leader_size;
+	size_t leader_len;
 };
 
-FILE *
-strace_open_memstream(struct tcb *tcp)
+bool collapse_repeats;
+
+bool
+stage_output_active(const struct tcb *tcp)
+{
+	return tcp->staged_output_data && tcp->staged_output_data->active;
+}
+
+/* Ensures that there is room for at least len more bytes plus '\0'. */
+static char *
+stage_output_reserve(struct staged_output_data *so, size_t len)
+{
+	while (so->size - so->len <= len)
+		so->buf = xgrowarray(so->buf, &so->size, 1);
+
+	return so->buf + so->len;
+}
+
+void
+stage_output_begin(struct tcb *tcp)
+{
+	struct staged_output_data *so = tcp->staged_output_data;
+
+	if (!so)
+		so = tcp->staged_output_data = xzalloc(sizeof(*so));
+
+	so->len = 0;
+	so->body = 0;
+	so->skip_begin = so->skip_end = 0;
+	stage_output_reserve(so, 0);
+	so->buf[0] = '\0';
+	so->active = true;
+}
+
+void
+stage_output_mark_body(struct tcb *tcp)
+{
+	if (stage_output_active(tcp))
+		tcp->staged_output_data->body = tcp->staged_output_data->len;
+}
+
+void
+stage_output_skip_begin(struct tcb *tcp)
+{
+	if (stage_output_active(tcp))
+		tcp->staged_output_data->skip_begin =
+			tcp->staged_output_data->len;
+}
+
+void
+stage_output_skip_end(struct tcb *tcp)
+{
+	if (stage_output_active(tcp))
+		tcp->staged_output_data->skip_end =
+			tcp->staged_output_data->len;
+}
+
+/* Copies len bytes of str to the growable buffer *dst at offset off.  */
+static void
+copy_text(char **dst, size_t *size, size_t off, const char *str, size_t len)
+{
+	while (*size < off + len)
+		*dst = xgrowarray(*dst, size, 1);
+	memcpy(*dst + off, str, len);
+}
+
+void
+stage_output_flush_repeats(struct tcb *tcp)
+{
+	struct staged_output_data *so = tcp->staged_output_data;
+
+	if (!so)
+		return;
+
+	if (so->repeats) {
+		struct timespec dt;
+
+		ts_sub(&dt, &so->last_ts, &so->prev_ts);
+		fprintf(tcp->outf, "%.*s[previous line repeated %" PRIu64
+			" time%s over %.3f ms]\n", (int) so->leader_len,
+			so->leader, so->repeats, so->repeats == 1 ? "" : "s",
+			ts_float(&dt) * 1000);
+		so->repeats = 0;
+	}
+
+	so->prev_valid = false;
+}
+
+/*
+ * Returns the compared text of the staged line: head_len bytes
+ * at the body offset followed by the bytes from *tail_off to the end.
+ * Returns false if the line is not complete.
+ */
+static bool
+get_compared_text(const struct staged_output_data *so, size_t *head_len,
+		  size_t *tail_off)
+{
+	/* Lines cut by detach and the like are not compared.  */
+	if (so->body >= so->len || so->buf[so->len - 1] != '\n')
+		return false;
+
+	if (so->skip_end > so->skip_begin && so->skip_begin >= so->body) {
+		*head_len = so->skip_begin - so->body;
+		*tail_off = so->skip_end;
+	} else {
+		*head_len = so->len - so->body;
+		*tail_off = so->len;
+	}
+
+	return true;
+}
+
+/* Counts the staged line if it is a repeat of the previous one.  */
+static bool
+is_repeat(struct staged_output_data *so)
+{
+	size_t head_len, tail_off;
+
+	if (!so->prev_valid || !get_compared_text(so, &head_len, &tail_off))
+		return false;
+
+	const size_t tail_len = so->len - tail_off;
+
+	if (so->prev_len != head_len + tail_len
+	    || memcmp(so->prev, so->buf + so->body, head_len)
+	    || memcmp(so->prev + head_len, so->buf + tail_off, tail_len))
+		return false;
+
+	++so->repeats;
+	clock_gettime(CLOCK_MONOTONIC, &so->last_ts);
+	copy_text(&so->leader, &so->leader_size, 0, so->buf, so->body);
+	so->leader_len = so->body;
+	return true;
+}
+
+static void
+remember_line(struct staged_output_data *so)
+{
+	size_t head_len, tail_off;
+
+	if (!get_compared_text(so, &head_len, &tail_off))
+		return;
+
+	const size_t tail_len = so->len - tail_off;
+
+	copy_text(&so->prev, &so->prev_size, 0, so->buf + so->body, head_len);
+	copy_text(&so->prev, &so->prev_size, head_len, so->buf + tail_off,
+		  tail_len);
+	so->prev_len = head_len + tail_len;
+	so->prev_valid = true;
+	clock_gettime(CLOCK_MONOTONIC, &so->prev_ts);
+}
+
+void
+stage_output_write(struct tcb *tcp, const char *str, size_t len)
 {
-	FILE *fp = NULL;
-
-#ifdef HAVE_OPEN_MEMSTREAM
-	tcp->staged_output_data = xmalloc(sizeof(*tcp->staged_output_data));
-	fp = open_memstream(&tcp->staged_output_data->memfptr,
-			    &tcp->staged_output_data->memfloc);
-	if (!fp)
-		perror_msg_and_die("open_memstream");
-	/*
-	 * Call to fflush required to update tcp->memfptr,
-	 * see open_memstream man page.
-	 */
-	fflush(fp);
-
-	/* Store the FILE pointer for later restoration. */
-	tcp->staged_output_data->real_outf = tcp->outf;
-	tcp->outf = fp;
-#endif
-
-	return fp;
+	struct staged_output_data *so = tcp->staged_output_data;
+	char *p = stage_output_reserve(so, len);
+
+	memcpy(p, str, len);
+	so->len += len;
+	so->buf[so->len] = '\0';
+}
+
+int
+stage_output_vprintf(struct tcb *tcp, const char *fmt, va_list args)
+{
+	struct staged_output_data *so = tcp->staged_output_data;
+	va_list copy;
+
+	va_copy(copy, args);
+	int n = vsnprintf(so->buf + so->len, so->size - so->len, fmt, copy);
+	va_end(copy);
+	if (n < 0)
+		return n;
+
+	if ((size_t) n >= so->size - so->len) {
+		char *p = stage_output_reserve(so, n);
+		n = vsnprintf(p, so->size - so->len, fmt, args);
+		if (n < 0)
+			return n;
+	}
+
+	so->len += n;
+	return n;
 }
 
 void
-strace_close_memstream(struct tcb *tcp, bool publish)
+stage_output_end(struct tcb *tcp, bool publish)
 {
-#ifdef HAVE_OPEN_MEMSTREAM
-	if (!tcp->staged_output_data) {
-		debug_msg("memstream already closed");
+	struct staged_output_data *so = tcp->staged_output_data;
+
+	if (!so || !so->active) {
+		debug_msg("staged output already ended");
 		return;
 	}
 
-	if (fclose(tcp->outf))
-		perror_msg("fclose(tcp->outf)");
+	so->active = false;
+	if (!so->len)
+		return;
 
-	tcp->outf = tcp->staged_output_data->real_outf;
-	if (tcp->staged_output_data->memfptr) {
-		if (publish)
-			fputs_unlocked(tcp->staged_output_data->memfptr,
-				       tcp->outf);
-		else
-			debug_msg("syscall output dropped: %s",
-				  tcp->staged_output_data->memfptr);
+	if (publish && collapse_repeats) {
+		if (is_repeat(so)) {
+			so->len = 0;
+			return;
+		}
+		stage_output_flush_repeats(tcp);
+		remember_line(so);
+	}
 
-		free(tcp->staged_output_data->memfptr);
-		tcp->staged_output_data->memfptr = NULL;
+	if (publish) {
+		if (fwrite(so->buf, 1, so->len, tcp->outf) != so->len)
+			perror_msg("fwrite");
+	} else {
+		debug_msg("syscall output dropped: %s", so->buf);
 	}
+
+	so->len = 0;
+}
+
+void
+stage_output_free(struct tcb *tcp)
+{
+	if (!tcp->staged_output_data)
+		return;
+
+	free(tcp->staged_output_data->buf);
+	free(tcp->staged_output_data->prev);
+	free(tcp->staged_output_data->leader);
 	free(tcp->staged_output_data);
 	tcp->staged_output_data = NULL;
-#endif
 }
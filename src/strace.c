@@ -15,7 +15,9 @@
 #include <fcntl.h>
 #include "ptrace.h"
 #include <signal.h>
+#include <poll.h>
 #include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #ifdef HAVE_PATHS_H
 # include <paths.h>
@@ -34,7 +36,9 @@
 #include "filter_seccomp.h"
 #include "largefile_wrappers.h"
 #include "mmap_cache.h"
+#include "mmap_notify.h"
 #include "number_set.h"
+#include "probe_cache.h"
 #include "ptrace_syscall_info.h"
 #include "scno.h"
 #include "printsiginfo.h"
@@ -42,6 +46,7 @@
 #include "trace_event.h"
 #include "xstring.h"
 #include "delay.h"
+#include "sample.h"
 #include "wait.h"
 #include "secontext.h"
 
@@ -157,6 +162,20 @@ static int exit_code;
 static int strace_child;
 static int strace_tracer_pid;
 
+/* Reported by the stats command of the control socket.  */
+static struct {
+	struct timespec start;
+	uint64_t syscall_stops;
+	uint64_t signal_stops;
+} tracer_stats;
+
+#define MAX_SHARDS 1024
+/* The number of tracer processes requested by --shards.  */
+static int nshards;
+/* The tracer processes forked by the supervisor.  */
+static pid_t *shard_pids;
+static unsigned int shard_count;
+
 static const char *username;
 static uid_t run_uid;
 static gid_t run_gid;
@@ -183,9 +202,32 @@ struct tcb_wait_data {
 	siginfo_t si;        /**< siginfo, returned by PTRACE_GETSIGINFO */
 };
 
+/*
+ * Tcbs are allocated from slabs, and the free ones are kept in a list,
+ * so that both allocating and dropping a tcb take constant time.
+ * Slabs that have no tcbs in use are released once there is more than one
+ * of them.
+ */
+# define TCB_SLAB_SIZE	64
+
+struct tcb_slab {
+	struct tcb_slab *next;
+	unsigned int used;
+	struct tcb tcbs[TCB_SLAB_SIZE];
+};
+
+static struct tcb_slab *tcb_slabs;
+static unsigned int empty_tcb_slabs;
+static EMPTY_LIST(free_tcbs);
+
+/*
+ * The tcbs in use, in the order of their allocation.  A dropped tcb leaves
+ * a NULL hole in its slot, holes are removed by compact_tcbtab.
+ */
 static struct tcb **tcbtab;
 static unsigned int nprocs;
-static size_t tcbtabsize;
+static size_t tcbtabsize;	/* The number of slots in use, holes included */
+static size_t tcbtab_alloc;	/* The number of slots allocated */
 
 static struct tcb_wait_data *tcb_wait_tab;
 static size_t tcb_wait_tab_size;
@@ -204,13 +246,14 @@ static void cleanup(int sig);
 static void interrupt(int sig);
 
 #ifdef HAVE_SIG_ATOMIC_T
-static volatile sig_atomic_t interrupted, restart_failed;
+static volatile sig_atomic_t interrupted;
 #else
-static volatile int interrupted, restart_failed;
+static volatile int interrupted;
 #endif
 
-static sigset_t timer_set;
-static void timer_sighandler(int);
+static bool restart_failed;
+static bool restart_delayed_tcbs(void);
+static void resume_sampled_tcbs(void);
 
 #ifndef HAVE_STRERROR
 
@@ -343,6 +386,11 @@ Tracing:\n\
      4, never_tstp: fatal signals and SIGTSTP (^Z) are always blocked\n\
                     (useful to make 'strace -o FILE PROG' not stop on ^Z)\n\
   --kill-on-exit kill all tracees if strace is killed\n\
+  --shards=N     split processes attached with -p between N tracer processes\n\
+                 (requires -ff and -o FILE)\n\
+  --control=SOCKET\n\
+                 accept commands changing filters, pausing output, and\n\
+                 printing statistics on unix socket SOCKET\n\
 \n\
 Filtering:\n\
   -e trace=[!][?]{{SYSCALL|GROUP|all|/REGEX}[@64|@32|@x32]|none},\n\
@@ -365,6 +413,9 @@ Filtering:\n\
                  print only syscalls that returned without an error code\n\
   -Z, --failed-only\n\
                  print only syscalls that returned with an error code\n\
+  --sample=N     trace only 1 in N invocations of each syscall\n\
+  --duty-cycle=ON/PERIOD\n\
+                 trace syscalls only during the first ON of every PERIOD\n\
 \n\
 Output format:\n\
   -a COLUMN, --columns=COLUMN\n\
@@ -377,6 +428,9 @@ Output format:\n\
                  dereference structures for the syscall in SET\n\
   -e raw=SET, --raw=SET\n\
                  print undecoded arguments for the syscalls in SET\n\
+  -e entry-only=SET, --entry-only[=SET]\n\
+                 print the syscalls in SET on entering only, without\n\
+                 waiting for them to return (default all)\n\
   -e read=SET, --read=SET\n\
                  dump the data read from the file descriptors in SET\n\
   -e write=SET, --write=SET\n\
@@ -386,6 +440,8 @@ Output format:\n\
      messages:   attach, exit, path-resolution, personality, thread-execve\n\
   -e kvm=vcpu[+], --kvm=vcpu[+]\n\
                  print exit reason of kvm vcpu ('+' for printing kvm_run struct)\n\
+  -e kvm=stats, --kvm=stats\n\
+                 report per-vcpu and per-exit-reason KVM_RUN statistics\n\
   -e namespace=new, --namespace=new\n\
                  print namespace IDs that the tracee enters\n\
   -e decode-fds=SET, --decode-fds=SET\n\
@@ -421,6 +477,8 @@ Output format:\n\
 "\
   -kk, --stack-trace=source\n\
                  obtain stack trace and source info between each syscall\n\
+  --stack-trace=deferred\n\
+                 record raw stack traces, print them symbolized on exit\n\
 "
 # endif
 "\
@@ -440,6 +498,12 @@ Output format:\n\
                  open the file provided in the -o option in append mode\n\
   --output-separately\n\
                  output into separate files (by appending pid to file names)\n\
+  --output-segmented\n\
+                 output into a single file of per-pid segments\n\
+  --collapse-repeats\n\
+                 print repeated identical syscall lines of a process once\n\
+  --output-compress=gzip[:LEVEL]\n\
+                 gzip compress the files written with -o FILE\n\
   -q, --quiet=attach,personality\n\
                  suppress messages about attaching, detaching, etc.\n\
   -qq, --quiet=attach,personality,exit\n\
@@ -486,6 +550,9 @@ Output format:\n\
                  print command names associated with PIDs\n\
   --always-show-pid\n\
                  show PID prefix also for the process started by strace\n\
+  --io-uring-rings\n\
+                 decode io_uring submission and completion queue entries\n\
+                 and report per-operation completion latency\n\
 \n\
 Statistics:\n\
   -c, --summary-only\n\
@@ -505,6 +572,24 @@ Statistics:\n\
                  (default time-percent,total-time,avg-time,calls,errors,name)\n\
   -w, --summary-wall-clock\n\
                  summarise syscall latency (default is system time)\n\
+  --futex-profile\n\
+                 report futex contention: blocked time and wait time\n\
+                 histograms per futex word, waits per thread, and\n\
+                 waker-waiter edges\n\
+  --poll-profile report event loop readiness: wakeups per second, events\n\
+                 per wakeup, empty wakeups, timeouts, and the most\n\
+                 frequently ready file descriptors of epoll, poll, and select\n\
+  --process-summary[=FORMAT]\n\
+                 report the process tree with spawn to exec latency, exec\n\
+                 time, lifetime, exit status, and CPU time of every process,\n\
+                 and the slowest subtrees; FORMAT is text, json, or folded\n\
+  --file-summary report the most frequently looked up paths and directories\n\
+                 with successful and failed opens, stats, accesses, and\n\
+                 readlinks, repeated lookups, and the time spent\n\
+  --blocking-profile=FILE\n\
+                 write wall clock time spent in blocking syscalls to FILE\n\
+                 as folded stacks keyed by command name, stacks (with -k),\n\
+                 and syscall\n\
 \n\
 Stop condition:\n\
   --syscall-limit=LIMIT\n\
@@ -522,7 +607,9 @@ Tampering:\n\
            [:poke_exit=@argN=DATAN,@argM=DATAM...]\n\
            [:when=WHEN],\n\
                  perform syscall tampering for the syscalls in SET\n\
-     delay:      microseconds or NUMBER{s|ms|us|ns}\n\
+     delay:      microseconds or NUMBER{s|ms|us|ns}, or a distribution:\n\
+                 uniform,MIN,MAX, exp,MEAN, lognormal,MEDIAN,SIGMA,\n\
+                 pareto,SCALE,ALPHA, empirical,FILE\n\
      when:       FIRST[..LAST][+[STEP]]\n\
   -e fault=SET[:error=ERRNO][:when=WHEN], --fault=SET[:error=ERRNO][:when=WHEN]\n\
                  synonym for -e inject with default ERRNO set to ENOSYS.\n\
@@ -530,6 +617,12 @@ Tampering:\n\
 Miscellaneous:\n\
   -d, --debug    enable debug output to stderr\n\
   -h, --help     print help message\n\
+  --merge-logs=PREFIX\n\
+                 merge the PREFIX.PID files produced by -ff -tt[t] by time\n\
+                 into standard output and exit\n\
+  --probe-cache[=FILE]\n\
+                 cache results of kernel capability probes in FILE\n\
+                 (default $XDG_CACHE_HOME/strace/probes)\n\
   --seccomp-bpf  enable seccomp-bpf filtering\n\
   --tips[=[[id:]ID][,[format:]FORMAT]]\n\
                  show strace tips, tricks, and tweaks on exit\n\
@@ -689,6 +782,15 @@ strace_fopen(const char *path)
 	return fp;
 }
 
+/* Opens a trace output file, compressed with --output-compress.  */
+static FILE *
+strace_fopen_log(const char *path)
+{
+	FILE *fp = strace_fopen(path);
+
+	return output_compress ? output_compress_open(fp) : fp;
+}
+
 static int popen_pid;
 
 #ifndef _PATH_BSHELL
@@ -757,7 +859,9 @@ static void
 tvprintf(const char *const fmt, va_list args)
 {
 	if (current_tcp) {
-		int n = vfprintf(current_tcp->outf, fmt, args);
+		int n = stage_output_active(current_tcp)
+			? stage_output_vprintf(current_tcp, fmt, args)
+			: vfprintf(current_tcp->outf, fmt, args);
 		if (n < 0) {
 			/* very unlikely due to vfprintf buffering */
 			outf_perror(current_tcp);
@@ -783,6 +887,11 @@ bool
 tprints_string_uncol(const char *str)
 {
 	if (current_tcp) {
+		if (stage_output_active(current_tcp)) {
+			stage_output_write(current_tcp, str, strlen(str));
+			return true;
+		}
+
 		int n = fputs_unlocked(str, current_tcp->outf);
 		if (n >= 0)
 			return true;
@@ -826,6 +935,12 @@ tprintf_comment(const char *fmt, ...)
 static void
 flush_tcp_output(const struct tcb *const tcp)
 {
+	/* Compressed output is flushed by output_compress_tick.  */
+	if (output_compress) {
+		output_compress_flush_later();
+		return;
+	}
+
 	if (fflush(tcp->outf))
 		outf_perror(tcp);
 }
@@ -877,7 +992,7 @@ printleader(struct tcb *tcp)
 		if (printing_tcp->curcol != 0 &&
 		    (printing_tcp == tcp ||
 		     (!output_separately &&
-		      !printing_tcp->staged_output_data))) {
+		      !stage_output_active(printing_tcp)))) {
 			/*
 			 * case 1: we have a shared log (i.e. not -ff), and last line
 			 * wasn't finished (same or different tcb, doesn't matter).
@@ -892,6 +1007,10 @@ printleader(struct tcb *tcp)
 		}
 	}
 
+	/* Any other line ends the run of repeated syscall lines.  */
+	if (collapse_repeats && !stage_output_active(tcp))
+		stage_output_flush_repeats(tcp);
+
 	printing_tcp = tcp;
 	set_current_tcp(tcp);
 	current_tcp->curcol = 0;
@@ -964,6 +1083,8 @@ printleader(struct tcb *tcp)
 
 	if (iflag)
 		print_instruction_pointer(tcp);
+
+	stage_output_mark_body(tcp);
 }
 
 void
@@ -982,10 +1103,12 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 {
 	tcp->flags |= TCB_ATTACHED | TCB_STARTUP | flags;
 	tcp->outf = shared_log; /* if not -ff mode, the same file is for all */
-	if (output_separately) {
+	if (output_segmented) {
+		tcp->outf = segmented_log_open(tcp->pid);
+	} else if (output_separately) {
 		char name[PATH_MAX];
 		xsprintf(name, "%s.%u", outfname, tcp->pid);
-		tcp->outf = strace_fopen(name);
+		tcp->outf = strace_fopen_log(name);
 	}
 
 #ifdef ENABLE_STACKTRACE
@@ -994,26 +1117,105 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 #endif
 }
 
+#define PID2TCB_CACHE_SIZE 1024U
+#define PID2TCB_CACHE_MASK (PID2TCB_CACHE_SIZE - 1)
+
+static struct tcb *pid2tcb_cache[PID2TCB_CACHE_SIZE];
+
+/* Drops the dropped tcb from the pid2tcb cache.  */
+static void
+forget_pid2tcb(struct tcb *tcp)
+{
+	struct tcb **const ptcp =
+		&pid2tcb_cache[tcp->pid & PID2TCB_CACHE_MASK];
+
+	if (*ptcp == tcp)
+		*ptcp = NULL;
+}
+
+static void
+add_tcb_slab(void)
+{
+	/*
+	 * We don't want to relocate the TCBs because our callers
+	 * have pointers and it would be a pain, so TCBs are allocated
+	 * in slabs that stay in place until all their TCBs are free.
+	 */
+	struct tcb_slab *slab = xcalloc(1, sizeof(*slab));
+
+	slab->next = tcb_slabs;
+	tcb_slabs = slab;
+	++empty_tcb_slabs;
+
+	for (unsigned int i = 0; i < TCB_SLAB_SIZE; ++i) {
+		slab->tcbs[i].slab = slab;
+		list_append(&free_tcbs, &slab->tcbs[i].wait_list);
+	}
+
+	debug_func_msg("new slab of %u tcbs", TCB_SLAB_SIZE);
+}
+
+/*
+ * Releases the slabs that have no tcbs in use but one.
+ * The tcbs of released slabs must not be referenced anymore,
+ * so this is called only between the rounds of event processing.
+ */
+static void
+release_empty_tcb_slabs(void)
+{
+	if (empty_tcb_slabs <= 1)
+		return;
+
+	bool keep = true;
+
+	for (struct tcb_slab **pslab = &tcb_slabs; *pslab;) {
+		struct tcb_slab *slab = *pslab;
+
+		if (slab->used || keep) {
+			if (!slab->used)
+				keep = false;
+			pslab = &slab->next;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < TCB_SLAB_SIZE; ++i)
+			list_remove(&slab->tcbs[i].wait_list);
+		*pslab = slab->next;
+		free(slab);
+		--empty_tcb_slabs;
+
+		debug_func_msg("released a slab of %u tcbs", TCB_SLAB_SIZE);
+	}
+}
+
+/* Removes the holes left in tcbtab by dropped tcbs.  */
+static void
+compact_tcbtab(void)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (!tcp)
+			continue;
+		tcp->tcbtab_idx = n;
+		tcbtab[n++] = tcp;
+	}
+
+	tcbtabsize = n;
+}
+
+/*
+ * Tidies up the tcb storage.  There must be no references to free tcbs
+ * and no iterations over tcbtab in progress.
+ */
 static void
-expand_tcbtab(void)
+tidy_tcbs(void)
 {
-	/* Allocate some (more) TCBs (and expand the table).
-	   We don't want to relocate the TCBs because our
-	   callers have pointers and it would be a pain.
-	   So tcbtab is a table of pointers.  Since we never
-	   free the TCBs, we allocate a single chunk of many.  */
-	size_t old_tcbtabsize;
-	struct tcb *newtcbs;
-
-	old_tcbtabsize = tcbtabsize;
-
-	tcbtab = xgrowarray(tcbtab, &tcbtabsize, sizeof(tcbtab[0]));
-	newtcbs = xcalloc(tcbtabsize - old_tcbtabsize, sizeof(newtcbs[0]));
-
-	for (struct tcb **tcb_ptr = tcbtab + old_tcbtabsize;
-	     tcb_ptr < tcbtab + tcbtabsize;
-	     ++tcb_ptr, ++newtcbs)
-		*tcb_ptr = newtcbs;
+	if (tcbtabsize > 2 * (size_t) nprocs)
+		compact_tcbtab();
+	release_empty_tcb_slabs();
 }
 
 static char *
@@ -1056,7 +1258,8 @@ print_pid_comm(int pid)
 void
 maybe_load_task_comm(struct tcb *tcp)
 {
-	if (!is_number_in_set(DECODE_PID_COMM, decode_pid_set))
+	if (!is_number_in_set(DECODE_PID_COMM, decode_pid_set)
+	    && !blocking_profile && !process_summary)
 		return;
 
 	load_pid_comm(get_proc_pid(tcp->pid), tcp->comm, sizeof(tcp->comm));
@@ -1065,29 +1268,35 @@ maybe_load_task_comm(struct tcb *tcp)
 static struct tcb *
 alloctcb(int pid)
 {
-	if (nprocs == tcbtabsize)
-		expand_tcbtab();
+	if (list_is_empty(&free_tcbs))
+		add_tcb_slab();
+	if (tcbtabsize == tcbtab_alloc)
+		tcbtab = xgrowarray(tcbtab, &tcbtab_alloc, sizeof(tcbtab[0]));
 
-	for (size_t i = 0; i < tcbtabsize; ++i) {
-		struct tcb *tcp = tcbtab[i];
-		if (!tcp->pid) {
-			memset(tcp, 0, sizeof(*tcp));
-			list_init(&tcp->wait_list);
-			tcp->pid = pid;
-			maybe_load_task_comm(tcp);
+	struct tcb *tcp = list_elem(list_remove_head(&free_tcbs),
+				    struct tcb, wait_list);
+	struct tcb_slab *slab = tcp->slab;
+
+	if (!slab->used++)
+		--empty_tcb_slabs;
+
+	memset(tcp, 0, sizeof(*tcp));
+	list_init(&tcp->wait_list);
+	tcp->slab = slab;
+	tcp->tcbtab_idx = tcbtabsize;
+	tcbtab[tcbtabsize++] = tcp;
+	tcp->pid = pid;
+	maybe_load_task_comm(tcp);
 #if SUPPORTED_PERSONALITIES > 1
-			tcp->currpers = current_personality;
+	tcp->currpers = current_personality;
 #endif
 #ifdef ENABLE_SECONTEXT
-			tcp->last_dirfd = AT_FDCWD;
+	tcp->last_dirfd = AT_FDCWD;
 #endif
-			nprocs++;
-			debug_msg("new tcb for pid %d, active tcbs:%d",
-				  tcp->pid, nprocs);
-			return tcp;
-		}
-	}
-	error_msg_and_die("bug in alloctcb");
+	nprocs++;
+	debug_msg("new tcb for pid %d, active tcbs:%d",
+		  tcp->pid, nprocs);
+	return tcp;
 }
 
 void *
@@ -1121,6 +1330,25 @@ free_tcb_priv_data(struct tcb *tcp)
 	}
 }
 
+/*
+ * Returns true if a tracee other than the given one belongs to the thread
+ * group.  Only tracees that have looked up their tgid, and the group
+ * leader, are taken into account.
+ */
+bool
+is_tgid_traced(const int tgid, const struct tcb *except)
+{
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		const struct tcb *tcp = tcbtab[i];
+
+		if (tcp && tcp != except && tcp->pid
+		    && (tcp->pid == tgid || tcp->tgid == tgid))
+			return true;
+	}
+
+	return false;
+}
+
 static void
 droptcb(struct tcb *tcp)
 {
@@ -1152,15 +1380,26 @@ droptcb(struct tcb *tcp)
 	if (tcp->mmap_cache)
 		tcp->mmap_cache->free_fn(tcp, __func__);
 
+	pidns_forget_tcb(tcp);
+
+	if (decode_io_uring_rings)
+		io_uring_rings_forget_tcb(tcp);
+
+	undelay_tcb(tcp);
+
+	sample_unpause_tcb(tcp);
+
 	nprocs--;
 	debug_msg("dropped tcb for pid %d, %d remain", tcp->pid, nprocs);
 
 	if (tcp->outf) {
 		bool publish = true;
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
 			publish = is_number_in_set(STATUS_DETACHED, status_set);
-			strace_close_memstream(tcp, publish);
-		}
+		if (collapse_repeats)
+			stage_output_flush_repeats(tcp);
+		if (stage_output_active(tcp))
+			stage_output_end(tcp, publish);
 
 		if (output_separately) {
 			if (tcp->curcol != 0 && publish)
@@ -1172,6 +1411,7 @@ droptcb(struct tcb *tcp)
 			flush_tcp_output(tcp);
 		}
 	}
+	stage_output_free(tcp);
 
 	if (current_tcp == tcp)
 		set_current_tcp(NULL);
@@ -1179,8 +1419,16 @@ droptcb(struct tcb *tcp)
 		printing_tcp = NULL;
 
 	list_remove(&tcp->wait_list);
+	forget_pid2tcb(tcp);
 
+	struct tcb_slab *slab = tcp->slab;
+
+	tcbtab[tcp->tcbtab_idx] = NULL;
 	memset(tcp, 0, sizeof(*tcp));
+	tcp->slab = slab;
+	list_insert(&free_tcbs, &tcp->wait_list);
+	if (!--slab->used)
+		++empty_tcb_slabs;
 }
 
 static void
@@ -1193,9 +1441,49 @@ droptcb_verbose(struct tcb *tcp)
 	droptcb(tcp);
 }
 
-/* Returns true when the tracee has to be waited for. */
+void
+print_tracer_stats(FILE *fp)
+{
+	struct timespec now, dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &tracer_stats.start);
+
+	fprintf(fp, "tracees %u\n"
+		"uptime %.6f\n"
+		"syscall-stops %" PRIu64 "\n"
+		"signal-stops %" PRIu64 "\n"
+		"seccomp-bpf %s\n"
+		"output %s\n",
+		nprocs, ts_float(&dt),
+		tracer_stats.syscall_stops, tracer_stats.signal_stops,
+		seccomp_filtering ? "on" : "off",
+		output_paused ? "off" : "on");
+}
+
+/* Makes tracees pick up the current injection settings.  */
+void
+reset_tcb_inject_vecs(void)
+{
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (!tcp)
+			continue;
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			free(tcp->inject_vec[p]);
+			tcp->inject_vec[p] = NULL;
+		}
+	}
+}
+
+/*
+ * Returns true when the tracee has to be waited for.
+ * With PTRACE_SEIZE, the tracees that are likely to be running are
+ * interrupted right away, without trying to detach them first.
+ */
 static bool
-detach_or_interrupt_or_stop(struct tcb *tcp)
+detach_or_interrupt_or_stop(struct tcb *tcp, const bool running)
 {
 	/*
 	 * Linux wrongly insists the child be stopped
@@ -1214,23 +1502,27 @@ detach_or_interrupt_or_stop(struct tcb *tcp)
 	if (tcp->flags & TCB_IGNORE_ONE_SIGSTOP)
 		return true;
 
-	int error = ptrace(PTRACE_DETACH, tcp->pid, 0, 0);
-	if (!error) {
-		/* On a clear day, you can see forever. */
-		return false;
-	}
-	if (errno != ESRCH) {
-		/* Shouldn't happen. */
-		perror_func_msg("ptrace(PTRACE_DETACH,%u)", tcp->pid);
-		return false;
-	}
-	/* ESRCH: process is either not stopped or doesn't exist. */
-	if (my_tkill(tcp->pid, 0) < 0) {
-		if (errno != ESRCH)
+	int error;
+
+	if (!running || !use_seize) {
+		error = ptrace(PTRACE_DETACH, tcp->pid, 0, 0);
+		if (!error) {
+			/* On a clear day, you can see forever. */
+			return false;
+		}
+		if (errno != ESRCH) {
 			/* Shouldn't happen. */
-			perror_func_msg("tkill(%u,0)", tcp->pid);
-		/* else: process doesn't exist. */
-		return false;
+			perror_func_msg("ptrace(PTRACE_DETACH,%u)", tcp->pid);
+			return false;
+		}
+		/* ESRCH: process is either not stopped or doesn't exist. */
+		if (my_tkill(tcp->pid, 0) < 0) {
+			if (errno != ESRCH)
+				/* Shouldn't happen. */
+				perror_func_msg("tkill(%u,0)", tcp->pid);
+			/* else: process doesn't exist. */
+			return false;
+		}
 	}
 	/* Process is not stopped, need to stop it. */
 	if (use_seize) {
@@ -1336,7 +1628,7 @@ detach_interrupted_or_stopped(struct tcb *tcp, int status)
 static void
 detach(struct tcb *tcp)
 {
-	if (!detach_or_interrupt_or_stop(tcp))
+	if (!detach_or_interrupt_or_stop(tcp, false))
 		goto drop;
 
 	/*
@@ -1598,7 +1890,7 @@ startup_attach(void)
 	for (size_t tcbi = 0; tcbi < tcbtabsize; ++tcbi) {
 		tcp = tcbtab[tcbi];
 
-		if (!tcp->pid)
+		if (!tcp)
 			continue;
 
 		/* Is this a process we should attach to, but not yet attached? */
@@ -2341,6 +2633,165 @@ add_path_trace(struct pathtrace *pt, const char *path)
 	pt->count++;
 }
 
+/* The time the current startup phase began.  */
+static struct timespec startup_phase_ts;
+
+/* Reports the time spent in the startup phase that has just ended.  */
+static void
+end_startup_phase(const char *name)
+{
+	struct timespec now, dt;
+
+	if (!debug_flag)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &startup_phase_ts);
+	startup_phase_ts = now;
+	debug_msg("startup phase %s: %.6f seconds", name, ts_float(&dt));
+}
+
+/*
+ * The tracer loop is single-threaded, and a tracee is bound to the thread
+ * that has attached it, so --shards scales tracing of many processes
+ * attached with -p by splitting them between several tracer processes.
+ * Every shard follows the descendants of its own processes, so a child
+ * is traced by the shard of its parent, and writes the -ff output files
+ * of its tracees, which can be merged afterwards with --merge-logs.
+ * The original process does not trace anything: it forwards fatal signals
+ * to the shards and waits for them to finish.
+ */
+struct shard_proc {
+	int tgid;
+	size_t idx;
+};
+
+static int
+shard_proc_cmp(const void *a, const void *b)
+{
+	const struct shard_proc *pa = a;
+	const struct shard_proc *pb = b;
+
+	if (pa->tgid != pb->tgid)
+		return pa->tgid < pb->tgid ? -1 : 1;
+	return (pa->idx > pb->idx) - (pa->idx < pb->idx);
+}
+
+static void
+forward_to_shards(int sig)
+{
+	for (unsigned int i = 0; i < shard_count; ++i)
+		kill(shard_pids[i], sig);
+}
+
+static void ATTRIBUTE_NORETURN
+wait_for_shards(void)
+{
+	static const int fatal_sigs[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+	int rc = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(fatal_sigs); ++i)
+		set_sighandler(fatal_sigs[i], forward_to_shards, NULL);
+
+	for (unsigned int left = shard_count; left; ) {
+		int status;
+		const pid_t pid = wait(&status);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg_and_die("wait");
+		}
+
+		--left;
+		debug_msg("shard %d finished with status %#x", pid, status);
+		if (!rc)
+			rc = WIFEXITED(status) ? WEXITSTATUS(status)
+					       : 0x100 | WTERMSIG(status);
+	}
+
+	if (rc > 0xff) {
+		/* Die the same way the shard has died.  */
+		signal(rc & 0xff, SIG_DFL);
+		raise(rc & 0xff);
+		rc = 0x80 | (rc & 0x7f);
+	}
+
+	exit(rc);
+}
+
+/*
+ * Forks the shards, each of them keeps the tcbs of its own share
+ * of the processes attached with -p, all threads of a process belong
+ * to the same shard.  Returns in the shards only.
+ */
+static void
+fork_shards(void)
+{
+	struct shard_proc *procs = xcalloc(tcbtabsize, sizeof(*procs));
+	unsigned int *shard_of = xcalloc(tcbtabsize, sizeof(*shard_of));
+	size_t n = 0;
+	unsigned int nth = 0;
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		if (!tcbtab[i])
+			continue;
+
+		const int pid = tcbtab[i]->pid;
+		const int tgid = proc_status_get_tgid(get_proc_pid(pid));
+
+		procs[n].tgid = tgid > 0 ? tgid : pid;
+		procs[n].idx = i;
+		++n;
+	}
+
+	qsort(procs, n, sizeof(*procs), shard_proc_cmp);
+
+	for (size_t i = 0; i < n; ++i) {
+		if (i && procs[i].tgid != procs[i - 1].tgid)
+			++nth;
+		shard_of[procs[i].idx] = nth % nshards;
+	}
+
+	free(procs);
+	shard_count = MIN((unsigned int) nshards, nth + 1);
+	if (shard_count <= 1) {
+		free(shard_of);
+		return;
+	}
+
+	shard_pids = xcalloc(shard_count, sizeof(*shard_pids));
+	fflush(NULL);
+
+	for (unsigned int k = 0; k < shard_count; ++k) {
+		const pid_t pid = fork();
+
+		if (pid < 0)
+			perror_msg_and_die("fork");
+
+		if (pid) {
+			shard_pids[k] = pid;
+			continue;
+		}
+
+		strace_tracer_pid = getpid();
+		for (size_t i = 0; i < tcbtabsize; ++i) {
+			if (tcbtab[i] && shard_of[i] != k)
+				droptcb(tcbtab[i]);
+		}
+		debug_msg("shard %u: %u processes", k, nprocs);
+
+		free(shard_of);
+		free(shard_pids);
+		shard_pids = NULL;
+		shard_count = 0;
+		return;
+	}
+
+	free(shard_of);
+	wait_for_shards();
+}
+
 /*
  * Initialization part of main() was eating much stack (~0.5k),
  * which was unused after init.
@@ -2376,6 +2827,9 @@ init(int argc, char *argv[])
 	bool columns_set = false;
 	bool sortby_set = false;
 	bool opt_kill_on_exit = false;
+	const char *blocking_profile_file = NULL;
+	const char *control_socket = NULL;
+	const char *merge_logs_prefix = NULL;
 #ifdef ENABLE_STACKTRACE
 	int stack_trace_frame_limit = 0;
 #endif
@@ -2408,6 +2862,9 @@ init(int argc, char *argv[])
 			(argc > 0 && argv[0] && *argv[0]) ? argv[0] : name;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &startup_phase_ts);
+	tracer_stats.start = startup_phase_ts;
+
 	strace_tracer_pid = getpid();
 
 	os_release = get_os_release();
@@ -2441,6 +2898,7 @@ init(int argc, char *argv[])
 		GETOPT_FOLLOWFORKS,
 		GETOPT_KILL_ON_EXIT,
 		GETOPT_OUTPUT_SEPARATELY,
+		GETOPT_OUTPUT_SEGMENTED,
 		GETOPT_PIDNS_TRANSLATION,
 		GETOPT_SYSCALL_LIMIT,
 		GETOPT_STACK,
@@ -2450,11 +2908,26 @@ init(int argc, char *argv[])
 		GETOPT_STACK_TRACE_FRAME_LIMIT,
 		GETOPT_ALWAYS_SHOW_PID,
 		GETOPT_COLOR,
+		GETOPT_IO_URING_RINGS,
+		GETOPT_FUTEX_PROFILE,
+		GETOPT_BLOCKING_PROFILE,
+		GETOPT_POLL_PROFILE,
+		GETOPT_PROCESS_SUMMARY,
+		GETOPT_FILE_SUMMARY,
+		GETOPT_MERGE_LOGS,
+		GETOPT_PROBE_CACHE,
+		GETOPT_SAMPLE,
+		GETOPT_DUTY_CYCLE,
+		GETOPT_SHARDS,
+		GETOPT_CONTROL,
+		GETOPT_COLLAPSE_REPEATS,
+		GETOPT_OUTPUT_COMPRESS,
 		GETOPT_QUAL_TRACE,
 		GETOPT_QUAL_TRACE_FD,
 		GETOPT_QUAL_ABBREV,
 		GETOPT_QUAL_VERBOSE,
 		GETOPT_QUAL_RAW,
+		GETOPT_QUAL_ENTRY_ONLY,
 		GETOPT_QUAL_SIGNAL,
 		GETOPT_QUAL_STATUS,
 		GETOPT_QUAL_READ,
@@ -2482,6 +2955,8 @@ init(int argc, char *argv[])
 		{ "follow-forks",	no_argument,	   0, GETOPT_FOLLOWFORKS },
 		{ "output-separately",	no_argument,	   0,
 			GETOPT_OUTPUT_SEPARATELY },
+		{ "output-segmented",	no_argument,	   0,
+			GETOPT_OUTPUT_SEGMENTED },
 		{ "help",		no_argument,	   0, 'h' },
 		{ "instruction-pointer", no_argument,      0, 'i' },
 		{ "interruptible",	required_argument, 0, 'I' },
@@ -2518,11 +2993,26 @@ init(int argc, char *argv[])
 		{ "argv0",		required_argument, 0, GETOPT_ARGV0 },
 		{ "always-show-pid",	no_argument,	   0, GETOPT_ALWAYS_SHOW_PID },
 		{ "color",		required_argument, 0, GETOPT_COLOR },
+		{ "io-uring-rings",	no_argument,	   0, GETOPT_IO_URING_RINGS },
+		{ "futex-profile",	no_argument,	   0, GETOPT_FUTEX_PROFILE },
+		{ "blocking-profile",	required_argument, 0, GETOPT_BLOCKING_PROFILE },
+		{ "poll-profile",	no_argument,	   0, GETOPT_POLL_PROFILE },
+		{ "process-summary",	optional_argument, 0, GETOPT_PROCESS_SUMMARY },
+		{ "file-summary",	no_argument,	   0, GETOPT_FILE_SUMMARY },
+		{ "merge-logs",		required_argument, 0, GETOPT_MERGE_LOGS },
+		{ "probe-cache",	optional_argument, 0, GETOPT_PROBE_CACHE },
+		{ "sample",		required_argument, 0, GETOPT_SAMPLE },
+		{ "duty-cycle",		required_argument, 0, GETOPT_DUTY_CYCLE },
+		{ "shards",		required_argument, 0, GETOPT_SHARDS },
+		{ "control",		required_argument, 0, GETOPT_CONTROL },
+		{ "collapse-repeats",	no_argument,	   0, GETOPT_COLLAPSE_REPEATS },
+		{ "output-compress",	required_argument, 0, GETOPT_OUTPUT_COMPRESS },
 		{ "trace",	required_argument, 0, GETOPT_QUAL_TRACE },
 		{ "trace-fds",	required_argument, 0, GETOPT_QUAL_TRACE_FD },
 		{ "abbrev",	required_argument, 0, GETOPT_QUAL_ABBREV },
 		{ "verbose",	required_argument, 0, GETOPT_QUAL_VERBOSE },
 		{ "raw",	required_argument, 0, GETOPT_QUAL_RAW },
+		{ "entry-only",	optional_argument, 0, GETOPT_QUAL_ENTRY_ONLY },
 		{ "signals",	required_argument, 0, GETOPT_QUAL_SIGNAL },
 		{ "status",	required_argument, 0, GETOPT_QUAL_STATUS },
 		{ "read",	required_argument, 0, GETOPT_QUAL_READ },
@@ -2612,6 +3102,9 @@ init(int argc, char *argv[])
 		case GETOPT_OUTPUT_SEPARATELY:
 			output_separately = true;
 			break;
+		case GETOPT_OUTPUT_SEGMENTED:
+			output_segmented = true;
+			break;
 		case 'F':
 			optF = 1;
 			break;
@@ -2665,6 +3158,15 @@ init(int argc, char *argv[])
 						  "(-kk/--stack-trace=source option) "
 						  "are not supported by this "
 						  "build of strace");
+# endif /* USE_LIBDW */
+			} else if (strcmp(optarg, "deferred") == 0) {
+# ifdef USE_LIBDW
+				stack_trace_mode = STACK_TRACE_DEFERRED;
+# else
+				error_msg_and_die("Deferred stack traces "
+						  "(--stack-trace=deferred option) "
+						  "are not supported by this "
+						  "build of strace");
 # endif /* USE_LIBDW */
 			} else
 				error_opt_arg(c, lopt, optarg);
@@ -2827,6 +3329,56 @@ init(int argc, char *argv[])
 			color_mode = (enum color_mode_t) color_mode_raw;
 			break;
 		}
+		case GETOPT_IO_URING_RINGS:
+			io_uring_rings_init();
+			break;
+		case GETOPT_FUTEX_PROFILE:
+			futex_profile_init();
+			break;
+		case GETOPT_BLOCKING_PROFILE:
+			blocking_profile_file = optarg;
+			break;
+		case GETOPT_POLL_PROFILE:
+			poll_profile_init();
+			break;
+		case GETOPT_PROCESS_SUMMARY:
+			if (!process_summary_init(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_FILE_SUMMARY:
+			file_summary_init();
+			break;
+		case GETOPT_MERGE_LOGS:
+			merge_logs_prefix = optarg;
+			break;
+		case GETOPT_PROBE_CACHE:
+			probe_cache_enable(optarg);
+			break;
+		case GETOPT_SAMPLE: {
+			int rate = string_to_uint(optarg);
+			if (rate <= 0)
+				error_opt_arg(c, lopt, optarg);
+			set_sample_rate(rate);
+			break;
+		}
+		case GETOPT_DUTY_CYCLE:
+			if (!set_duty_cycle(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_CONTROL:
+			control_socket = optarg;
+			break;
+		case GETOPT_COLLAPSE_REPEATS:
+			collapse_repeats = true;
+			break;
+		case GETOPT_OUTPUT_COMPRESS:
+			output_compress_init(optarg);
+			break;
+		case GETOPT_SHARDS:
+			nshards = string_to_uint_upto(optarg, MAX_SHARDS);
+			if (nshards <= 0)
+				error_opt_arg(c, lopt, optarg);
+			break;
 		case GETOPT_QUAL_SECONTEXT:
 			qualify_secontext(optarg ? optarg : secontext_qual);
 			break;
@@ -2845,6 +3397,9 @@ init(int argc, char *argv[])
 		case GETOPT_QUAL_RAW:
 			qualify_raw(optarg);
 			break;
+		case GETOPT_QUAL_ENTRY_ONLY:
+			qualify_entry_only(optarg ?: "all");
+			break;
 		case GETOPT_QUAL_SIGNAL:
 			qualify_signals(optarg);
 			break;
@@ -2889,6 +3444,9 @@ init(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (merge_logs_prefix)
+		exit(merge_logs(merge_logs_prefix));
+
 	argv += optind;
 	argc -= optind;
 
@@ -2950,15 +3508,20 @@ init(int argc, char *argv[])
 		qualify_decode_fd(yflag_short == 1 ? yflag_qual : yyflag_qual);
 	}
 
-	if (is_number_in_set(DECODE_PID_COMM, decode_pid_set)) {
+	if (blocking_profile_file)
+		blocking_profile_init(strace_fopen(blocking_profile_file));
+
+	if (is_number_in_set(DECODE_PID_COMM, decode_pid_set)
+	    || blocking_profile || process_summary) {
 		/*
-		 * If --decode-pids=comm option comes after -p, comm fields
-		 * of tcbs are not filled though tcbs are initialized.
-		 * We must fill the fields here.
+		 * If --decode-pids=comm, --blocking-profile,
+		 * or --process-summary option comes
+		 * after -p, comm fields of tcbs are not filled though tcbs
+		 * are initialized.  We must fill the fields here.
 		 */
 		for (size_t i = 0; i < tcbtabsize; ++i) {
 			struct tcb *tcp = tcbtab[i];
-			if (tcp->comm[0] == 0)
+			if (tcp && tcp->comm[0] == 0)
 				maybe_load_task_comm(tcp);
 		}
 	}
@@ -2976,6 +3539,10 @@ init(int argc, char *argv[])
 		}
 	}
 
+	/* --output-segmented is a backend of --output-separately.  */
+	if (output_segmented)
+		output_separately = true;
+
 	if (seccomp_filtering && !followfork) {
 		error_msg("--seccomp-bpf cannot be used without"
 			  " -f/--follow-forks, disabling");
@@ -3064,20 +3631,51 @@ init(int argc, char *argv[])
 #endif
 	}
 
+#ifdef ENABLE_STACKTRACE
+	if (collapse_repeats && stack_trace_mode)
+		error_msg_and_help("--collapse-repeats and -k/--stack-trace"
+				   " are mutually exclusive");
+#endif
+
+	if (nshards > 1) {
+		if (argc || !nprocs)
+			error_msg_and_help("--shards can only be used"
+					   " with -p/--attach");
+		if (!output_separately || !outfname
+		    || outfname[0] == '|' || outfname[0] == '!')
+			error_msg_and_help("--shards requires"
+					   " -ff/--output-separately"
+					   " and -o/--output FILE");
+		if (output_segmented)
+			error_msg_and_help("--shards and --output-segmented"
+					   " are mutually exclusive");
+		if (control_socket)
+			error_msg_and_help("--shards and --control"
+					   " are mutually exclusive");
+	}
+
+	if (output_compress) {
+		if (!outfname || outfname[0] == '|' || outfname[0] == '!')
+			error_msg_and_help("--output-compress requires"
+					   " -o/--output FILE");
+		if (output_segmented)
+			error_msg_and_help("--output-compress and"
+					   " --output-segmented are mutually"
+					   " exclusive");
+	}
+
 	if (!outfname) {
 		if (output_separately && !followfork)
 			error_msg("--output-separately has no effect "
 				  "without -o/--output");
+		if (output_segmented)
+			error_msg("--output-segmented has no effect "
+				  "without -o/--output");
 		if (open_append)
 			error_msg("-A/--output-append-mode has no effect "
 				  "without -o/--output");
 	}
 
-#ifndef HAVE_OPEN_MEMSTREAM
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-		error_msg_and_help("open_memstream is required to use -z, -Z, or -e status");
-#endif
-
 	if (zflags > 1)
 		error_msg("Only the last of "
 			  "-z/--successful-only/-Z/--failed-only options will "
@@ -3140,6 +3738,8 @@ init(int argc, char *argv[])
 				     PTRACE_O_TRACEFORK |
 				     PTRACE_O_TRACEVFORK;
 
+	end_startup_phase("options");
+
 	if (seccomp_filtering)
 		check_seccomp_filter();
 	if (seccomp_filtering) {
@@ -3163,6 +3763,7 @@ init(int argc, char *argv[])
 	if (inject_set)
 		test_ptrace_set_syscall_info();
 	test_ptrace_get_syscall_info();
+	end_startup_phase("probes");
 
 	/*
 	 * Is something weird with our stdin and/or stdout -
@@ -3177,6 +3778,12 @@ init(int argc, char *argv[])
 	 */
 	ensure_standard_fds_opened();
 
+	if (nshards > 1)
+		fork_shards();
+
+	if (control_socket)
+		control_init(control_socket);
+
 	/* Check if they want to redirect the output. */
 	if (outfname) {
 		/* See if they want to pipe the output. */
@@ -3191,7 +3798,9 @@ init(int argc, char *argv[])
 						   "are mutually exclusive");
 			shared_log = strace_popen(outfname + 1);
 		} else if (!output_separately) {
-			shared_log = strace_fopen(outfname);
+			shared_log = strace_fopen_log(outfname);
+		} else if (output_segmented) {
+			segmented_log_init(strace_fopen(outfname), outfname);
 		} else if (strlen(outfname) >= PATH_MAX - sizeof(int) * 3) {
 			errno = ENAMETOOLONG;
 			perror_msg_and_die("%s", outfname);
@@ -3199,6 +3808,7 @@ init(int argc, char *argv[])
 	} else {
 		/* -ff without -o FILE is the same as single -f */
 		output_separately = false;
+		output_segmented = false;
 	}
 
 	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
@@ -3276,13 +3886,9 @@ init(int argc, char *argv[])
 		set_sighandler(SIGTERM, interactive ? interrupt : SIG_IGN, NULL);
 	}
 
-	sigemptyset(&timer_set);
-	sigaddset(&timer_set, SIGALRM);
-	sigprocmask(SIG_BLOCK, &timer_set, NULL);
-	set_sighandler(SIGALRM, timer_sighandler, NULL);
-
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
+	end_startup_phase("startup");
 
 	/* Do we want pids printed in our -o OUTFILE?
 	 * -ff: no (every pid has its own file); or
@@ -3301,10 +3907,6 @@ pid2tcb(const int pid)
 	if (pid <= 0)
 		return NULL;
 
-#define PID2TCB_CACHE_SIZE 1024U
-#define PID2TCB_CACHE_MASK (PID2TCB_CACHE_SIZE - 1)
-
-	static struct tcb *pid2tcb_cache[PID2TCB_CACHE_SIZE];
 	struct tcb **const ptcp = &pid2tcb_cache[pid & PID2TCB_CACHE_MASK];
 	struct tcb *tcp = *ptcp;
 
@@ -3313,7 +3915,7 @@ pid2tcb(const int pid)
 
 	for (size_t i = 0; i < tcbtabsize; ++i) {
 		tcp = tcbtab[i];
-		if (tcp->pid == pid)
+		if (tcp && tcp->pid == pid)
 			return *ptcp = tcp;
 	}
 
@@ -3371,6 +3973,37 @@ print_debug_info(const int pid, int status)
 	error_msg("[wait(0x%06x) = %u] %s%s", status, pid, buf, evbuf);
 }
 
+/*
+ * The tracee with a second reaped ptrace-stop, it is handled after
+ * the one that is already queued.
+ */
+static struct tcb *extra_tcp;
+
+/*
+ * Returns true if the tracee has a ptrace-stop that has been reaped
+ * but not handled yet.
+ */
+static bool
+has_unhandled_stop(const struct tcb *tcp)
+{
+	return !list_is_empty(&tcp->wait_list) || syscall_delayed(tcp)
+	       || tcp == current_tcp || tcp == extra_tcp;
+}
+
+struct detach_wait {
+	int pid;
+	struct tcb *tcp;
+};
+
+static int
+detach_wait_cmp(const void *a, const void *b)
+{
+	const int pid_a = ((const struct detach_wait *) a)->pid;
+	const int pid_b = ((const struct detach_wait *) b)->pid;
+
+	return (pid_a > pid_b) - (pid_a < pid_b);
+}
+
 static void
 cleanup(int fatal_sig)
 {
@@ -3380,26 +4013,57 @@ cleanup(int fatal_sig)
 	if (!fatal_sig)
 		fatal_sig = SIGTERM;
 
+	struct timespec start_ts, end_ts;
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+
+	const unsigned int num_tracees = nprocs;
+	struct detach_wait *waits = xcalloc(tcbtabsize + 1, sizeof(*waits));
+	size_t num_waits = 0;
 	size_t num_to_wait = 0;
 
-	for (size_t i = 0; i < tcbtabsize; ++i) {
-		struct tcb *tcp = tcbtab[i];
-		if (!tcp->pid)
-			continue;
-		debug_func_msg("looking at pid %u", tcp->pid);
-		if (tcp->pid == strace_child) {
-			kill(tcp->pid, SIGCONT);
-			kill(tcp->pid, fatal_sig);
+	/*
+	 * The tracees with a ptrace-stop that has not been handled yet are
+	 * detached first, the rest are interrupted all at once, so that
+	 * the whole group of tracees is not frozen while they are detached
+	 * one by one.
+	 */
+	for (unsigned int pass = 0; pass < 2; ++pass) {
+		for (size_t i = 0; i < tcbtabsize; ++i) {
+			struct tcb *tcp = tcbtab[i];
+			if (!tcp)
+				continue;
+
+			const bool running = !has_unhandled_stop(tcp);
+			if (running != pass)
+				continue;
+
+			debug_func_msg("looking at pid %u", tcp->pid);
+			if (tcp->pid == strace_child) {
+				kill(tcp->pid, SIGCONT);
+				kill(tcp->pid, fatal_sig);
+			}
+			if (detach_or_interrupt_or_stop(tcp, running)) {
+				waits[num_waits].pid = tcp->pid;
+				waits[num_waits].tcp = tcp;
+				++num_waits;
+			} else {
+				droptcb_verbose(tcp);
+			}
 		}
-		if (detach_or_interrupt_or_stop(tcp))
-			++num_to_wait;
-		else
-			droptcb_verbose(tcp);
 	}
 
+	qsort(waits, num_waits, sizeof(*waits), detach_wait_cmp);
+	num_to_wait = num_waits;
+
+	/*
+	 * Block for the first stop only, then handle all the stops
+	 * that have been reported by the time.
+	 */
+	int wait_flags = __WALL;
+
 	while (num_to_wait) {
 		int status;
-		pid_t pid = waitpid(-1, &status, __WALL);
+		pid_t pid = waitpid(-1, &status, wait_flags);
 
 		if (pid < 0) {
 			if (errno == EINTR)
@@ -3409,6 +4073,12 @@ cleanup(int fatal_sig)
 			break;
 		}
 
+		if (pid == 0) {
+			wait_flags = __WALL;
+			continue;
+		}
+		wait_flags = __WALL | WNOHANG;
+
 		if (pid == popen_pid) {
 			if (!WIFSTOPPED(status))
 				popen_pid = 0;
@@ -3418,7 +4088,11 @@ cleanup(int fatal_sig)
 		if (debug_flag)
 			print_debug_info(pid, status);
 
-		struct tcb *tcp = pid2tcb(pid);
+		const struct detach_wait key = { .pid = pid };
+		struct detach_wait *w = bsearch(&key, waits, num_waits,
+						sizeof(*waits),
+						detach_wait_cmp);
+		struct tcb *tcp = w ? w->tcp : NULL;
 		if (!tcp) {
 			if (!is_number_in_set(QUIET_EXIT, quiet_set)) {
 				/*
@@ -3432,9 +4106,22 @@ cleanup(int fatal_sig)
 
 		if (detach_interrupted_or_stopped(tcp, status)) {
 			droptcb_verbose(tcp);
+			w->tcp = NULL;
 			--num_to_wait;
 		}
 	}
+
+	free(waits);
+
+	clock_gettime(CLOCK_MONOTONIC, &end_ts);
+	if (num_tracees > 1 && !is_number_in_set(QUIET_ATTACH, quiet_set)) {
+		struct timespec dt;
+
+		ts_sub(&dt, &end_ts, &start_ts);
+		error_msg("Detached %u processes in %lld.%06ld seconds",
+			  num_tracees, (long long) dt.tv_sec,
+			  (long) dt.tv_nsec / 1000);
+	}
 }
 
 static void
@@ -3523,20 +4210,22 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 		 * Another case is demonstrated by
 		 * tests/maybe_switch_current_tcp.c
 		 */
-		fprintf(execve_thread->outf, " <pid changed to %d ...>\n", pid);
+		char buf[sizeof(" <pid changed to  ...>\n") + sizeof(int) * 3];
+		xsprintf(buf, " <pid changed to %d ...>\n", pid);
+		if (stage_output_active(execve_thread))
+			stage_output_write(execve_thread, buf, strlen(buf));
+		else
+			fputs_unlocked(buf, execve_thread->outf);
 		/*execve_thread->curcol = 0; - no need, see code below */
 	}
-	/* Swap output FILEs and memstream (needed for -ff) */
+	/* Swap output FILEs and staged output (needed for -ff) */
 	FILE *fp = execve_thread->outf;
 	execve_thread->outf = tcp->outf;
 	tcp->outf = fp;
-	if (execve_thread->staged_output_data || tcp->staged_output_data) {
-		struct staged_output_data *staged_output_data;
-
-		staged_output_data = execve_thread->staged_output_data;
-		execve_thread->staged_output_data = tcp->staged_output_data;
-		tcp->staged_output_data = staged_output_data;
-	}
+	struct staged_output_data *staged_output_data =
+		execve_thread->staged_output_data;
+	execve_thread->staged_output_data = tcp->staged_output_data;
+	tcp->staged_output_data = staged_output_data;
 
 	/* And their column positions */
 	execve_thread->curcol = tcp->curcol;
@@ -3555,12 +4244,16 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 			line_ended();
 		}
 		/*
-		 * Need to reopen memstream for thread
-		 * as we closed it in droptcb.
+		 * Need to restart output staging for thread
+		 * as we ended it in droptcb, unless the execve syscall
+		 * has been printed entirely on entering.
 		 */
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-			strace_open_memstream(tcp);
-		tcp->flags |= TCB_REPRINT;
+		if (!(tcp->flags & TCB_ENTRY_ONLY)) {
+			if (!is_complete_set(status_set, NUMBER_OF_STATUSES)
+			    || collapse_repeats)
+				stage_output_begin(tcp);
+			tcp->flags |= TCB_REPRINT;
+		}
 	}
 
 	return tcp;
@@ -3668,6 +4361,9 @@ startup_tcb(struct tcb *tcp)
 	if (cflag) {
 		tcp->atime = tcp->stime;
 	}
+
+	if (process_summary)
+		process_summary_start(tcp);
 }
 
 static void
@@ -3679,7 +4375,7 @@ print_event_exit(struct tcb *tcp)
 	}
 
 	if (!output_separately && printing_tcp && printing_tcp != tcp
-	    && printing_tcp->curcol != 0 && !printing_tcp->staged_output_data) {
+	    && printing_tcp->curcol != 0 && !stage_output_active(printing_tcp)) {
 		set_current_tcp(printing_tcp);
 		tprint_space();
 		tprints_string("<unfinished ...>");
@@ -3708,9 +4404,10 @@ print_event_exit(struct tcb *tcp)
 	tprint_sysret_pseudo_rval();
 	tprint_sysret_end();
 	tprint_newline();
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
-		bool publish = is_number_in_set(STATUS_UNFINISHED, status_set);
-		strace_close_memstream(tcp, publish);
+	if (stage_output_active(tcp)) {
+		bool publish = is_complete_set(status_set, NUMBER_OF_STATUSES)
+			       || is_number_in_set(STATUS_UNFINISHED, status_set);
+		stage_output_end(tcp, publish);
 	}
 	line_ended();
 }
@@ -3753,6 +4450,83 @@ tcb_wait_tab_check_size(const size_t size)
 	}
 }
 
+/*
+ * Waits for a tracee event like wait4(-1, status, __WALL, ru) does,
+ * restarting the delayed tracees when the delay timer expires,
+ * and resuming the paused tracees when the duty cycle timer expires.
+ * Fails with EINTR after handling an expiration of either timer.
+ * Commands from the control socket are served while waiting, and
+ * compressed output is synced when it is due.
+ */
+static int
+wait4_or_timers(int *status, struct rusage *ru)
+{
+	static int sigchld_fd = -1;
+
+	if (sigchld_fd < 0) {
+		/*
+		 * SIGCHLD is blocked from now on, so that every tracee
+		 * event that happens after wait4(WNOHANG) makes
+		 * sigchld_fd readable.  After the tracing loop starts,
+		 * strace forks no children that could inherit the signal
+		 * mask except the --control expression validator, which
+		 * unblocks SIGCHLD.
+		 */
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigprocmask(SIG_BLOCK, &mask, NULL);
+
+		sigchld_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+		if (sigchld_fd < 0)
+			perror_msg_and_die("signalfd");
+	}
+
+	for (;;) {
+		int pid = wait4(-1, status, __WALL | WNOHANG, ru);
+		if (pid)
+			return pid;
+
+		struct pollfd fds[] = {
+			{ .fd = sigchld_fd, .events = POLLIN },
+			{ .fd = get_delay_timer_fd(), .events = POLLIN },
+			{ .fd = get_sample_timer_fd(), .events = POLLIN },
+			{ .fd = control_get_fd(), .events = POLLIN },
+		};
+
+		if (poll(fds, ARRAY_SIZE(fds), output_compress_timeout()) < 0) {
+			if (errno != EINTR)
+				perror_msg_and_die("poll");
+			return -1;
+		}
+
+		output_compress_tick();
+
+		if (fds[0].revents & POLLIN) {
+			struct signalfd_siginfo si[16];
+
+			while (read(sigchld_fd, si, sizeof(si)) > 0)
+				;
+		}
+
+		if (fds[3].revents & (POLLIN | POLLHUP | POLLERR))
+			control_handle();
+
+		if (fds[2].revents & POLLIN)
+			resume_sampled_tcbs();
+
+		if (fds[1].revents & POLLIN) {
+			if (!restart_delayed_tcbs())
+				restart_failed = true;
+		}
+
+		if ((fds[1].revents | fds[2].revents) & POLLIN) {
+			errno = EINTR;
+			return -1;
+		}
+	}
+}
+
 static const struct tcb_wait_data *
 next_event(void)
 {
@@ -3776,7 +4550,6 @@ next_event(void)
 	if (!list_is_empty(&pending_tcps))
 		goto next_event_get_tcp;
 
-	static struct tcb *extra_tcp;
 	static size_t wait_extra_data_idx;
 	/* Handle the extra tcb event.  */
 	if (extra_tcp) {
@@ -3809,44 +4582,35 @@ next_event(void)
 			return NULL;
 	}
 
-	const bool unblock_delay_timer = is_delay_timer_armed();
+	/* No tcbs are referenced between the rounds of event processing.  */
+	tidy_tcbs();
 
-	/*
-	 * The window of opportunity to handle expirations
-	 * of the delay timer opens here.
-	 *
-	 * Unblock the signal handler for the delay timer
-	 * iff the delay timer is already created.
-	 */
-	if (unblock_delay_timer)
-		sigprocmask(SIG_UNBLOCK, &timer_set, NULL);
+	if (output_segmented)
+		segmented_log_flush();
+	if (output_compress)
+		output_compress_tick();
 
-	/*
-	 * If the delay timer has expired, then its expiration
-	 * has been handled already by the signal handler.
-	 *
-	 * If the delay timer expires during wait4(),
-	 * then the system call will be interrupted and
-	 * the expiration will be handled by the signal handler.
-	 */
 	int status;
 	struct rusage ru;
-	int pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
-	int wait_errno = errno;
+	int pid;
 
 	/*
-	 * The window of opportunity to handle expirations
-	 * of the delay timer closes here.
-	 *
-	 * Block the signal handler for the delay timer
-	 * iff it was unblocked earlier.
+	 * If there are delayed or paused tracees, wait for either
+	 * a new event or an expiration of the corresponding timer.
+	 * The same wait serves the control socket and syncs compressed
+	 * output.
 	 */
-	if (unblock_delay_timer) {
-		sigprocmask(SIG_BLOCK, &timer_set, NULL);
-
+	if (is_delay_timer_armed() || is_sample_timer_armed()
+	    || control_get_fd() >= 0 || output_compress) {
+		pid = wait4_or_timers(&status,
+				      (cflag || process_summary) ? &ru : NULL);
 		if (restart_failed)
 			return NULL;
+	} else {
+		pid = wait4(-1, &status, __WALL,
+			    (cflag || process_summary) ? &ru : NULL);
 	}
+	int wait_errno = errno;
 
 	size_t wait_tab_pos = 0;
 	bool wait_nohang = false;
@@ -3900,6 +4664,9 @@ next_event(void)
 			tcp->stime.tv_nsec = ru.ru_stime.tv_usec * 1000;
 		}
 
+		if (process_summary && !WIFSTOPPED(status))
+			process_summary_exited(tcp, status, &ru);
+
 		tcb_wait_tab_check_size(wait_tab_pos);
 
 		/* Initialise a new wait data structure.  */
@@ -4013,7 +4780,8 @@ next_event(void)
 			break;
 
 next_event_wait_next:
-		pid = wait4(-1, &status, __WALL | WNOHANG, (cflag ? &ru : NULL));
+		pid = wait4(-1, &status, __WALL | WNOHANG,
+			    (cflag || process_summary) ? &ru : NULL);
 		wait_errno = errno;
 		wait_nohang = true;
 	}
@@ -4119,6 +4887,7 @@ dispatch_event(const struct tcb_wait_data *wd)
 		ATTRIBUTE_FALLTHROUGH;
 
 	case TE_SYSCALL_STOP:
+		++tracer_stats.syscall_stops;
 		if (trace_syscall(current_tcp, &restart_sig) < 0) {
 			/*
 			 * ptrace() failed in trace_syscall().
@@ -4172,6 +4941,7 @@ dispatch_event(const struct tcb_wait_data *wd)
 		break;
 
 	case TE_SIGNAL_DELIVERY_STOP:
+		++tracer_stats.signal_stops;
 		restart_sig = WSTOPSIG(status);
 		print_stopped(current_tcp, &wd->si, restart_sig);
 		break;
@@ -4212,7 +4982,8 @@ dispatch_event(const struct tcb_wait_data *wd)
 		 * and all the following syscall state tracking is screwed up
 		 * otherwise.
 		 */
-		if (!maybe_switch_current_tcp() && entering(current_tcp)) {
+		if (!maybe_switch_current_tcp() && entering(current_tcp)
+		    && !(current_tcp->flags & TCB_ENTRY_ONLY)) {
 			int ret;
 
 			error_msg("Stray PTRACE_EVENT_EXEC from pid %d"
@@ -4229,6 +5000,13 @@ dispatch_event(const struct tcb_wait_data *wd)
 			}
 		}
 
+		/*
+		 * The address space has been replaced.  The exit of execve
+		 * is not seen if the tracee is detached below, so let
+		 * the mmap clients know now.
+		 */
+		mmap_notify_report(current_tcp, false);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -4259,6 +5037,18 @@ dispatch_event(const struct tcb_wait_data *wd)
 		return true;
 	}
 
+	/*
+	 * Outside of the duty cycle window, let the tracee run without
+	 * syscall stops until resume_sampled_tcbs interrupts it.
+	 * This is possible only between syscalls, and only if the tracee
+	 * has no seccomp filter that would stop it anyway.
+	 */
+	sample_unpause_tcb(current_tcp);
+	if (restart_op == PTRACE_SYSCALL && duty_cycle_enabled() && use_seize
+	    && entering(current_tcp) && !has_seccomp_filter(current_tcp)
+	    && sample_pause_tcb(current_tcp))
+		restart_op = PTRACE_CONT;
+
 	if (ptrace_restart(restart_op, current_tcp, restart_sig) < 0) {
 		/* Note: ptrace_restart emitted error message */
 		exit_code = 1;
@@ -4298,55 +5088,60 @@ restart_delayed_tcb(struct tcb *const tcp)
 static bool
 restart_delayed_tcbs(void)
 {
-	struct tcb *tcp_next = NULL;
 	struct timespec ts_now;
+	struct tcb *tcp;
 
+	delay_timer_expired();
 	clock_gettime(CLOCK_MONOTONIC, &ts_now);
 
-	for (size_t i = 0; i < tcbtabsize; i++) {
-		struct tcb *tcp = tcbtab[i];
-
-		if (tcp->pid && syscall_delayed(tcp)) {
-			if (ts_cmp(&ts_now, &tcp->delay_expiration_time) > 0) {
-				if (!restart_delayed_tcb(tcp))
-					return false;
-			} else {
-				/* Check whether this tcb is the next.  */
-				if (!tcp_next ||
-				    ts_cmp(&tcp_next->delay_expiration_time,
-					   &tcp->delay_expiration_time) > 0) {
-					tcp_next = tcp;
-				}
-			}
-		}
+	while ((tcp = pop_expired_delayed_tcb(&ts_now))) {
+		if (!restart_delayed_tcb(tcp))
+			return false;
 	}
 
-	if (tcp_next)
-		arm_delay_timer(tcp_next);
-
 	return true;
 }
 
 /*
- * As this signal handler does a lot of work that is not suitable
- * for signal handlers, extra care must be taken to ensure that
- * it is enabled only in those places where it's safe.
+ * Interrupts the tracees paused outside of the duty cycle window,
+ * they are restarted with PTRACE_SYSCALL after the PTRACE_INTERRUPT-stop.
  */
 static void
-timer_sighandler(int sig)
+resume_sampled_tcbs(void)
 {
-	delay_timer_expired();
+	struct tcb *tcp;
 
-	if (restart_failed)
-		return;
+	sample_timer_expired();
 
-	int saved_errno = errno;
+	while ((tcp = sample_pop_paused_tcb())) {
+		if (ptrace(PTRACE_INTERRUPT, tcp->pid, 0L, 0L) < 0
+		    && errno != ESRCH)
+			perror_msg("PTRACE_INTERRUPT pid:%d", tcp->pid);
+	}
+}
 
-	if (!restart_delayed_tcbs())
-		restart_failed = 1;
+#ifdef ENABLE_STACKTRACE
+/*
+ * Prints the stacks recorded in deferred mode.  With -ff, the stacks
+ * are written to FILE.stacks next to the FILE.PID files that refer to them.
+ */
+static void
+print_deferred_stacks(void)
+{
+	if (!output_separately) {
+		unwind_print_deferred(shared_log);
+		return;
+	}
 
-	errno = saved_errno;
+	char name[PATH_MAX];
+	xsprintf(name, "%s.stacks", outfname);
+
+	FILE *fp = strace_fopen(name);
+	unwind_print_deferred(fp);
+	if (fclose(fp))
+		perror_msg("%s", name);
 }
+#endif
 
 static void ATTRIBUTE_NORETURN
 terminate(void)
@@ -4354,8 +5149,32 @@ terminate(void)
 	int sig = interrupted;
 
 	cleanup(sig);
-	if (cflag)
+	if (cflag) {
 		call_summary(shared_log);
+		if (decode_io_uring_rings)
+			io_uring_rings_summary(shared_log);
+	}
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_run_stats)
+		kvm_run_stats_summary(shared_log);
+#endif
+	if (futex_profile)
+		futex_profile_summary(shared_log);
+	if (poll_profile)
+		poll_profile_summary(shared_log);
+	if (process_summary)
+		process_summary_summary(shared_log);
+	if (file_summary)
+		file_summary_summary(shared_log);
+	if (blocking_profile)
+		blocking_profile_summary();
+	if (output_segmented)
+		segmented_log_finish();
+	control_finish();
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_mode == STACK_TRACE_DEFERRED)
+		print_deferred_stacks();
+#endif
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
@@ -22,6 +22,7 @@
 #include "number_set.h"
 #include "delay.h"
 #include "poke.h"
+#include "sample.h"
 #include "retval.h"
 #include <limits.h>
 #include <fcntl.h>
@@ -617,9 +618,69 @@ syscall_entering_decode(struct tcb *tcp)
 	return 1;
 }
 
+/*
+ * Returns true if the syscall is to be printed on entering only,
+ * and its exit is of no interest to strace.
+ */
+static bool
+syscall_entry_only(const struct tcb *tcp)
+{
+	return entry_only(tcp) && !cflag && !check_exec_syscall(tcp)
+	       && !((tcp_sysent(tcp)->sys_flags & COMM_CHANGE)
+		    && is_number_in_set(DECODE_PID_COMM, decode_pid_set))
+	       && !(decode_io_uring_rings
+		    && tcp_sysent(tcp)->sen == SEN_io_uring_enter)
+	       && !syscall_tampered(tcp)
+	       && !inject_delay_exit(tcp) && !inject_poke_exit(tcp);
+}
+
+static void
+print_syscall_entry_only(struct tcb *tcp, int res)
+{
+	if (!(res & RVAL_DECODED)) {
+		/*
+		 * The decoder is going to print the rest
+		 * on exiting syscall, which is not going to be traced.
+		 */
+		tprint_space();
+		tprints_string("<unfinished ...>");
+	}
+
+	tprint_arg_end();
+	tprint_space();
+	tabto();
+	tprint_sysret_begin();
+	tprints_sysret_next("retval");
+	tprint_sysret_pseudo_rval();
+	tprint_sysret_end();
+	tprint_newline();
+	if (stage_output_active(tcp)) {
+		bool publish = is_complete_set(status_set, NUMBER_OF_STATUSES)
+			       || is_number_in_set(STATUS_UNFINISHED, status_set);
+		stage_output_end(tcp, publish);
+	}
+	line_ended();
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_mode)
+		unwind_tcb_print(tcp);
+#endif
+
+	if (syscall_limit != -1)
+		syscall_limit--;
+
+	/* The result is not going to be seen, invalidate the clients.  */
+	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+		mmap_notify_report(tcp, false);
+
+	tcp->flags |= TCB_ENTRY_ONLY;
+}
+
 int
 syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 {
+	tcp->flags &= ~TCB_ENTRY_ONLY;
+
 	if (hide_log(tcp)) {
 		/*
 		 * Restrain from fault injection
@@ -643,7 +704,18 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 		}
 	}
 
-	if (hide_log(tcp) || !traced(tcp)
+	/*
+	 * The process tree and the KVM_RUN statistics are built
+	 * from untraced syscalls, too.
+	 */
+	if (process_summary)
+		process_summary_entering(tcp);
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_run_stats)
+		kvm_run_stats_entering(tcp);
+#endif
+
+	if (hide_log(tcp) || !traced(tcp) || output_paused
 	    || ((tracing_paths || tracing_fds) && !pathtrace_match(tcp))) {
 		tcp->flags |= TCB_FILTERED;
 		return 0;
@@ -651,9 +723,31 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 
 	tcp->flags &= ~TCB_FILTERED;
 
+	if (sampling_enabled() && !inject(tcp) && !check_exec_syscall(tcp)
+	    && !sample_syscall(tcp)) {
+		tcp->flags |= TCB_FILTERED;
+		/*
+		 * With seccomp-bpf filtering, skip the syscall exit
+		 * the same way as for entry-only syscalls.
+		 */
+		if (has_seccomp_filter(tcp)) {
+			if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+				mmap_notify_report(tcp, false);
+			tcp->flags |= TCB_ENTRY_ONLY;
+		}
+		return 0;
+	}
+
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
+	if (decode_io_uring_rings)
+		io_uring_rings_entering(tcp);
+	if (futex_profile)
+		futex_profile_entering(tcp);
+	if (poll_profile)
+		poll_profile_entering(tcp);
+
 	if (cflag == CFLAG_ONLY_STATS) {
 		return 0;
 	}
@@ -663,14 +757,19 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 		unwind_tcb_capture(tcp);
 #endif
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-		strace_open_memstream(tcp);
+	if (!is_complete_set(status_set, NUMBER_OF_STATUSES) || collapse_repeats)
+		stage_output_begin(tcp);
 
 	printleader(tcp);
 	tprints_arg_begin(tcp_sysent(tcp)->sys_name);
 	int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
 	STRACE_PRINT_COLOR_SEQ(COLOR_RESET);
-	fflush(tcp->outf);
+	if (syscall_entry_only(tcp))
+		print_syscall_entry_only(tcp, res);
+	if (output_compress)
+		output_compress_flush_later();
+	else
+		fflush(tcp->outf);
 	return res;
 }
 
@@ -681,7 +780,8 @@ syscall_entering_finish(struct tcb *tcp, int res)
 	tcp->sys_func_rval = res;
 
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || blocking_profile || file_summary)
+	    && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
 
 	/* Start tracking system time */
@@ -700,6 +800,20 @@ syscall_entering_finish(struct tcb *tcp, int res)
 
 		tcp->ltime = tcp->stime;
 	}
+
+	if (tcp->flags & TCB_ENTRY_ONLY) {
+		/*
+		 * With seccomp-bpf filtering, the tracee is going to be
+		 * restarted with PTRACE_CONT, so there will be no
+		 * syscall-exit-stop, and the next syscall stop is going
+		 * to be the entry of the next traced syscall.
+		 * Otherwise, the syscall exit is processed silently.
+		 */
+		if (has_seccomp_filter(tcp))
+			syscall_exiting_finish(tcp);
+		else
+			tcp->flags |= TCB_FILTERED;
+	}
 }
 
 /* Returns:
@@ -714,18 +828,39 @@ int
 syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
 	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || blocking_profile || file_summary)
+	    && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, pts);
 
-	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
-		mmap_notify_report(tcp);
-
 	if ((tcp_sysent(tcp)->sys_flags & COMM_CHANGE) && !syserror(tcp) &&
 	    (tcp_sysent(tcp)->sen != SEN_prctl || tcp->u_arg[0] == PR_SET_NAME))
 		maybe_load_task_comm(tcp);
 
-	if (filtered(tcp))
+	if (filtered(tcp)) {
+		const bool mm = tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE;
+		const bool uring = decode_io_uring_rings &&
+				   io_uring_rings_syscall(tcp_sysent(tcp)->sen);
+		const bool proc = process_summary &&
+				  process_summary_syscall(tcp_sysent(tcp)->sen);
+		const bool kvm = kvm_run_stats &&
+				 tcp_sysent(tcp)->sen == SEN_ioctl;
+
+		if (mm || uring || proc || kvm) {
+			const bool ok = get_syscall_result(tcp) == 1;
+
+			if (mm)
+				mmap_notify_report(tcp, ok);
+			if (uring && ok)
+				io_uring_rings_exiting(tcp);
+			if (proc && ok)
+				process_summary_exiting(tcp);
+#ifdef HAVE_LINUX_KVM_H
+			if (kvm && ok)
+				kvm_run_stats_exiting(tcp);
+#endif
+		}
 		return 0;
+	}
 
 	if (check_exec_syscall(tcp)) {
 		/* The check failed, hide the log.  */
@@ -736,7 +871,30 @@ syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 	update_personality(tcp, tcp->currpers);
 #endif
 
-	return get_syscall_result(tcp);
+	int res = get_syscall_result(tcp);
+
+	/* Let the clients see the result of the syscall.  */
+	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+		mmap_notify_report(tcp, res == 1);
+
+	if (decode_io_uring_rings && res == 1)
+		io_uring_rings_exiting(tcp);
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_run_stats && res == 1)
+		kvm_run_stats_exiting(tcp);
+#endif
+	if (futex_profile && res == 1)
+		futex_profile_exiting(tcp);
+	if (poll_profile && res == 1)
+		poll_profile_exiting(tcp);
+	if (blocking_profile)
+		blocking_profile_exiting(tcp, pts);
+	if (process_summary && res == 1)
+		process_summary_exiting(tcp);
+	if (file_summary && res == 1)
+		file_summary_exiting(tcp, pts);
+
+	return res;
 }
 
 void
@@ -751,7 +909,7 @@ print_syscall_resume(struct tcb *tcp)
 	 * "strace -ff -oLOG test/threaded_execve" corner case.
 	 * It's the only case when -ff mode needs reprinting.
 	 */
-	if ((!output_separately && printing_tcp != tcp && !tcp->staged_output_data)
+	if ((!output_separately && printing_tcp != tcp && !stage_output_active(tcp))
 	    || (tcp->flags & TCB_REPRINT)) {
 		tcp->flags &= ~TCB_REPRINT;
 		printleader(tcp);
@@ -818,8 +976,8 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			tprints_string("<unavailable>");
 			tprint_sysret_end();
 			tprint_newline();
-			if (status_filtering)
-				strace_close_memstream(tcp, publish);
+			if (stage_output_active(tcp))
+				stage_output_end(tcp, publish);
 			line_ended();
 		}
 #ifdef ENABLE_STACKTRACE
@@ -847,8 +1005,9 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			       && is_number_in_set(STATUS_FAILED, status_set);
 		publish |= !syserror(tcp)
 			   && is_number_in_set(STATUS_SUCCESSFUL, status_set);
-		if (cflag != CFLAG_ONLY_STATS)
-			strace_close_memstream(tcp, publish);
+		/* Published lines are staged further to collapse repeats.  */
+		if (cflag != CFLAG_ONLY_STATS && (!publish || !collapse_repeats))
+			stage_output_end(tcp, publish);
 		if (!publish) {
 			if (cflag != CFLAG_ONLY_STATS)
 				line_ended();
@@ -1013,6 +1172,7 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		tprints_sysret_string("retstr", tcp->auxstr);
 	print_injected_note(tcp);
 	if (Tflag) {
+		stage_output_skip_begin(tcp);
 		tprints_sysret_next("time");
 		tprint_associated_info_begin();
 		ts_sub(ts, ts, &tcp->etime);
@@ -1022,10 +1182,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 				       (long) ts->tv_nsec / Tflag_scale);
 		}
 		tprint_associated_info_end();
+		stage_output_skip_end(tcp);
 	}
 	tprint_sysret_end();
 	tprint_newline();
 	dumpio(tcp);
+	if (stage_output_active(tcp))
+		stage_output_end(tcp, true);
 	line_ended();
 
 #ifdef ENABLE_STACKTRACE
@@ -16,6 +16,7 @@
 
 #include "defs.h"
 #include "unwind.h"
+#include "list.h"
 #include "mmap_notify.h"
 #include "static_assert.h"
 #include <elfutils/libdwfl.h>
@@ -25,6 +26,8 @@
 static_assert(STRACE_UW_CACHE_SIZE % STRACE_UW_CACHE_ASSOC == 0,
 	     "STRACE_UW_CACHE_SIZE % STRACE_UW_CACHE_ASSOC != 0");
 
+struct module_rec;
+
 struct cache_entry {
 	/* key */
 	Dwarf_Addr pc;
@@ -39,25 +42,89 @@ struct cache_entry {
 	const char *source_filename;
 	int source_line;
 
+	/* deferred mode */
+	const struct module_rec *module;
+
 	/* replacement */
 	unsigned long long last_use;
 };
 
+/*
+ * The unwinding context is per address space: all threads of a thread
+ * group share the same Dwfl and the same pc cache.
+ */
 struct ctx {
+	struct list_item entry;
+	int tgid;
+	unsigned int refcount;
 	Dwfl *dwfl;
+	unsigned long long generation;
 	unsigned long long last_proc_updating;
 	struct cache_entry cache[STRACE_UW_CACHE_SIZE];
 };
 
-static unsigned long long mapping_generation = 1;
+static EMPTY_LIST(ctx_list);
+
+/*
+ * Build IDs of the modules seen so far; symbol cache entries refer
+ * to these by pointer.
+ */
+struct build_id {
+	struct list_item entry;
+	uint64_t hash;
+	size_t len;
+	unsigned char bits[];
+};
+
+static EMPTY_LIST(build_id_list);
+
+/*
+ * Global symbolization cache keyed by (build-id, relocated address),
+ * shared by all traced processes.  The strings are owned by the cache
+ * and live until strace exits, so they are not invalidated by changes
+ * in the mappings of a particular process.
+ */
+struct sym_entry {
+	const struct build_id *build_id;
+	Dwarf_Addr addr;
+
+	const char *symname;
+	GElf_Off off;
+	const char *source_filename;
+	int source_line;
+};
+
+/*
+ * Modules referred to by frames recorded in deferred mode.  They are
+ * reported to a separate offline Dwfl when the frames are symbolized.
+ */
+struct module_rec {
+	struct list_item entry;
+	char *name;
+	const struct build_id *build_id;
+	bool relocatable;
+	bool offline_reported;
+	Dwfl_Module *offline;
+};
+
+static EMPTY_LIST(module_list);
+static Dwfl *offline_dwfl;
+
+static struct sym_entry **sym_cache;
+static size_t sym_cache_size;
+static size_t sym_cache_used;
+
 static unsigned long long uwcache_clock;
 static bool with_srcinfo;
 static int stack_trace_limit;
 
 static void
-update_mapping_generation(struct tcb *tcp, void *unused)
+update_mapping_generation(struct tcb *tcp, bool has_result, void *unused)
 {
-	mapping_generation++;
+	struct ctx *ctx = tcp->unwind_ctx;
+
+	if (ctx)
+		ctx->generation++;
 }
 
 static void
@@ -76,13 +143,23 @@ tcb_init(struct tcb *tcp)
 		.find_debuginfo = dwfl_standard_find_debuginfo
 	};
 
+	const int tgid = get_tcb_tgid(tcp);
+	struct ctx *ctx;
+
+	list_foreach(ctx, &ctx_list, entry) {
+		if (ctx->tgid == tgid) {
+			ctx->refcount++;
+			return ctx;
+		}
+	}
+
 	Dwfl *dwfl = dwfl_begin(&proc_callbacks);
 	if (dwfl == NULL) {
 		error_msg("dwfl_begin: %s", dwfl_errmsg(-1));
 		return NULL;
 	}
 
-	int r = dwfl_linux_proc_attach(dwfl, tcp->pid, true);
+	int r = dwfl_linux_proc_attach(dwfl, tgid, true);
 	if (r) {
 		const char *msg = NULL;
 
@@ -92,15 +169,19 @@ tcb_init(struct tcb *tcp)
 			msg = strerror(r);
 
 		error_msg("dwfl_linux_proc_attach returned an error"
-			  " for process %d: %s", tcp->pid, msg);
+			  " for process %d: %s", tgid, msg);
 		dwfl_end(dwfl);
 		return NULL;
 	}
 
-	struct ctx *ctx = xmalloc(sizeof(*ctx));
+	ctx = xmalloc(sizeof(*ctx));
+	ctx->tgid = tgid;
+	ctx->refcount = 1;
 	ctx->dwfl = dwfl;
-	ctx->last_proc_updating = mapping_generation - 1;
+	ctx->generation = 1;
+	ctx->last_proc_updating = 0;
 	memset(ctx->cache, 0, sizeof(ctx->cache));
+	list_insert(&ctx_list, &ctx->entry);
 	return ctx;
 }
 
@@ -108,7 +189,8 @@ static void
 tcb_fin(struct tcb *tcp)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
-	if (ctx) {
+	if (ctx && !--ctx->refcount) {
+		list_remove(&ctx->entry);
 		dwfl_end(ctx->dwfl);
 		free(ctx);
 	}
@@ -121,7 +203,7 @@ flush_cache_maybe(struct tcb *tcp)
 	if (!ctx)
 		return;
 
-	if (ctx->last_proc_updating == mapping_generation)
+	if (ctx->last_proc_updating == ctx->generation)
 		return;
 
 	int r = dwfl_linux_proc_report(ctx->dwfl, tcp->pid);
@@ -136,7 +218,7 @@ flush_cache_maybe(struct tcb *tcp)
 		error_msg("dwfl_report_end returned an error"
 			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
 
-	ctx->last_proc_updating = mapping_generation;
+	ctx->last_proc_updating = ctx->generation;
 }
 
 struct frame_user_data {
@@ -155,12 +237,12 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	struct cache_entry *lru = ctx->cache + idx;
 	for (unsigned int i = 0; i < STRACE_UW_CACHE_ASSOC; ++i) {
 		struct cache_entry *ce = ctx->cache + (idx + i);
-		if (ce->generation == mapping_generation && ce->pc == pc) {
+		if (ce->generation == ctx->generation && ce->pc == pc) {
 			ce->last_use = uwcache_clock++;
 			*res = ce;
 			return true;
 		}
-		if (ce->generation != mapping_generation) {
+		if (ce->generation != ctx->generation) {
 			unused = ce;
 			continue;
 		}
@@ -172,6 +254,160 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	return false;
 }
 
+static uint64_t
+hash_bytes(const unsigned char *bits, size_t len)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= bits[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static const struct build_id *
+get_build_id(Dwfl_Module *mod)
+{
+	const unsigned char *bits;
+	GElf_Addr vaddr;
+	Dwarf_Addr bias;
+
+	/* The build ID is not known until the ELF file is loaded.  */
+	if (!dwfl_module_getelf(mod, &bias))
+		return NULL;
+
+	int len = dwfl_module_build_id(mod, &bits, &vaddr);
+	if (len <= 0)
+		return NULL;
+
+	const uint64_t hash = hash_bytes(bits, len);
+	struct build_id *bid;
+
+	list_foreach(bid, &build_id_list, entry) {
+		if (bid->hash == hash && bid->len == (size_t) len
+		    && !memcmp(bid->bits, bits, len))
+			return bid;
+	}
+
+	bid = xmalloc(sizeof(*bid) + len);
+	bid->hash = hash;
+	bid->len = len;
+	memcpy(bid->bits, bits, len);
+	list_insert(&build_id_list, &bid->entry);
+	return bid;
+}
+
+static size_t
+sym_cache_slot(const struct build_id *bid, Dwarf_Addr addr)
+{
+	uint64_t h = (bid->hash ^ addr) * 0x9e3779b97f4a7c15ULL;
+	return (h >> 32) & (sym_cache_size - 1);
+}
+
+static struct sym_entry *
+sym_cache_lookup(const struct build_id *bid, Dwarf_Addr addr)
+{
+	if (!sym_cache_size)
+		return NULL;
+
+	for (size_t i = sym_cache_slot(bid, addr); sym_cache[i];
+	     i = (i + 1) & (sym_cache_size - 1)) {
+		struct sym_entry *se = sym_cache[i];
+		if (se->build_id == bid && se->addr == addr)
+			return se;
+	}
+
+	return NULL;
+}
+
+static void
+sym_cache_insert(struct sym_entry *se)
+{
+	if ((sym_cache_used + 1) * 4 > sym_cache_size * 3) {
+		struct sym_entry **old = sym_cache;
+		const size_t old_size = sym_cache_size;
+
+		sym_cache_size = old_size ? old_size * 2 : 1024;
+		sym_cache = xcalloc(sym_cache_size, sizeof(*sym_cache));
+		for (size_t i = 0; i < old_size; ++i) {
+			if (!old[i])
+				continue;
+			size_t j = sym_cache_slot(old[i]->build_id,
+						  old[i]->addr);
+			while (sym_cache[j])
+				j = (j + 1) & (sym_cache_size - 1);
+			sym_cache[j] = old[i];
+		}
+		free(old);
+	}
+
+	size_t i = sym_cache_slot(se->build_id, se->addr);
+	while (sym_cache[i])
+		i = (i + 1) & (sym_cache_size - 1);
+	sym_cache[i] = se;
+	sym_cache_used++;
+}
+
+static void
+symbolize(Dwfl_Module *mod, Dwarf_Addr pc, struct cache_entry *ce)
+{
+	GElf_Sym sym;
+
+	ce->symname = dwfl_module_addrinfo(mod, pc, &ce->off, &sym,
+					   NULL, NULL, NULL);
+	ce->source_filename = NULL;
+	ce->source_line = 0;
+	if (with_srcinfo) {
+		Dwfl_Line *dwfl_line;
+
+		dwfl_line = dwfl_module_getsrc(mod, pc);
+		if (dwfl_line)
+			ce->source_filename =
+				dwfl_lineinfo(dwfl_line, NULL,
+					      &ce->source_line, NULL,
+					      NULL, NULL);
+	}
+}
+
+/*
+ * Fill the cache entry for the given pc, consulting the global
+ * symbolization cache first when the module has a build ID.
+ */
+static void
+fill_cache_entry(Dwfl_Module *mod, Dwarf_Addr pc, struct cache_entry *ce)
+{
+	ce->modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
+				       NULL, NULL, NULL);
+	ce->true_offset = pc;
+	dwfl_module_relocate_address(mod, &ce->true_offset);
+
+	const struct build_id *bid = get_build_id(mod);
+	if (!bid) {
+		symbolize(mod, pc, ce);
+		return;
+	}
+
+	struct sym_entry *se = sym_cache_lookup(bid, ce->true_offset);
+	if (!se) {
+		symbolize(mod, pc, ce);
+
+		se = xmalloc(sizeof(*se));
+		se->build_id = bid;
+		se->addr = ce->true_offset;
+		se->symname = xstrdup(ce->symname);
+		se->off = ce->off;
+		se->source_filename = xstrdup(ce->source_filename);
+		se->source_line = ce->source_line;
+		sym_cache_insert(se);
+	}
+
+	ce->symname = se->symname;
+	ce->off = se->off;
+	ce->source_filename = se->source_filename;
+	ce->source_line = se->source_line;
+}
+
 static int
 frame_callback(Dwfl_Frame *state, void *arg)
 {
@@ -196,42 +432,17 @@ frame_callback(Dwfl_Frame *state, void *arg)
 	} else {
 		Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
 		Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
-		GElf_Off off = 0;
 
 		if (mod != NULL) {
-			const char *modname = NULL;
-			const char *symname = NULL;
-			GElf_Sym sym;
-			Dwarf_Addr true_offset = pc;
-			const char *source_filename = NULL;
-			int source_line = 0;
-
-			modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
-						   NULL, NULL, NULL);
-			symname = dwfl_module_addrinfo(mod, pc, &off, &sym,
-						       NULL, NULL, NULL);
-			dwfl_module_relocate_address(mod, &true_offset);
-			if (with_srcinfo) {
-				Dwfl_Line *dwfl_line;
-
-				dwfl_line = dwfl_module_getsrc(mod, pc);
-				if (dwfl_line)
-					source_filename = dwfl_lineinfo(dwfl_line, NULL,
-									&source_line, NULL,
-									NULL, NULL);
-			}
-			user_data->call_action(user_data->data, modname, symname,
-					       off, true_offset,
-					       source_filename, source_line);
-
-			ce->generation = mapping_generation;
+			fill_cache_entry(mod, pc, ce);
+			user_data->call_action(user_data->data,
+					       ce->modname, ce->symname,
+					       ce->off, ce->true_offset,
+					       ce->source_filename,
+					       ce->source_line);
+
+			ce->generation = user_data->ctx->generation;
 			ce->pc = pc;
-			ce->modname = modname;
-			ce->symname = symname;
-			ce->off = off;
-			ce->true_offset = true_offset;
-			ce->source_filename = source_filename;
-			ce->source_line = source_line;
 			ce->last_use = uwcache_clock++;
 		}
 	}
@@ -243,6 +454,176 @@ frame_callback(Dwfl_Frame *state, void *arg)
 	return DWARF_CB_OK;
 }
 
+static const struct module_rec *
+get_module_rec(Dwfl_Module *mod, const char *name)
+{
+	const struct build_id *bid = get_build_id(mod);
+	struct module_rec *m;
+
+	list_foreach(m, &module_list, entry) {
+		if (m->build_id == bid && !strcmp(m->name, name))
+			return m;
+	}
+
+	m = xzalloc(sizeof(*m));
+	m->name = xstrdup(name);
+	m->build_id = bid;
+	m->relocatable = dwfl_module_relocations(mod) > 0;
+	list_insert(&module_list, &m->entry);
+	return m;
+}
+
+struct raw_frame_user_data {
+	unwind_raw_action_fn raw_action;
+	unwind_error_action_fn error_action;
+	void *data;
+	int stack_depth;
+	struct ctx *ctx;
+};
+
+static int
+raw_frame_callback(Dwfl_Frame *state, void *arg)
+{
+	struct raw_frame_user_data *user_data = arg;
+	Dwarf_Addr pc;
+	bool isactivation;
+
+	if (!dwfl_frame_pc(state, &pc, &isactivation))
+		return -1;
+
+	if (!isactivation)
+		pc--;
+
+	struct cache_entry *ce;
+	if (!find_bucket(user_data->ctx, pc, &ce)) {
+		Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
+		Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
+
+		if (mod == NULL)
+			goto next;
+
+		ce->modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
+					       NULL, NULL, NULL);
+		ce->true_offset = pc;
+		dwfl_module_relocate_address(mod, &ce->true_offset);
+		ce->module = get_module_rec(mod, ce->modname ?: "");
+
+		ce->generation = user_data->ctx->generation;
+		ce->pc = pc;
+		ce->last_use = uwcache_clock++;
+	}
+
+	user_data->raw_action(user_data->data, ce->module, ce->true_offset);
+
+next:
+	if (--user_data->stack_depth == 0)
+		return DWARF_CB_ABORT;
+
+	return DWARF_CB_OK;
+}
+
+static void
+tcb_walk_raw(struct tcb *tcp,
+	     unwind_raw_action_fn raw_action,
+	     unwind_error_action_fn error_action,
+	     void *data)
+{
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (!ctx)
+		return;
+
+	struct raw_frame_user_data user_data = {
+		.raw_action = raw_action,
+		.error_action = error_action,
+		.data = data,
+		.stack_depth = stack_trace_limit,
+		.ctx = ctx,
+	};
+
+	flush_cache_maybe(tcp);
+
+	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, raw_frame_callback,
+				      &user_data);
+	if (r)
+		error_action(data,
+			     r < 0 ? dwfl_errmsg(-1) : "too many stack frames",
+			     0);
+}
+
+static Dwfl_Module *
+report_offline(struct module_rec *m)
+{
+	static const Dwfl_Callbacks offline_callbacks = {
+		.find_elf = dwfl_build_id_find_elf,
+		.find_debuginfo = dwfl_standard_find_debuginfo,
+		.section_address = dwfl_offline_section_address
+	};
+
+	if (m->offline_reported)
+		return m->offline;
+	m->offline_reported = true;
+
+	if (!offline_dwfl) {
+		offline_dwfl = dwfl_begin(&offline_callbacks);
+		if (!offline_dwfl) {
+			error_msg("dwfl_begin: %s", dwfl_errmsg(-1));
+			return NULL;
+		}
+	}
+
+	dwfl_report_begin_add(offline_dwfl);
+	Dwfl_Module *mod = dwfl_report_offline(offline_dwfl, m->name,
+					       m->name, -1);
+	dwfl_report_end(offline_dwfl, NULL, NULL);
+	if (!mod)
+		return NULL;
+
+	/* The file may have been replaced since it was mapped.  */
+	const struct build_id *bid = get_build_id(mod);
+	if (bid != m->build_id)
+		return NULL;
+
+	m->offline = mod;
+	return mod;
+}
+
+static void
+symbolize_deferred(const void *module, unsigned long true_offset,
+		   unwind_call_action_fn call_action,
+		   unwind_error_action_fn error_action,
+		   void *data)
+{
+	struct module_rec *m = (struct module_rec *) module;
+	Dwfl_Module *mod = report_offline(m);
+	struct cache_entry ce = { .true_offset = true_offset };
+
+	if (mod) {
+		Dwarf_Addr pc = true_offset;
+
+		if (m->relocatable) {
+			Dwarf_Addr low;
+
+			dwfl_module_info(mod, NULL, &low, NULL, NULL,
+					 NULL, NULL, NULL);
+			pc += low;
+		}
+
+		struct sym_entry *se = m->build_id
+				       ? sym_cache_lookup(m->build_id,
+							  true_offset)
+				       : NULL;
+		if (se) {
+			ce.symname = se->symname;
+			ce.off = se->off;
+		} else {
+			symbolize(mod, pc, &ce);
+		}
+	}
+
+	call_action(data, m->name, ce.symname, ce.off, ce.true_offset,
+		    NULL, 0);
+}
+
 static void
 tcb_walk(struct tcb *tcp,
 	 unwind_call_action_fn call_action,
@@ -277,4 +658,6 @@ const struct unwind_unwinder_t unwinder = {
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
 	.tcb_walk = tcb_walk,
+	.tcb_walk_raw = tcb_walk_raw,
+	.symbolize = symbolize_deferred,
 };
@@ -32,6 +32,36 @@ struct unwind_queue_t {
 	struct call_t *head;
 };
 
+/*
+ * Types used in deferred stacktrace symbolization
+ */
+struct raw_frame_t {
+	const void *module;
+	unsigned long true_offset;
+	char *error;
+	char *name;	/* Folded frame name, for unwinders without raw walks */
+};
+
+struct raw_stack_t {
+	uint64_t hash;
+	size_t nframes;
+	struct raw_frame_t *frames;
+};
+
+/* The current raw walk.  */
+static struct raw_frame_t *raw_frames;
+static size_t raw_frames_size;
+static size_t raw_frames_count;
+
+/* Unique stacks; stack ID is the index in this array plus one.  */
+static struct raw_stack_t *raw_stacks;
+static size_t raw_stacks_size;
+static size_t raw_stacks_count;
+
+/* Open addressing hash table of stack IDs.  */
+static size_t *raw_stack_index;
+static size_t raw_stack_index_size;
+
 static void queue_drain(struct unwind_queue_t *queue, bool print);
 
 static const char asprintf_error_str[] = "???";
@@ -212,6 +242,8 @@ sprint_call_or_error(const char *binary_filename,
 /*
  * queue manipulators
  */
+static void queue_put_line(struct unwind_queue_t *queue, char *output_line);
+
 static void
 queue_put(struct unwind_queue_t *queue,
 	  const char *binary_filename,
@@ -221,17 +253,23 @@ queue_put(struct unwind_queue_t *queue,
 	  const char *source_filename,
 	  int source_line,
 	  const char *error)
+{
+	queue_put_line(queue, sprint_call_or_error(binary_filename,
+						   symbol_name,
+						   function_offset,
+						   true_offset,
+						   source_filename,
+						   source_line,
+						   error));
+}
+
+static void
+queue_put_line(struct unwind_queue_t *queue, char *output_line)
 {
 	struct call_t *call;
 
 	call = xmalloc(sizeof(*call));
-	call->output_line = sprint_call_or_error(binary_filename,
-						 symbol_name,
-						 function_offset,
-						 true_offset,
-						 source_filename,
-						 source_line,
-						 error);
+	call->output_line = output_line;
 	call->next = NULL;
 
 	if (!queue->head) {
@@ -296,6 +334,338 @@ queue_drain(struct unwind_queue_t *queue, bool print)
 	}
 }
 
+/*
+ * deferred symbolization
+ */
+static struct raw_frame_t *
+raw_frames_put(const void *module, unsigned long true_offset,
+	       const char *error)
+{
+	if (raw_frames_count >= raw_frames_size)
+		raw_frames = xgrowarray(raw_frames, &raw_frames_size,
+					sizeof(*raw_frames));
+
+	struct raw_frame_t *f = &raw_frames[raw_frames_count++];
+	f->module = module;
+	f->true_offset = true_offset;
+	f->error = error ? xstrdup(error) : NULL;
+	f->name = NULL;
+	return f;
+}
+
+static void
+raw_put_call(void *dummy, const void *module, unsigned long true_offset)
+{
+	raw_frames_put(module, true_offset, NULL);
+}
+
+static void
+raw_put_error(void *dummy, const char *error, unsigned long true_offset)
+{
+	raw_frames_put(NULL, true_offset, error);
+}
+
+static uint64_t
+raw_frames_hash(void)
+{
+	uint64_t h = raw_frames_count;
+
+	for (size_t i = 0; i < raw_frames_count; ++i) {
+		h ^= (uintptr_t) raw_frames[i].module;
+		h *= 0x9e3779b97f4a7c15ULL;
+		h ^= raw_frames[i].true_offset;
+		h *= 0x9e3779b97f4a7c15ULL;
+		for (const char *p = raw_frames[i].name; p && *p; ++p) {
+			h ^= (unsigned char) *p;
+			h *= 0x100000001b3ULL;
+		}
+	}
+
+	return h ^ (h >> 29);
+}
+
+static bool
+raw_frames_equal(const struct raw_stack_t *st)
+{
+	if (st->nframes != raw_frames_count)
+		return false;
+
+	for (size_t i = 0; i < raw_frames_count; ++i) {
+		const struct raw_frame_t *a = &st->frames[i];
+		const struct raw_frame_t *b = &raw_frames[i];
+
+		if (a->module != b->module || a->true_offset != b->true_offset)
+			return false;
+		if (!a->error != !b->error)
+			return false;
+		if (a->error && strcmp(a->error, b->error))
+			return false;
+		if (!a->name != !b->name)
+			return false;
+		if (a->name && strcmp(a->name, b->name))
+			return false;
+	}
+
+	return true;
+}
+
+static void
+raw_stack_index_insert(size_t id)
+{
+	const size_t mask = raw_stack_index_size - 1;
+	size_t i = raw_stacks[id - 1].hash & mask;
+
+	while (raw_stack_index[i])
+		i = (i + 1) & mask;
+	raw_stack_index[i] = id;
+}
+
+/*
+ * Look up the stack collected in raw_frames, add it if it is new,
+ * and return its ID.  The frames are either moved to the new stack
+ * or released.
+ */
+static size_t
+raw_stack_intern(void)
+{
+	const uint64_t hash = raw_frames_hash();
+
+	if (raw_stack_index_size) {
+		const size_t mask = raw_stack_index_size - 1;
+
+		for (size_t i = hash & mask; raw_stack_index[i];
+		     i = (i + 1) & mask) {
+			const size_t id = raw_stack_index[i];
+
+			if (raw_stacks[id - 1].hash == hash
+			    && raw_frames_equal(&raw_stacks[id - 1])) {
+				for (size_t j = 0; j < raw_frames_count; ++j) {
+					free(raw_frames[j].error);
+					free(raw_frames[j].name);
+				}
+				raw_frames_count = 0;
+				return id;
+			}
+		}
+	}
+
+	if (raw_stacks_count >= raw_stacks_size)
+		raw_stacks = xgrowarray(raw_stacks, &raw_stacks_size,
+					sizeof(*raw_stacks));
+
+	struct raw_stack_t *st = &raw_stacks[raw_stacks_count++];
+	st->hash = hash;
+	st->nframes = raw_frames_count;
+	st->frames = xmemdup(raw_frames, raw_frames_count * sizeof(*raw_frames));
+	raw_frames_count = 0;
+
+	if ((raw_stacks_count + 1) * 2 > raw_stack_index_size) {
+		free(raw_stack_index);
+		raw_stack_index_size = raw_stack_index_size
+				       ? raw_stack_index_size * 2 : 256;
+		raw_stack_index = xcalloc(raw_stack_index_size,
+					  sizeof(*raw_stack_index));
+		for (size_t id = 1; id <= raw_stacks_count; ++id)
+			raw_stack_index_insert(id);
+	} else {
+		raw_stack_index_insert(raw_stacks_count);
+	}
+
+	return raw_stacks_count;
+}
+
+static char *
+sprint_stack_id(size_t id)
+{
+	char *output_line = NULL;
+
+	if (asprintf(&output_line, " > stack #%zu\n", id) < 0) {
+		perror_func_msg("asprintf");
+		output_line = (char *) asprintf_error_str;
+	}
+
+	return output_line;
+}
+
+static size_t
+walk_raw(struct tcb *tcp)
+{
+	unwinder.tcb_walk_raw(tcp, raw_put_call, raw_put_error, NULL);
+	return raw_stack_intern();
+}
+
+static void
+fprint_call_cb(void *outf,
+	       const char *binary_filename,
+	       const char *symbol_name,
+	       unwind_function_offset_t function_offset,
+	       unsigned long true_offset,
+	       const char *source_filename,
+	       int source_line)
+{
+	char *line = sprint_call_or_error(binary_filename, symbol_name,
+					  function_offset, true_offset,
+					  source_filename, source_line, NULL);
+	fputs(line, outf);
+	if (line != asprintf_error_str)
+		free(line);
+}
+
+static void
+fprint_error_cb(void *outf, const char *error, unsigned long true_offset)
+{
+	char *line = sprint_call_or_error(NULL, NULL, 0, true_offset,
+					  NULL, 0, error);
+	fputs(line, outf);
+	if (line != asprintf_error_str)
+		free(line);
+}
+
+/*
+ * Symbolize all stacks recorded in deferred mode and print them
+ * to the given stream.
+ */
+void
+unwind_print_deferred(FILE *outf)
+{
+	if (!raw_stacks_count)
+		return;
+
+	for (size_t id = 1; id <= raw_stacks_count; ++id) {
+		const struct raw_stack_t *st = &raw_stacks[id - 1];
+
+		fprintf(outf, "stack #%zu:\n", id);
+		for (size_t i = 0; i < st->nframes; ++i) {
+			const struct raw_frame_t *f = &st->frames[i];
+
+			if (f->name)
+				fprintf(outf, " > %s [0x%lx]\n", f->name,
+					f->true_offset);
+			else if (f->error)
+				fprint_error_cb(outf, f->error,
+						f->true_offset);
+			else
+				unwinder.symbolize(f->module, f->true_offset,
+						   fprint_call_cb,
+						   fprint_error_cb, outf);
+		}
+	}
+}
+
+/*
+ * folded stacks
+ */
+static char *
+sprint_folded_frame(const char *binary_filename,
+		    const char *symbol_name,
+		    unsigned long true_offset)
+{
+	if (symbol_name && symbol_name[0] != '\0') {
+#ifdef USE_DEMANGLE
+		char *demangled_name =
+			cplus_demangle(symbol_name,
+				       DMGL_AUTO | DMGL_PARAMS);
+		if (demangled_name)
+			return demangled_name;
+#endif
+		return xstrdup(symbol_name);
+	}
+
+	if (binary_filename)
+		return xasprintf("%s+%#lx", binary_filename, true_offset);
+
+	return xstrdup("[unknown]");
+}
+
+static void
+folded_put_call(void *dummy,
+		const char *binary_filename,
+		const char *symbol_name,
+		unwind_function_offset_t function_offset,
+		unsigned long true_offset,
+		const char *source_filename,
+		int source_line)
+{
+	raw_frames_put(NULL, true_offset, NULL)->name =
+		sprint_folded_frame(binary_filename, symbol_name, true_offset);
+}
+
+static void
+folded_put_error(void *dummy, const char *error, unsigned long true_offset)
+{
+	raw_frames_put(NULL, true_offset, NULL)->name = xstrdup("[unknown]");
+}
+
+/*
+ * Walk the current stack of the tracee and return its ID,
+ * or 0 if the stack is not available.  Unwinders without raw walks
+ * symbolize the frames right away.
+ */
+size_t
+unwind_tcb_stack_id(struct tcb *tcp)
+{
+#if defined(USE_LIBUNWIND) && (SUPPORTED_PERSONALITIES > 1)
+	if (tcp->currpers != DEFAULT_PERSONALITY)
+		return 0;
+#endif
+	if (!tcp->unwind_ctx)
+		return 0;
+
+	if (unwinder.tcb_walk_raw)
+		return walk_raw(tcp);
+
+	unwinder.tcb_walk(tcp, folded_put_call, folded_put_error, NULL);
+	return raw_stack_intern();
+}
+
+static void
+fprint_folded_call_cb(void *outf,
+		      const char *binary_filename,
+		      const char *symbol_name,
+		      unwind_function_offset_t function_offset,
+		      unsigned long true_offset,
+		      const char *source_filename,
+		      int source_line)
+{
+	char *name = sprint_folded_frame(binary_filename, symbol_name,
+					 true_offset);
+	fprintf(outf, ";%s", name);
+	free(name);
+}
+
+static void
+fprint_folded_error_cb(void *outf, const char *error,
+		       unsigned long true_offset)
+{
+	fputs(";[unknown]", outf);
+}
+
+/*
+ * Print the frames of the stack with the given ID outermost first,
+ * each preceded by a semicolon, as in the folded stack format.
+ */
+void
+unwind_fprint_folded(FILE *outf, size_t id)
+{
+	if (!id || id > raw_stacks_count)
+		return;
+
+	const struct raw_stack_t *st = &raw_stacks[id - 1];
+
+	for (size_t i = st->nframes; i > 0; --i) {
+		const struct raw_frame_t *f = &st->frames[i - 1];
+
+		if (f->name)
+			fprintf(outf, ";%s", f->name);
+		else if (f->error)
+			fprint_folded_error_cb(outf, f->error, f->true_offset);
+		else
+			unwinder.symbolize(f->module, f->true_offset,
+					   fprint_folded_call_cb,
+					   fprint_folded_error_cb, outf);
+	}
+}
+
 /*
  * printing stack
  */
@@ -312,6 +682,9 @@ unwind_tcb_print(struct tcb *tcp)
 		debug_func_msg("head: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
 		queue_drain(tcp->unwind_queue, true);
+	} else if (stack_trace_mode == STACK_TRACE_DEFERRED) {
+		tprintf_string(" > stack #%zu\n", walk_raw(tcp));
+		line_ended();
 	} else
 		unwinder.tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
 }
@@ -339,7 +712,11 @@ unwind_tcb_capture(struct tcb *tcp)
 	else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
-		unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
-				  tcp->unwind_queue);
+		if (stack_trace_mode == STACK_TRACE_DEFERRED)
+			queue_put_line(tcp->unwind_queue,
+				       sprint_stack_id(walk_raw(tcp)));
+		else
+			unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
+					  tcp->unwind_queue);
 	}
 }
@@ -33,6 +33,13 @@ typedef void (*unwind_call_action_fn)(void *data,
 typedef void (*unwind_error_action_fn)(void *data,
 				       const char *error,
 				       unsigned long true_offset);
+/*
+ * Type used in raw stacktrace walker: module is an opaque handle
+ * that stays valid until strace exits.
+ */
+typedef void (*unwind_raw_action_fn)(void *data,
+				     const void *module,
+				     unsigned long true_offset);
 
 struct unwind_unwinder_t {
 	const char *name;
@@ -48,6 +55,20 @@ struct unwind_unwinder_t {
 			   unwind_call_action_fn,
 			   unwind_error_action_fn,
 			   void *);
+
+	/*
+	 * Optional: walk the stack without symbolization,
+	 * and symbolize the recorded frames later.
+	 */
+	void   (*tcb_walk_raw)(struct tcb *,
+			       unwind_raw_action_fn,
+			       unwind_error_action_fn,
+			       void *);
+	void   (*symbolize)(const void *module,
+			    unsigned long true_offset,
+			    unwind_call_action_fn,
+			    unwind_error_action_fn,
+			    void *);
 };
 
 extern const struct unwind_unwinder_t unwinder;
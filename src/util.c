@@ -624,6 +624,26 @@ getfdinode(struct tcb *tcp, int fd)
 	return 0;
 }
 
+/*
+ * Describes the file descriptor the way printfd does with -yy: sockets
+ * are described by their addresses, other descriptors by their paths.
+ * Returns a newly allocated string, or NULL if the descriptor is not open.
+ */
+char *
+getfd_description(struct tcb *tcp, int fd)
+{
+	char path[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		return NULL;
+
+	const unsigned long inode = get_inode_of_socket_path(path);
+	const char *details = inode ? get_sockaddr_by_inode(tcp, fd, inode)
+				    : NULL;
+
+	return xstrdup(details ?: path);
+}
+
 static void
 print_string_in_angle_brackets(const char *str)
 {
@@ -1105,6 +1125,27 @@ proc_status_get_id_list(int proc_pid, int *id_buf, size_t id_buf_size,
 	return n;
 }
 
+int
+proc_status_get_tgid(int proc_pid)
+{
+	int tgid;
+
+	if (proc_status_get_id_list(proc_pid, &tgid, 1, "Tgid:\t", 0) != 1)
+		return proc_pid;
+
+	return tgid;
+}
+
+/* Returns the thread group id of the tcb, looking it up once.  */
+int
+get_tcb_tgid(struct tcb *tcp)
+{
+	if (!tcp->tgid)
+		tcp->tgid = proc_status_get_tgid(get_proc_pid(tcp->pid));
+
+	return tcp->tgid;
+}
+
 /*
  * Quote string `instr' of length `size'
  * Write up to (3 + `size' * 4) bytes to `outstr' buffer.
@@ -0,0 +1,38 @@
+/*
+ * Check --blocking-profile option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#ifdef __NR_nanosleep
+
+# include <stdio.h>
+# include <time.h>
+# include <unistd.h>
+
+int
+main(void)
+{
+	const struct timespec ts = { .tv_nsec = 20000000 };
+
+	/* Blocks for 20ms.  */
+	if (syscall(__NR_nanosleep, &ts, NULL))
+		perror_msg_and_fail("nanosleep");
+	/* Does not block, must not show up in the profile.  */
+	if (syscall(__NR_chdir, "."))
+		perror_msg_and_fail("chdir");
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_nanosleep")
+
+#endif
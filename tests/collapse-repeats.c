@@ -0,0 +1,35 @@
+/*
+ * Check --collapse-repeats option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	long rc = 0;
+
+	for (unsigned int i = 0; i < 4; ++i)
+		rc = fchdir(-1);
+	printf("fchdir(-1) = %s\n"
+	       "[previous line repeated 3 times over X ms]\n", sprintrc(rc));
+
+	rc = fchdir(-2);
+	rc = fchdir(-2);
+	printf("fchdir(-2) = %s\n"
+	       "[previous line repeated 1 time over X ms]\n", sprintrc(rc));
+
+	rc = fchdir(-1);
+	printf("fchdir(-1) = %s\n", sprintrc(rc));
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,2 @@
+#define PRINT_PID
+#include "entry-only.c"
@@ -0,0 +1,43 @@
+/*
+ * Check decoding of syscalls printed on entering only.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static void
+print_pid(void)
+{
+#ifdef PRINT_PID
+	printf("%-5d ", getpid());
+#endif
+}
+
+int
+main(void)
+{
+	static const char sample[] = "entry-only.sample";
+
+	syscall(__NR_chdir, sample);
+	print_pid();
+	printf("chdir(\"%s\") = ?\n", sample);
+
+	long rc = syscall(__NR_fchdir, -1);
+	print_pid();
+	printf("fchdir(-1) = %s\n", sprintrc(rc));
+
+	syscall(__NR_chdir, sample);
+	print_pid();
+	printf("chdir(\"%s\") = ?\n", sample);
+
+	print_pid();
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Check --file-summary option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+int
+main(void)
+{
+	static const char null[] = "/dev/null";
+	static const char missing[] = "/dev/file-summary-missing";
+	struct stat st;
+	char c;
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (stat(null, &st))
+			perror_msg_and_fail("stat: %s", null);
+	}
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (!access(missing, F_OK))
+			error_msg_and_fail("access: %s", missing);
+	}
+
+	int fd = open(null, O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", null);
+	close(fd);
+
+	const int dirfd = open("/dev", O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0)
+		perror_msg_and_fail("open: /dev");
+	fd = openat(dirfd, "null", O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("openat: null");
+	close(fd);
+	close(dirfd);
+
+	if (readlink(null, &c, 1) >= 0)
+		error_msg_and_fail("readlink: %s", null);
+
+	/* Relative paths are resolved against the working directory.  */
+	if (chdir("/dev"))
+		perror_msg_and_fail("chdir: /dev");
+	if (stat("null", &st))
+		perror_msg_and_fail("stat: null");
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Check --futex-profile option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <linux/futex.h>
+
+static int word;
+
+int
+main(void)
+{
+	const struct timespec timeout = { .tv_nsec = 1000000 };
+
+	/* The value does not match, the wait fails with EAGAIN.  */
+	syscall(__NR_futex, &word, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+	/* Nobody wakes the waiter up, the wait fails with ETIMEDOUT.  */
+	syscall(__NR_futex, &word, FUTEX_WAIT_PRIVATE, 0, &timeout, NULL, 0);
+	/* There are no waiters left to wake up.  */
+	syscall(__NR_futex, &word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+	printf("%#lx\n", (unsigned long) &word);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Check decoding of io_uring submission and completion queue rings.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "kernel_time_types.h"
+#define UAPI_LINUX_IO_URING_H_SKIP_LINUX_TIME_TYPES_H
+#include <linux/io_uring.h>
+
+static const uint64_t user_data[] = {
+	0xdeadbeef, 0xfacefeedcafef00dULL
+};
+
+/* Submits NOPs to the ring and prints the expected output.  */
+static void
+submit_nops(const int fd, const struct io_uring_params *params, char *sq,
+	    struct io_uring_sqe *sqes)
+{
+	uint32_t *sq_tail = (uint32_t *) (sq + params->sq_off.tail);
+	uint32_t *sq_array = (uint32_t *) (sq + params->sq_off.array);
+	const uint32_t tail = *sq_tail;
+	const uint32_t mask = params->sq_entries - 1;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(user_data); ++i) {
+		const uint32_t idx = (tail + i) & mask;
+
+		memset(&sqes[idx], 0, sizeof(sqes[idx]));
+		sqes[idx].opcode = IORING_OP_NOP;
+		sqes[idx].user_data = user_data[i];
+		sq_array[idx] = idx;
+	}
+	__atomic_store_n(sq_tail, tail + ARRAY_SIZE(user_data),
+			 __ATOMIC_RELEASE);
+
+	long rc = syscall(__NR_io_uring_enter, fd, ARRAY_SIZE(user_data),
+			  ARRAY_SIZE(user_data), IORING_ENTER_GETEVENTS,
+			  NULL, 0);
+	if (rc != (long) ARRAY_SIZE(user_data))
+		perror_msg_and_skip("io_uring_enter");
+
+	printf("io_uring_enter(%d, %zu, %zu, IORING_ENTER_GETEVENTS, NULL, 0"
+	       " /* sqes=[", fd, ARRAY_SIZE(user_data), ARRAY_SIZE(user_data));
+	for (unsigned int i = 0; i < ARRAY_SIZE(user_data); ++i) {
+		printf("%s{opcode=IORING_OP_NOP, flags=0, ioprio=0, fd=0"
+		       ", off=0, addr=0, len=0, nop_flags=0, user_data=%#jx"
+		       ", buf_index=0, personality=0, file_index=0, optval=0}",
+		       i ? ", " : "", (uintmax_t) user_data[i]);
+	}
+	printf("] */ /* cqes=[");
+	for (unsigned int i = 0; i < ARRAY_SIZE(user_data); ++i) {
+		printf("%s{user_data=%#jx, res=0, flags=0"
+		       ", opcode=IORING_OP_NOP, latency=SECONDS}",
+		       i ? ", " : "", (uintmax_t) user_data[i]);
+	}
+	printf("] */) = %ld\n", rc);
+}
+
+int
+main(void)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, 4, &params);
+	if (fd < 0)
+		perror_msg_and_skip("io_uring_setup");
+
+	const size_t sq_size = params.sq_off.array
+			       + params.sq_entries * sizeof(uint32_t);
+	const size_t cq_size = params.cq_off.cqes
+			       + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, IORING_OFF_SQ_RING);
+	char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, IORING_OFF_CQ_RING);
+	struct io_uring_sqe *sqes =
+		mmap(NULL, params.sq_entries * sizeof(*sqes),
+		     PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+		perror_msg_and_skip("mmap");
+
+	submit_nops(fd, &params, sq, sqes);
+
+	/*
+	 * A descriptor that is closed while the ring stays mapped
+	 * is no longer a ring, even if the close is not traced.
+	 */
+	if (close(fd))
+		perror_msg_and_fail("close");
+	if (open("/dev/null", O_RDONLY) != fd)
+		perror_msg_and_skip("open: /dev/null");
+
+	uint32_t *sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+	__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+
+	long rc = syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0);
+	printf("io_uring_enter(%d, 1, 0, 0, NULL, 0) = %s\n",
+	       fd, sprintrc(rc));
+
+	/*
+	 * With IORING_SETUP_NO_MMAP, the rings are in the memory
+	 * provided by the application: cq_off.user_addr for the rings,
+	 * sq_off.user_addr for the SQE array.
+	 */
+	const size_t page_size = get_page_size();
+	char *rings = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	struct io_uring_sqe *user_sqes =
+		mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (rings == MAP_FAILED || user_sqes == MAP_FAILED)
+		perror_msg_and_fail("mmap");
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_NO_MMAP;
+	params.cq_off.user_addr = (uintptr_t) rings;
+	params.sq_off.user_addr = (uintptr_t) user_sqes;
+
+	fd = syscall(__NR_io_uring_setup, 4, &params);
+	if (fd >= 0)
+		submit_nops(fd, &params, rings, user_sqes);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Check --poll-profile option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+
+int
+main(void)
+{
+	int fds[2];
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	if (write(fds[1], "", 1) != 1)
+		perror_msg_and_fail("write");
+
+	const int epfd = epoll_create1(0);
+	if (epfd < 0)
+		perror_msg_and_fail("epoll_create1");
+
+	/* The user data is not the descriptor, it is resolved via fdinfo. */
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u64 = 0xfacefeed,
+	};
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev))
+		perror_msg_and_fail("epoll_ctl");
+
+	/* epoll: 2 wakeups with 1 event each.  */
+	for (int i = 0; i < 2; ++i) {
+		if (epoll_wait(epfd, &ev, 1, 0) != 1)
+			perror_msg_and_fail("epoll_wait");
+	}
+
+	/* select: 1 wakeup with 1 event.  */
+	fd_set rfds;
+	struct timeval tv = { 0 };
+	FD_ZERO(&rfds);
+	FD_SET(fds[0], &rfds);
+	if (select(fds[0] + 1, &rfds, NULL, NULL, &tv) != 1)
+		perror_msg_and_fail("select");
+
+	/* poll: 1 wakeup with 1 event, and 1 empty wakeup.  */
+	struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+	if (poll(&pfd, 1, 10) != 1)
+		perror_msg_and_fail("poll");
+
+	char c;
+	if (read(fds[0], &c, 1) != 1)
+		perror_msg_and_fail("read");
+	if (poll(&pfd, 1, 1) != 0)
+		perror_msg_and_fail("poll");
+
+	printf("%d\n", fds[0]);
+	return 0;
+}
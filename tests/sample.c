@@ -0,0 +1,35 @@
+/*
+ * Check --sample option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 3)
+		error_msg_and_fail("usage: sample calls rate");
+
+	const int calls = atoi(argv[1]);
+	const int rate = atoi(argv[2]);
+
+	for (int i = 0; i < calls; ++i) {
+		const char *path = i % 2 ? "" : ".";
+		long rc = syscall(__NR_chdir, path);
+		if (i % rate == 0)
+			printf("chdir(\"%s\") = %s\n", path, sprintrc(rc));
+	}
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Check --control option.
+ *
+ * Copyright (c) 2026 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static FILE *fp;
+
+/* Sends the command and returns the last line of the response.  */
+static const char *
+command(const char *cmd, const char *expected_line)
+{
+	static char line[256];
+	bool found = !expected_line;
+
+	fprintf(fp, "%s\n", cmd);
+	fflush(fp);
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (expected_line && !strcmp(line, expected_line))
+			found = true;
+		if (!strcmp(line, "ok\n") || !strcmp(line, "error\n")) {
+			if (!found)
+				error_msg_and_fail("%s: no %s", cmd,
+						   expected_line);
+			return line;
+		}
+	}
+
+	perror_msg_and_fail("%s: no response", cmd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2)
+		error_msg_and_fail("usage: strace-control SOCKET");
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(argv[1]) >= sizeof(addr.sun_path))
+		error_msg_and_fail("%s: name is too long", argv[1]);
+	strcpy(addr.sun_path, argv[1]);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		perror_msg_and_fail("socket");
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_fail("connect: %s", argv[1]);
+	fp = fdopen(fd, "r+");
+	if (!fp)
+		perror_msg_and_fail("fdopen");
+
+	if (strcmp(command("set trace=fchdir", NULL), "ok\n"))
+		error_msg_and_fail("set trace=fchdir failed");
+
+	long rc = fchdir(-1);
+	printf("fchdir(-1) = %s\n", sprintrc(rc));
+
+	if (strcmp(command("set trace=no-such-syscall", NULL), "error\n"))
+		error_msg_and_fail("set trace=no-such-syscall succeeded");
+	if (strcmp(command("frobnicate", NULL), "error\n"))
+		error_msg_and_fail("frobnicate succeeded");
+
+	command("output off", "ok\n");
+	rc = fchdir(-2);
+	command("stats", "output off\n");
+	command("output on", "ok\n");
+	command("stats", "tracees 1\n");
+
+	command("path add /", "ok\n");
+	rc = fchdir(-4);
+	command("path clear", "ok\n");
+
+	rc = fchdir(-3);
+	printf("fchdir(-3) = %s\n", sprintrc(rc));
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}